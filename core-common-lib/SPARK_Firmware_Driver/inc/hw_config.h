@@ -191,6 +191,7 @@ void CC3000_Write_Enable_Pin(unsigned char val);
 /* Serial Flash Hardware related methods */
 void sFLASH_SPI_DeInit(void);
 void sFLASH_SPI_Init(void);
+void sFLASH_DMA_Config(uint8_t* buffer, uint16_t NumData);
 void sFLASH_CS_LOW(void);
 void sFLASH_CS_HIGH(void);
 
@@ -170,6 +170,16 @@
 
 #define sFLASH_SPI_BAUDRATE_PRESCALER		SPI_BaudRatePrescaler_2
 
+/* sFLASH shares SPI2, and so its DMA channels, with the CC3000 */
+#define sFLASH_SPI_DMA_CLK                  RCC_AHBPeriph_DMA1
+#define sFLASH_SPI_RX_DMA_CHANNEL           DMA1_Channel4
+#define sFLASH_SPI_TX_DMA_CHANNEL           DMA1_Channel5
+#define sFLASH_SPI_RX_DMA_TCFLAG            DMA1_FLAG_TC4
+#define sFLASH_SPI_TX_DMA_TCFLAG            DMA1_FLAG_TC5
+#define sFLASH_SPI_RX_DMA_IRQn              DMA1_Channel4_IRQn
+
+#define sFLASH_SPI_DR_BASE                  ((uint32_t)0x4000380C)	/* SPI2_BASE | 0x0C */
+
 #define USB_DISCONNECT_GPIO_PIN           	GPIO_Pin_10
 #define USB_DISCONNECT_GPIO_PORT       		GPIOB
 #define USB_DISCONNECT_GPIO_CLK		  		RCC_APB2Periph_GPIOB
@@ -179,6 +189,7 @@
 
 //NVIC Priorities based on NVIC_PriorityGroup_4
 #define DMA1_CHANNEL5_IRQ_PRIORITY			0	//CC3000_SPI_TX_DMA Interrupt
+#define DMA1_CHANNEL4_IRQ_PRIORITY			0	//sFLASH_SPI_RX_DMA Interrupt
 #define EXTI15_10_IRQ_PRIORITY				1	//CC3000_WIFI_INT_EXTI & User Interrupt
 #define USB_LP_IRQ_PRIORITY					2	//USB_LP_CAN1_RX0 Interrupt
 #define RTCALARM_IRQ_PRIORITY				3	//RTC Alarm Interrupt
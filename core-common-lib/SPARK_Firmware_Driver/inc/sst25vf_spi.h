@@ -51,6 +51,9 @@
 #define sFLASH_DUMMY_BYTE         		0xFF
 #define sFLASH_PAGESIZE					0x1000		/* 4096 bytes */
 
+/* Reads at least this long go over DMA */
+#define sFLASH_DMA_MIN_READ				16
+
 #define sFLASH_SST25VF040_ID			0xBF258D	/* JEDEC Read-ID Data */
 #define sFLASH_SST25VF016_ID			0xBF2541	/* JEDEC Read-ID Data */
 
@@ -58,12 +61,19 @@
 extern "C" {
 #endif /* __cplusplus */
 
+/* Called from interrupt context once a read started by sFLASH_ReadBufferDMA() is done */
+typedef void (*sFLASH_DMA_Callback_TypeDef)(void);
+
 /* High level functions. */
 void sFLASH_Init(void);
 void sFLASH_EraseSector(uint32_t SectorAddr);
+void sFLASH_EraseSectorStart(uint32_t SectorAddr);
 void sFLASH_EraseBulk(void);
 void sFLASH_WriteBuffer(const uint8_t *pBuffer, uint32_t WriteAddr, uint32_t NumByteToWrite);
 void sFLASH_ReadBuffer(uint8_t *pBuffer, uint32_t ReadAddr, uint32_t NumByteToRead);
+void sFLASH_ReadBufferDMA(uint8_t *pBuffer, uint32_t ReadAddr, uint32_t NumByteToRead, sFLASH_DMA_Callback_TypeDef Callback);
+int sFLASH_DMA_InProgress(void);
+void sFLASH_DMA_IntHandler(void);
 uint32_t sFLASH_ReadID(void);
 
 /* Flash Self Test Routine */
@@ -85,6 +85,9 @@ uint32_t External_Flash_Address = 0;
 uint32_t Internal_Flash_Data = 0;
 uint8_t External_Flash_Data[4];
 uint16_t Flash_Update_Index = 0;
+uint32_t External_Flash_Start_Address = 0;
+uint32_t External_Flash_Erase_Address = 0;	/* Sectors of the OTA image below this address are erased */
+uint32_t External_Flash_Image_CRC = 0;		/* CRC-32 of the OTA image chunks accepted so far */
 uint32_t EraseCounter = 0;
 uint32_t NbrOfPage = 0;
 volatile FLASH_Status FLASHStatus = FLASH_COMPLETE;
@@ -904,6 +907,7 @@ void sFLASH_SPI_Init(void)
 {
 	GPIO_InitTypeDef GPIO_InitStructure;
 	SPI_InitTypeDef  SPI_InitStructure;
+	NVIC_InitTypeDef NVIC_InitStructure;
 
 	/* sFLASH_MEM_CS_GPIO, sFLASH_SPI_MOSI_GPIO, sFLASH_SPI_MISO_GPIO
 	   and sFLASH_SPI_SCK_GPIO Periph clock enable */
@@ -953,6 +957,53 @@ void sFLASH_SPI_Init(void)
 
 	/*!< Enable the sFLASH_SPI  */
 	SPI_Cmd(sFLASH_SPI, ENABLE);
+
+	/* Configure the SPI DMA RX Channel interrupt, which sFLASH_ReadBufferDMA()
+	   enables when it is given a callback */
+	NVIC_InitStructure.NVIC_IRQChannel = sFLASH_SPI_RX_DMA_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = DMA1_CHANNEL4_IRQ_PRIORITY;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0x00;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+}
+
+/**
+  * @brief  Configure the DMA channels for sFLASH to read NumData bytes into buffer
+  *         while clocking out dummy bytes. The channels are left disabled.
+  * @param  buffer: where the bytes read end up
+  * @param  NumData: number of bytes to read
+  * @retval None
+  */
+void sFLASH_DMA_Config(uint8_t* buffer, uint16_t NumData)
+{
+	static const uint8_t Dummy_Byte = sFLASH_DUMMY_BYTE;
+	DMA_InitTypeDef DMA_InitStructure;
+
+	RCC_AHBPeriphClockCmd(sFLASH_SPI_DMA_CLK, ENABLE);
+
+	DMA_InitStructure.DMA_PeripheralBaseAddr = sFLASH_SPI_DR_BASE;
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+	DMA_InitStructure.DMA_BufferSize = NumData;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_VeryHigh;
+	DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+
+	/* DMA used for Reception */
+	DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t) buffer;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+	DMA_DeInit(sFLASH_SPI_RX_DMA_CHANNEL);
+	DMA_Init(sFLASH_SPI_RX_DMA_CHANNEL, &DMA_InitStructure);
+
+	/* DMA used for Transmission, the same dummy byte over and over */
+	DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t) &Dummy_Byte;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Disable;
+	DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+	DMA_DeInit(sFLASH_SPI_TX_DMA_CHANNEL);
+	DMA_Init(sFLASH_SPI_TX_DMA_CHANNEL, &DMA_InitStructure);
 }
 
 /* Select sFLASH: Chip Select pin low */
@@ -1302,6 +1353,50 @@ void FLASH_Restore(uint32_t sFLASH_Address)
 #endif
 }
 
+#ifdef SPARK_SFLASH_ENABLE
+
+/* CRC-32 (IEEE 802.3) a nibble at a time */
+static const uint32_t CRC32_Nibble_Table[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+/* Continues crc, which starts out as 0, over bufferSize more bytes */
+static uint32_t Update_CRC32(uint32_t crc, const uint8_t *pBuffer, uint32_t bufferSize)
+{
+	crc = ~crc;
+
+	while (bufferSize--)
+	{
+		crc ^= *pBuffer++;
+		crc = (crc >> 4) ^ CRC32_Nibble_Table[crc & 0x0F];
+		crc = (crc >> 4) ^ CRC32_Nibble_Table[crc & 0x0F];
+	}
+
+	return ~crc;
+}
+
+/* CRC-32 of what the SPI Flash holds from startAddress up to endAddress */
+static uint32_t FLASH_Read_CRC32(uint32_t startAddress, uint32_t endAddress)
+{
+	uint8_t readBuffer[64];
+	uint32_t length, crc = 0;
+
+	for (; startAddress < endAddress; startAddress += length)
+	{
+		length = endAddress - startAddress;
+		if (length > sizeof(readBuffer))
+			length = sizeof(readBuffer);
+
+		sFLASH_ReadBuffer(readBuffer, startAddress, length);
+		crc = Update_CRC32(crc, readBuffer, length);
+	}
+
+	return crc;
+}
+
+#endif
+
 void FLASH_Begin(uint32_t sFLASH_Address)
 {
 #ifdef SPARK_SFLASH_ENABLE
@@ -1315,16 +1410,15 @@ void FLASH_Begin(uint32_t sFLASH_Address)
 	//BKP_WriteBackupRegister(BKP_DR10, 0x5555);
 
 	Flash_Update_Index = 0;
+	External_Flash_Start_Address = sFLASH_Address;
 	External_Flash_Address = sFLASH_Address;
+	External_Flash_Image_CRC = 0;
 
-	/* Define the number of External Flash pages to be erased */
-	NbrOfPage = EXTERNAL_FLASH_BLOCK_SIZE / sFLASH_PAGESIZE;
-
-	/* Erase the SPI Flash pages */
-	for (EraseCounter = 0; (EraseCounter < NbrOfPage); EraseCounter++)
-	{
-		sFLASH_EraseSector(sFLASH_Address + (sFLASH_PAGESIZE * EraseCounter));
-	}
+	/* Only the first sector is erased up front, and without waiting for it. FLASH_Update()
+	 * erases the others just ahead of the image as it grows, instead of blocking here while
+	 * the whole block is erased. */
+	sFLASH_EraseSectorStart(sFLASH_Address);
+	External_Flash_Erase_Address = sFLASH_Address + sFLASH_PAGESIZE;
 
 #endif
 }
@@ -1333,27 +1427,67 @@ uint16_t FLASH_Update(uint8_t *pBuffer, uint32_t bufferSize)
 {
 #ifdef SPARK_SFLASH_ENABLE
 
-	uint8_t *writeBuffer = pBuffer;
-	uint8_t readBuffer[bufferSize];
+	uint8_t readBuffer[64];
+	uint32_t offset, length;
+	uint32_t endAddress = External_Flash_Address + bufferSize;
+	uint32_t imageEndAddress = External_Flash_Start_Address + EXTERNAL_FLASH_BLOCK_SIZE;
+	int verified = 1;
+
+	/* Never write past the OTA block. Whatever follows it in the SPI Flash, such as the
+	 * random seeds, must not be erased. The chunk is dropped, so the index doesn't move. */
+	if (endAddress > imageEndAddress)
+	{
+		return Flash_Update_Index;
+	}
+
+	/* Make sure the whole chunk lands on erased sectors. Normally the one it needs was
+	 * already erased after the previous chunk. */
+	while (External_Flash_Erase_Address < endAddress &&
+			External_Flash_Erase_Address < imageEndAddress)
+	{
+		sFLASH_EraseSector(External_Flash_Erase_Address);
+		External_Flash_Erase_Address += sFLASH_PAGESIZE;
+	}
 
 	/* Write Data Buffer to SPI Flash memory */
-	sFLASH_WriteBuffer(writeBuffer, External_Flash_Address, bufferSize);
+	sFLASH_WriteBuffer(pBuffer, External_Flash_Address, bufferSize);
 
-	/* Read Data Buffer from SPI Flash memory */
-	sFLASH_ReadBuffer(readBuffer, External_Flash_Address, bufferSize);
+	/* Read it back a piece at a time, and compare with the Data Buffer */
+	for (offset = 0; verified && offset < bufferSize; offset += length)
+	{
+		length = bufferSize - offset;
+		if (length > sizeof(readBuffer))
+			length = sizeof(readBuffer);
 
-	/* Is the Data Buffer successfully programmed to SPI Flash memory */
-	if (0 == memcmp(writeBuffer, readBuffer, bufferSize))
+		sFLASH_ReadBuffer(readBuffer, External_Flash_Address + offset, length);
+		verified = (0 == memcmp(pBuffer + offset, readBuffer, length));
+	}
+
+	if (verified)
 	{
-		External_Flash_Address += bufferSize;
+		External_Flash_Image_CRC = Update_CRC32(External_Flash_Image_CRC, pBuffer, bufferSize);
+		External_Flash_Address = endAddress;
 		Flash_Update_Index += 1;
+
+		/* Start erasing the sector the next chunk runs into, if any. The erase then goes on
+		 * while the chunk is acknowledged and the next one is received. */
+		if (External_Flash_Erase_Address < External_Flash_Address + bufferSize &&
+			External_Flash_Erase_Address < imageEndAddress)
+		{
+			sFLASH_EraseSectorStart(External_Flash_Erase_Address);
+			External_Flash_Erase_Address += sFLASH_PAGESIZE;
+		}
 	}
 	else
 	{
 		/* Erase the problematic SPI Flash pages and back off the chunk index */
 		External_Flash_Address = ((uint32_t)(External_Flash_Address / sFLASH_PAGESIZE)) * sFLASH_PAGESIZE;
 		sFLASH_EraseSector(External_Flash_Address);
+		External_Flash_Erase_Address = External_Flash_Address + sFLASH_PAGESIZE;
 		Flash_Update_Index = (uint16_t)((External_Flash_Address - EXTERNAL_FLASH_OTA_ADDRESS) / bufferSize);
+
+		/* The chunks dropped from the image must come out of its CRC too */
+		External_Flash_Image_CRC = FLASH_Read_CRC32(External_Flash_Start_Address, External_Flash_Address);
 	}
 
 	LED_Toggle(LED_RGB);
@@ -1367,10 +1501,15 @@ void FLASH_End(void)
 {
 #ifdef SPARK_SFLASH_ENABLE
 
-	FLASH_OTA_Update_SysFlag = 0x0005;
-	Save_SystemFlags();
+	/* Only have the bootloader install the image if the SPI Flash still holds exactly the
+	 * chunks that were accepted. Otherwise the current firmware simply keeps running. */
+	if (FLASH_Read_CRC32(External_Flash_Start_Address, External_Flash_Address) == External_Flash_Image_CRC)
+	{
+		FLASH_OTA_Update_SysFlag = 0x0005;
+		Save_SystemFlags();
 
-	BKP_WriteBackupRegister(BKP_DR10, 0x0005);
+		BKP_WriteBackupRegister(BKP_DR10, 0x0005);
+	}
 
     USB_Cable_Config(DISABLE);
 
@@ -33,8 +33,21 @@ static void sFLASH_WriteBytes(const uint8_t *pBuffer, uint32_t WriteAddr, uint32
 static void sFLASH_WriteEnable(void);
 static void sFLASH_WriteDisable(void);
 static void sFLASH_WaitForWriteEnd(void);
+static void sFLASH_WaitForIdle(void);
+static void sFLASH_DMA_StartNext(void);
+static void sFLASH_DMA_TransferComplete(void);
 static uint8_t sFLASH_SendByte(uint8_t byte);
 
+/* Set while a sector erase started by sFLASH_EraseSectorStart() may still be running */
+static uint8_t sFLASH_ErasePending = 0;
+
+/* State of a read started by sFLASH_ReadBufferDMA() */
+static volatile uint8_t sFLASH_DMAPending = 0;
+static uint8_t *sFLASH_DMABuffer;
+static uint32_t sFLASH_DMARemaining;
+static uint16_t sFLASH_DMASavedCR2;
+static sFLASH_DMA_Callback_TypeDef sFLASH_DMACallback;
+
 /**
   * @brief Initializes SPI Flash
   * @param void
@@ -47,6 +60,8 @@ void sFLASH_Init(void)
   /* Initializes the peripherals used by the SPI FLASH driver */
   sFLASH_SPI_Init();
 
+  sFLASH_WaitForIdle();
+
   /* Disable the write access to the FLASH */
   sFLASH_WriteDisable();
 
@@ -86,6 +101,22 @@ void sFLASH_Init(void)
   */
 void sFLASH_EraseSector(uint32_t SectorAddr)
 {
+  sFLASH_EraseSectorStart(SectorAddr);
+
+  /* Wait till the end of Flash writing */
+  sFLASH_WaitForIdle();
+}
+
+/**
+  * @brief  Starts erasing the specified FLASH sector and returns without waiting
+  *         for the erase to finish. The next call into this driver waits for it.
+  * @param  SectorAddr: address of the sector to erase.
+  * @retval None
+  */
+void sFLASH_EraseSectorStart(uint32_t SectorAddr)
+{
+  sFLASH_WaitForIdle();
+
   /* Enable the write access to the FLASH */
   sFLASH_WriteEnable();
 
@@ -103,8 +134,7 @@ void sFLASH_EraseSector(uint32_t SectorAddr)
   /* Deselect the FLASH: Chip Select high */
   sFLASH_CS_HIGH();
 
-  /* Wait till the end of Flash writing */
-  sFLASH_WaitForWriteEnd();
+  sFLASH_ErasePending = 1;
 }
 
 /**
@@ -114,6 +144,8 @@ void sFLASH_EraseSector(uint32_t SectorAddr)
   */
 void sFLASH_EraseBulk(void)
 {
+  sFLASH_WaitForIdle();
+
   /* Enable the write access to the FLASH */
   sFLASH_WriteEnable();
 
@@ -235,6 +267,8 @@ void sFLASH_WriteBuffer(const uint8_t *pBuffer, uint32_t WriteAddr, uint32_t Num
 {
   uint32_t evenBytes;
 
+  sFLASH_WaitForIdle();
+
   /* If write starts at an odd address, need to use single byte write
    * to write the first address. */
   if ((WriteAddr & 0x1) == 0x1)
@@ -272,6 +306,16 @@ void sFLASH_WriteBuffer(const uint8_t *pBuffer, uint32_t WriteAddr, uint32_t Num
   */
 void sFLASH_ReadBuffer(uint8_t* pBuffer, uint32_t ReadAddr, uint32_t NumByteToRead)
 {
+  if (NumByteToRead >= sFLASH_DMA_MIN_READ)
+  {
+    /* Let the DMA clock the data in, and wait for it here */
+    sFLASH_ReadBufferDMA(pBuffer, ReadAddr, NumByteToRead, NULL);
+    sFLASH_WaitForIdle();
+    return;
+  }
+
+  sFLASH_WaitForIdle();
+
   /* Select the FLASH: Chip Select low */
   sFLASH_CS_LOW();
 
@@ -297,6 +341,139 @@ void sFLASH_ReadBuffer(uint8_t* pBuffer, uint32_t ReadAddr, uint32_t NumByteToRe
   sFLASH_CS_HIGH();
 }
 
+/**
+  * @brief  Starts reading a block of data from the FLASH over DMA, and returns
+  *         while the data is still coming in. The next call into this driver
+  *         waits for the read to finish.
+  * @note   The callback runs in interrupt context, and must not call into this
+  *         driver. Without a callback, sFLASH_DMA_InProgress() tells when the
+  *         data is in.
+  * @param  pBuffer: pointer to the buffer that receives the data read from the FLASH.
+  * @param  ReadAddr: FLASH's internal address to read from.
+  * @param  NumByteToRead: number of bytes to read from the FLASH, not zero.
+  * @param  Callback: function to call once the data is in pBuffer, or NULL.
+  * @retval None
+  */
+void sFLASH_ReadBufferDMA(uint8_t* pBuffer, uint32_t ReadAddr, uint32_t NumByteToRead, sFLASH_DMA_Callback_TypeDef Callback)
+{
+  sFLASH_WaitForIdle();
+
+  /* Select the FLASH: Chip Select low */
+  sFLASH_CS_LOW();
+
+  /* Send "Read from Memory " instruction */
+  sFLASH_SendByte(sFLASH_CMD_READ);
+
+  /* Send ReadAddr high nibble address byte to read from */
+  sFLASH_SendByte((ReadAddr & 0xFF0000) >> 16);
+  /* Send ReadAddr medium nibble address byte to read from */
+  sFLASH_SendByte((ReadAddr& 0xFF00) >> 8);
+  /* Send ReadAddr low nibble address byte to read from */
+  sFLASH_SendByte(ReadAddr & 0xFF);
+
+  sFLASH_DMABuffer = pBuffer;
+  sFLASH_DMARemaining = NumByteToRead;
+  sFLASH_DMACallback = Callback;
+  sFLASH_DMAPending = 1;
+
+  /* The CC3000 driver may or may not have the SPI DMA requests enabled */
+  sFLASH_DMASavedCR2 = sFLASH_SPI->CR2;
+  SPI_I2S_DMACmd(sFLASH_SPI, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, ENABLE);
+
+  sFLASH_DMA_StartNext();
+}
+
+/**
+  * @brief  Tells whether a read started by sFLASH_ReadBufferDMA() is still going on.
+  * @param  None
+  * @retval 1 while the read is going on, 0 once the data is in.
+  */
+int sFLASH_DMA_InProgress(void)
+{
+  /* Reads without a callback have no interrupt, and are finished from here */
+  if (sFLASH_DMAPending && sFLASH_DMACallback == NULL &&
+      DMA_GetFlagStatus(sFLASH_SPI_RX_DMA_TCFLAG) != RESET)
+  {
+    sFLASH_DMA_TransferComplete();
+  }
+
+  return sFLASH_DMAPending;
+}
+
+/**
+  * @brief  Handles the SPI DMA RX Channel interrupt, at the end of each part of
+  *         a read started by sFLASH_ReadBufferDMA() with a callback.
+  * @param  None
+  * @retval None
+  */
+void sFLASH_DMA_IntHandler(void)
+{
+  if (DMA_GetFlagStatus(sFLASH_SPI_RX_DMA_TCFLAG) != RESET)
+  {
+    sFLASH_DMA_TransferComplete();
+  }
+}
+
+/**
+  * @brief  Starts the DMA on the next part of the read, at most 65535 bytes.
+  * @param  None
+  * @retval None
+  */
+static void sFLASH_DMA_StartNext(void)
+{
+  uint16_t NumData = sFLASH_DMARemaining > 0xFFFF ? 0xFFFF : sFLASH_DMARemaining;
+
+  sFLASH_DMA_Config(sFLASH_DMABuffer, NumData);
+  sFLASH_DMABuffer += NumData;
+  sFLASH_DMARemaining -= NumData;
+
+  if (sFLASH_DMACallback != NULL)
+  {
+    DMA_ITConfig(sFLASH_SPI_RX_DMA_CHANNEL, DMA_IT_TC, ENABLE);
+  }
+
+  /* Enable DMA RX Channel first, so that it is ready for the first byte */
+  DMA_Cmd(sFLASH_SPI_RX_DMA_CHANNEL, ENABLE);
+  /* Enable DMA TX Channel */
+  DMA_Cmd(sFLASH_SPI_TX_DMA_CHANNEL, ENABLE);
+}
+
+/**
+  * @brief  Moves on to the next part of the read, or ends it and hands the bus
+  *         back once all the data is in.
+  * @param  None
+  * @retval None
+  */
+static void sFLASH_DMA_TransferComplete(void)
+{
+  sFLASH_DMA_Callback_TypeDef Callback = sFLASH_DMACallback;
+
+  DMA_ClearFlag(sFLASH_SPI_RX_DMA_TCFLAG | sFLASH_SPI_TX_DMA_TCFLAG);
+
+  if (sFLASH_DMARemaining)
+  {
+    sFLASH_DMA_StartNext();
+    return;
+  }
+
+  DMA_ITConfig(sFLASH_SPI_RX_DMA_CHANNEL, DMA_IT_TC, DISABLE);
+  DMA_Cmd(sFLASH_SPI_RX_DMA_CHANNEL, DISABLE);
+  DMA_Cmd(sFLASH_SPI_TX_DMA_CHANNEL, DISABLE);
+
+  /* Restore the SPI DMA requests before the CC3000 can get the bus */
+  sFLASH_SPI->CR2 = sFLASH_DMASavedCR2;
+
+  /* Deselect the FLASH: Chip Select high */
+  sFLASH_CS_HIGH();
+
+  sFLASH_DMAPending = 0;
+
+  if (Callback != NULL)
+  {
+    Callback();
+  }
+}
+
 /**
   * @brief  Reads FLASH identification.
   * @param  None
@@ -306,6 +483,8 @@ uint32_t sFLASH_ReadID(void)
 {
   uint8_t byte[3];
 
+  sFLASH_WaitForIdle();
+
   /* Select the FLASH: Chip Select low */
   sFLASH_CS_LOW();
 
@@ -411,6 +590,23 @@ static void sFLASH_WaitForWriteEnd(void)
   sFLASH_CS_HIGH();
 }
 
+/**
+  * @brief  Waits for a read started by sFLASH_ReadBufferDMA() or an erase
+  *         started by sFLASH_EraseSectorStart(), if any.
+  * @param  None
+  * @retval None
+  */
+static void sFLASH_WaitForIdle(void)
+{
+  while (sFLASH_DMA_InProgress());
+
+  if (sFLASH_ErasePending)
+  {
+    sFLASH_WaitForWriteEnd();
+    sFLASH_ErasePending = 0;
+  }
+}
+
 int sFLASH_SelfTest(void)
 {
   uint32_t FLASH_TestAddress = 0x000000;
@@ -90,7 +90,8 @@ extern "C" {
 	 * \param length   length of the input data
 	 * \param iv       initialization vector (updated after use)
 	 * \param input    buffer holding the input data
-	 * \param output   buffer holding the output data
+	 * \param output   buffer holding the output data, which may be
+	 *                 input itself to work in place
 	 */
 	void aes_crypt_cbc(aes_context * ctx,
 			   int mode,
@@ -118,6 +119,33 @@ extern "C" {
 			      const unsigned char *input,
 			      unsigned char *output);
 
+	/**
+	 * \brief          AES-CTR buffer encryption/decryption
+	 *
+	 * Both directions are the same operation. The counter is incremented
+	 * as one 128-bit big-endian number, so a 12-byte nonce followed by a
+	 * 4-byte zero counter gives every block of up to 64 GB its own key
+	 * stream.
+	 *
+	 * \param ctx           AES context, set up with aes_setkey_enc()
+	 * \param length        length of the input data
+	 * \param nc_off        offset in stream_block (updated after use),
+	 *                      0 before the first call
+	 * \param nonce_counter 128-bit nonce and counter (updated after use)
+	 * \param stream_block  saved key stream for resuming mid-block
+	 *                      (updated after use)
+	 * \param input         buffer holding the input data
+	 * \param output        buffer holding the output data, which may be
+	 *                      input itself to work in place
+	 */
+	void aes_crypt_ctr(aes_context * ctx,
+			   int length,
+			   int *nc_off,
+			   unsigned char nonce_counter[16],
+			   unsigned char stream_block[16],
+			   const unsigned char *input,
+			   unsigned char *output);
+
 	/**
 	 * \brief          Checkup routine
 	 *
@@ -104,6 +104,40 @@ extern "C" {
 	 */
 	int mpi_grow(mpi * X, int nblimbs);
 
+	/**
+	 * \brief          Take limbs from the static arena instead of the
+	 *                 heap until the matching mpi_arena_end()
+	 *
+	 * \note           Scopes nest. The arena empties itself as the mpis
+	 *                 grown inside a scope are freed, so they should not
+	 *                 outlive it; any that do stay valid but pin their
+	 *                 part of the arena until freed. Requests that do not
+	 *                 fit fall back to the heap. Without
+	 *                 TROPICSSL_MPI_ARENA_SIZE this does nothing.
+	 */
+	void mpi_arena_begin(void);
+
+	/**
+	 * \brief          Close the scope opened by mpi_arena_begin()
+	 */
+	void mpi_arena_end(void);
+
+	/**
+	 * \brief          Return the number of arena bytes in use
+	 */
+	int mpi_arena_used(void);
+
+	/**
+	 * \brief          Return the most arena bytes ever in use at once
+	 */
+	int mpi_arena_peak(void);
+
+	/**
+	 * \brief          Return how many allocations in a scope did not fit
+	 *                 in the arena and went to the heap
+	 */
+	int mpi_arena_misses(void);
+
 	/**
 	 * \brief          Copy the contents of Y into X
 	 *
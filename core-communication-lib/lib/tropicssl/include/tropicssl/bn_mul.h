@@ -44,6 +44,7 @@
  *         . PowerPC, 64-bit      . TriCore
  *         . SPARC v8             . ARM v3+
  *         . Alpha                . MIPS32
+ *         . ARM Thumb-2
  *         . C, longlong          . C, generic
  */
 #ifndef TROPICSSL_BN_MUL_H
@@ -489,7 +490,33 @@
 
 #endif /* TriCore */
 
-#if defined(__arm__)
+#if defined(__arm__) && defined(__thumb2__)
+
+/*
+ * Thumb-2 (Cortex-M3). The whole run of limbs is one asm statement, so
+ * the compiler can't reuse r0-r2 between limbs. UMAAL would fold the carry
+ * add into the multiply, but it is ARMv7E-M only, so UMLAL it is:
+ *
+ *      r2:r1 = d + s * b,  then  c:d = r2:r1 + c
+ */
+#define MULADDC_INIT                            \
+    asm(
+
+#define MULADDC_CORE                            \
+    "ldr    r0, [%0], #4        \n\t"           \
+    "ldr    r1, [%1]            \n\t"           \
+    "movs   r2, #0              \n\t"           \
+    "umlal  r1, r2, r0, %3      \n\t"           \
+    "adds   r1, r1, %2          \n\t"           \
+    "adc    %2, r2, #0          \n\t"           \
+    "str    r1, [%1], #4        \n\t"
+
+#define MULADDC_STOP                            \
+    : "+r" (s), "+r" (d), "+r" (c)              \
+    : "r" (b)                                   \
+    : "r0", "r1", "r2", "cc", "memory" );
+
+#elif defined(__arm__)
 
 #define MULADDC_INIT                            \
     asm( "ldr    r0, %0         " :: "m" (s));  \
@@ -133,6 +133,14 @@
  */
 #define TROPICSSL_BIGNUM_C
 
+/*
+ * Size in bytes of the static arena that mpi limbs come from inside
+ * mpi_arena_begin() / mpi_arena_end(). It is permanent .bss. A cloud
+ * handshake peaks at 3972 bytes with the 32-bit limbs of the Core, see
+ * mpi_arena_peak(). Comment out to always use the heap.
+ */
+#define TROPICSSL_MPI_ARENA_SIZE	4096
+
 /*
  * Module:  library/camellia.c
  * Caller:
@@ -776,19 +776,28 @@ void aes_crypt_cbc(aes_context * ctx,
 #endif
 
 	if (mode == AES_DECRYPT) {
-		while (length > 0) {
-			memcpy(temp, input, 16);
-			aes_crypt_ecb(ctx, mode, input, output);
+		const unsigned char *chain;
 
-			for (i = 0; i < 16; i++)
-				output[i] = (unsigned char)(output[i] ^ iv[i]);
+		if (length <= 0)
+			return;
 
-			memcpy(iv, temp, 16);
+		/*
+		 * Last block first: the block each one chains from is then
+		 * still ciphertext even when decrypting in place, so nothing
+		 * is copied but the next IV
+		 */
+		memcpy(temp, input + length - 16, 16);
 
-			input += 16;
-			output += 16;
-			length -= 16;
+		for (length -= 16; length >= 0; length -= 16) {
+			aes_crypt_ecb(ctx, mode, input + length, output + length);
+
+			chain = length > 0 ? input + length - 16 : iv;
+			for (i = 0; i < 16; i++)
+				output[length + i] =
+				    (unsigned char)(output[length + i] ^ chain[i]);
 		}
+
+		memcpy(iv, temp, 16);
 	} else {
 		while (length > 0) {
 			for (i = 0; i < 16; i++)
@@ -842,6 +851,61 @@ void aes_crypt_cfb128(aes_context * ctx,
 	*iv_off = n;
 }
 
+/*
+ * AES-CTR buffer encryption/decryption
+ */
+void aes_crypt_ctr(aes_context * ctx,
+		   int length,
+		   int *nc_off,
+		   unsigned char nonce_counter[16],
+		   unsigned char stream_block[16],
+		   const unsigned char *input,
+		   unsigned char *output)
+{
+	int i, n = *nc_off;
+	unsigned long x, k;
+
+	/*
+	 * Use up what is left of the last stream block first
+	 */
+	while (n != 0 && length > 0) {
+		*output++ = (unsigned char)(*input++ ^ stream_block[n]);
+		n = (n + 1) & 0x0F;
+		length--;
+	}
+
+	while (length > 0) {
+		aes_crypt_ecb(ctx, AES_ENCRYPT, nonce_counter, stream_block);
+
+		for (i = 15; i >= 0; i--)
+			if (++nonce_counter[i] != 0)
+				break;
+
+		if (length < 16) {
+			for (n = 0; n < length; n++)
+				output[n] = (unsigned char)(input[n] ^ stream_block[n]);
+			break;
+		}
+
+		/*
+		 * Whole blocks are XORed a word at a time; memcpy keeps
+		 * this safe for unaligned input and output
+		 */
+		for (i = 0; i < 16; i += sizeof(x)) {
+			memcpy(&x, input + i, sizeof(x));
+			memcpy(&k, stream_block + i, sizeof(k));
+			x ^= k;
+			memcpy(output + i, &x, sizeof(x));
+		}
+
+		input += 16;
+		output += 16;
+		length -= 16;
+	}
+
+	*nc_off = n;
+}
+
 #if defined(TROPICSSL_SELF_TEST)
 
 #include <stdio.h>
@@ -62,6 +62,152 @@
 #define BITS_TO_LIMBS(i)  (((i) + biL - 1) / biL)
 #define CHARS_TO_LIMBS(i) (((i) + ciL - 1) / ciL)
 
+#if defined(TROPICSSL_MPI_ARENA_SIZE)
+
+/*
+ * Limbs allocated between mpi_arena_begin() and mpi_arena_end() are
+ * carved off the top of a static stack instead of the heap. Each block
+ * starts with a header pointing at the block below it. Freeing the top
+ * block pops it together with any already freed blocks under it, and
+ * growing the top block extends it in place, so the temporaries of one
+ * RSA operation come and go without fragmenting anything. Requests that
+ * do not fit fall back to malloc().
+ */
+typedef union {
+	struct {
+		unsigned short prev;	/* offset of the block below */
+		unsigned short freed;	/* 1 once the block is released */
+	} h;
+	t_int align;
+} arena_header;
+
+#define ARENA_LIMBS	(TROPICSSL_MPI_ARENA_SIZE / ciL)
+#define ARENA_HDR	((int) ((sizeof(arena_header) + ciL - 1) / ciL))
+#define ARENA_NONE	0xFFFF
+#define ARENA_BLOCK(o)	((arena_header *) &arena[o])
+
+static t_int arena[ARENA_LIMBS];
+static int arena_depth = 0;
+static int arena_top = 0;		/* limbs in use */
+static int arena_last = ARENA_NONE;	/* offset of the top block */
+static int arena_peak = 0;
+static int arena_misses = 0;
+
+static int arena_owns(const t_int * p)
+{
+	return (p >= arena && p < arena + ARENA_LIMBS);
+}
+
+static t_int *limbs_alloc(int nblimbs)
+{
+	if (arena_depth > 0) {
+		if (arena_top + ARENA_HDR + nblimbs <= ARENA_LIMBS) {
+			ARENA_BLOCK(arena_top)->h.prev = arena_last;
+			ARENA_BLOCK(arena_top)->h.freed = 0;
+			arena_last = arena_top;
+			arena_top += ARENA_HDR + nblimbs;
+
+			if (arena_peak < arena_top)
+				arena_peak = arena_top;
+
+			return (&arena[arena_last + ARENA_HDR]);
+		}
+		arena_misses++;
+	}
+
+	return ((t_int *) malloc(nblimbs * ciL));
+}
+
+static void limbs_release(t_int * p)
+{
+	if (!arena_owns(p)) {
+		free(p);
+		return;
+	}
+
+	ARENA_BLOCK(p - arena - ARENA_HDR)->h.freed = 1;
+
+	while (arena_last != ARENA_NONE && ARENA_BLOCK(arena_last)->h.freed) {
+		arena_top = arena_last;
+		arena_last = ARENA_BLOCK(arena_last)->h.prev;
+	}
+}
+
+/*
+ * Grow p to nblimbs without moving it, which only works for the top block
+ */
+static int limbs_extend(t_int * p, int nblimbs)
+{
+	if (arena_depth == 0 || !arena_owns(p) ||
+	    p - arena - ARENA_HDR != arena_last ||
+	    arena_last + ARENA_HDR + nblimbs > ARENA_LIMBS)
+		return (0);
+
+	arena_top = arena_last + ARENA_HDR + nblimbs;
+
+	if (arena_peak < arena_top)
+		arena_peak = arena_top;
+
+	return (1);
+}
+
+void mpi_arena_begin(void)
+{
+	arena_depth++;
+}
+
+void mpi_arena_end(void)
+{
+	if (arena_depth > 0)
+		arena_depth--;
+}
+
+int mpi_arena_used(void)
+{
+	return (arena_top * ciL);
+}
+
+int mpi_arena_peak(void)
+{
+	return (arena_peak * ciL);
+}
+
+int mpi_arena_misses(void)
+{
+	return (arena_misses);
+}
+
+#else
+
+#define limbs_alloc(n)		((t_int *) malloc((n) * ciL))
+#define limbs_release(p)	free(p)
+#define limbs_extend(p, n)	0
+
+void mpi_arena_begin(void)
+{
+}
+
+void mpi_arena_end(void)
+{
+}
+
+int mpi_arena_used(void)
+{
+	return (0);
+}
+
+int mpi_arena_peak(void)
+{
+	return (0);
+}
+
+int mpi_arena_misses(void)
+{
+	return (0);
+}
+
+#endif
+
 /*
  * Initialize one MPI
  */
@@ -86,7 +232,7 @@ void mpi_free(mpi * X)
 
 	if (X->p != NULL) {
 		memset(X->p, 0, X->n * ciL);
-		free(X->p);
+		limbs_release(X->p);
 	}
 
 	X->s = 1;
@@ -102,7 +248,13 @@ int mpi_grow(mpi * X, int nblimbs)
 	t_int *p;
 
 	if (X->n < nblimbs) {
-		if ((p = (t_int *) malloc(nblimbs * ciL)) == NULL)
+		if (X->p != NULL && limbs_extend(X->p, nblimbs)) {
+			memset(X->p + X->n, 0, (nblimbs - X->n) * ciL);
+			X->n = nblimbs;
+			return (0);
+		}
+
+		if ((p = limbs_alloc(nblimbs)) == NULL)
 			return (1);
 
 		memset(p, 0, nblimbs * ciL);
@@ -110,7 +262,7 @@ int mpi_grow(mpi * X, int nblimbs)
 		if (X->p != NULL) {
 			memcpy(p, X->p, X->n * ciL);
 			memset(X->p, 0, X->n * ciL);
-			free(X->p);
+			limbs_release(X->p);
 		}
 
 		X->n = nblimbs;
@@ -1208,6 +1360,128 @@ static void mpi_montg_init(t_int * mm, const mpi * N)
 	*mm = ~x + 1;
 }
 
+/*
+ * One limb of T = (T + u0*B + u1*N) / 2^biL, done as a single pass over
+ * B, N and T (CIOS), instead of two mpi_mul_hlp() passes over T:
+ *
+ *      c0:x = T[j] + u0*B[j] + c0
+ *      c1:x = x    + u1*N[j] + c1,    T[j-1] = x
+ *
+ * tp points at T[j-1], bp at B[j] and np at N[j], and all three move on
+ * by one limb.
+ */
+#if defined(TROPICSSL_HAVE_ASM) && defined(__GNUC__) && \
+	defined(__arm__) && defined(__thumb2__)
+
+#define MONT_STEP						\
+	asm("ldr    %5, [%1], #4        \n\t"			\
+	    "ldr    %6, [%0, #4]        \n\t"			\
+	    "movs   %7, #0              \n\t"			\
+	    "umlal  %6, %7, %5, %8      \n\t"			\
+	    "adds   %6, %6, %3          \n\t"			\
+	    "adc    %3, %7, #0          \n\t"			\
+	    "ldr    %5, [%2], #4        \n\t"			\
+	    "movs   %7, #0              \n\t"			\
+	    "umlal  %6, %7, %5, %9      \n\t"			\
+	    "adds   %6, %6, %4          \n\t"			\
+	    "adc    %4, %7, #0          \n\t"			\
+	    "str    %6, [%0], #4        \n\t"			\
+	    : "+r" (tp), "+r" (bp), "+r" (np), "+r" (c0), "+r" (c1),	\
+	      "=&r" (x), "=&r" (lo), "=&r" (hi)			\
+	    : "r" (u0), "r" (u1)				\
+	    : "cc", "memory")
+
+#else
+
+#define MONT_STEP						\
+	r = (t_dbl) u0 * *bp++ + tp[1] + c0;			\
+	c0 = (t_int) (r >> biL);				\
+	r = (t_dbl) u1 * *np++ + (t_int) r + c1;			\
+	c1 = (t_int) (r >> biL);				\
+	*tp++ = (t_int) r
+
+#endif
+
+/*
+ * Montgomery multiplication of n-limb A and B. Leaves A * B * R^-1 mod N,
+ * possibly plus N, in T[0..n]. T is zero.
+ */
+static void mpi_montmul_cios(int n, const t_int * A, const t_int * B,
+			     const t_int * N, t_int mm, t_int * T)
+{
+	int i, j;
+	t_int u0, u1, c0, c1, *tp;
+	const t_int *bp, *np;
+#if defined(TROPICSSL_HAVE_ASM) && defined(__GNUC__) && \
+	defined(__arm__) && defined(__thumb2__)
+	t_int x, lo, hi;
+#endif
+	t_dbl r;
+
+	for (i = 0; i < n; i++) {
+		u0 = A[i];
+		u1 = (T[0] + u0 * B[0]) * mm;
+
+		/*
+		 * u1 is chosen so the lowest limb comes out zero
+		 */
+		r = (t_dbl) u0 * B[0] + T[0];
+		c0 = (t_int) (r >> biL);
+		r = (t_dbl) u1 * N[0] + (t_int) r;
+		c1 = (t_int) (r >> biL);
+
+		tp = T;
+		bp = B + 1;
+		np = N + 1;
+		for (j = 1; j < n; j++) {
+			MONT_STEP;
+		}
+
+		r = (t_dbl) T[n] + c0 + c1;
+		T[n - 1] = (t_int) r;
+		T[n] = (t_int) (r >> biL);
+	}
+}
+
+/*
+ * Montgomery squaring of n-limb A. Leaves A * A * R^-1 mod N, possibly
+ * plus N, in T[n..2n]. T is zero and has 2n + 2 limbs.
+ *
+ * The cross products A[i]*A[j] appear twice in the square, so they are
+ * computed once and doubled (HAC 14.16). That makes squaring about a
+ * quarter cheaper than mpi_montmul_cios(), and exponentiation is mostly
+ * squaring.
+ */
+static void mpi_montsqr(int n, t_int * A, t_int * N, t_int mm, t_int * T)
+{
+	int i;
+	t_int c, top;
+	t_dbl r;
+
+	for (i = 0; i < n - 1; i++)
+		mpi_mul_hlp(n - 1 - i, A + i + 1, T + 2 * i + 1, A[i]);
+
+	for (i = 0, c = 0; i < 2 * n; i++) {
+		top = T[i] >> (biL - 1);
+		T[i] = (T[i] << 1) | c;
+		c = top;
+	}
+
+	for (i = 0, c = 0; i < n; i++) {
+		r = (t_dbl) A[i] * A[i] + T[2 * i] + c;
+		T[2 * i] = (t_int) r;
+		r = (r >> biL) + T[2 * i + 1];
+		T[2 * i + 1] = (t_int) r;
+		c = (t_int) (r >> biL);
+	}
+
+	/*
+	 * T = T * R^-1 mod N  (HAC 14.32)
+	 */
+	for (i = 0; i < n; i++)
+		mpi_mul_hlp(n, N, T + i, T[i] * mm);
+}
+
 /*
  * Montgomery multiplication: A = A * B * R^-1 mod N  (HAC 14.36)
  */
@@ -1222,18 +1496,25 @@ static void mpi_montmul(mpi * A, const mpi * B, const mpi * N, t_int mm, mpi * T
 	n = N->n;
 	m = (B->n < n) ? B->n : n;
 
-	for (i = 0; i < n; i++) {
-		/*
-		 * T = (T + u0*B + u1*N) / 2^biL
-		 */
-		u0 = A->p[i];
-		u1 = (d[0] + u0 * B->p[0]) * mm;
+	if (A == B) {
+		mpi_montsqr(n, A->p, N->p, mm, T->p);
+		d += n;
+	} else if (m == n) {
+		mpi_montmul_cios(n, A->p, B->p, N->p, mm, T->p);
+	} else {
+		for (i = 0; i < n; i++) {
+			/*
+			 * T = (T + u0*B + u1*N) / 2^biL
+			 */
+			u0 = A->p[i];
+			u1 = (d[0] + u0 * B->p[0]) * mm;
 
-		mpi_mul_hlp(m, B->p, d, u0);
-		mpi_mul_hlp(n, N->p, d, u1);
+			mpi_mul_hlp(m, B->p, d, u0);
+			mpi_mul_hlp(n, N->p, d, u1);
 
-		*d++ = u0;
-		d[n + 1] = 0;
+			*d++ = u0;
+			d[n + 1] = 0;
+		}
 	}
 
 	memcpy(A->p, d, (n + 1) * ciL);
@@ -76,3 +76,181 @@ size_t CoAP::option_decode(unsigned char **option)
   }
   return option_length;
 }
+
+CoAPMessageView::CoAPMessageView() : message(NULL), is_valid(false), options(0),
+                                     spill_offset(0), spill_number(0),
+                                     payload_marker(false), payload_offset(0),
+                                     payload_size(0)
+{
+}
+
+// Finishes an option delta or length whose 4-bit field is in value, reading
+// its extended bytes at offset
+bool CoAPMessageView::extended(const unsigned char *message, size_t length,
+                               size_t &offset, unsigned int &value)
+{
+  if (13 == value)
+  {
+    if (offset + 1 > length) return false;
+    value = message[offset] + 13;
+    offset += 1;
+  }
+  else if (14 == value)
+  {
+    if (offset + 2 > length) return false;
+    value = (message[offset] << 8 | message[offset + 1]) + 269;
+    offset += 2;
+  }
+  else if (15 == value)
+  {
+    // reserved, only valid as part of the payload marker
+    return false;
+  }
+  return true;
+}
+
+bool CoAPMessageView::parse(const unsigned char *message, size_t length)
+{
+  this->message = message;
+  is_valid = false;
+  options = 0;
+  payload_marker = false;
+  payload_offset = length;
+  payload_size = 0;
+
+  if (4 > length || 0x40 != (message[0] & 0xc0))
+  {
+    // too short for a header, or not CoAP version 1
+    return false;
+  }
+
+  size_t offset = 4 + token_length();
+  if (8 < token_length() || offset > length)
+  {
+    return false;
+  }
+
+  unsigned int number = 0;
+  while (offset < length)
+  {
+    size_t header = offset;
+    unsigned char byte = message[offset++];
+    if (0xff == byte)
+    {
+      payload_marker = true;
+      payload_offset = offset;
+      payload_size = length - offset;
+      break;
+    }
+
+    unsigned int delta = byte >> 4;
+    unsigned int option_length = byte & 0x0f;
+    if (!extended(message, length, offset, delta) ||
+        !extended(message, length, offset, option_length) ||
+        offset + option_length > length)
+    {
+      return false;
+    }
+
+    if (MAX_OPTIONS == options)
+    {
+      spill_offset = header;
+      spill_number = number;
+    }
+    number += delta;
+    if (MAX_OPTIONS > options)
+    {
+      option[options].number = number;
+      option[options].offset = offset;
+      option[options].length = option_length;
+    }
+    ++options;
+    offset += option_length;
+  }
+
+  is_valid = true;
+  return true;
+}
+
+void CoAPMessageView::decode(size_t &offset, unsigned int &number,
+                             Option &result) const
+{
+  unsigned char byte = message[offset++];
+  unsigned int delta = byte >> 4;
+  unsigned int option_length = byte & 0x0f;
+  extended(message, payload_offset, offset, delta);
+  extended(message, payload_offset, offset, option_length);
+
+  number += delta;
+  result.number = number;
+  result.offset = offset;
+  result.length = option_length;
+  offset += option_length;
+}
+
+CoAPMessageView::Option CoAPMessageView::option_at(int index) const
+{
+  if (MAX_OPTIONS > index)
+  {
+    return option[index];
+  }
+
+  size_t offset = spill_offset;
+  unsigned int spill = spill_number;
+  Option result;
+  for (int i = MAX_OPTIONS; i <= index; i++)
+  {
+    decode(offset, spill, result);
+  }
+  return result;
+}
+
+int CoAPMessageView::find_option(unsigned short number, int nth) const
+{
+  size_t offset = spill_offset;
+  unsigned int spill = spill_number;
+  Option current;
+  for (int i = 0; i < options; i++)
+  {
+    if (MAX_OPTIONS > i)
+    {
+      current = option[i];
+    }
+    else
+    {
+      decode(offset, spill, current);
+    }
+
+    if (number == current.number && 0 == nth--)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+size_t CoAPMessageView::join_options(int index, unsigned char separator)
+{
+  Option first = option_at(index);
+  unsigned char *joined = (unsigned char *)message + first.offset;
+  unsigned char *next_dst = joined + first.length;
+
+  // One pass from the option after index. Every header is decoded before
+  // anything is written over it: the separator takes the place of a header
+  // of one byte or more, so what is written never passes the end of the
+  // value being moved.
+  size_t offset = first.offset + first.length;
+  unsigned int number = first.number;
+  Option next;
+  for (int i = index + 1; i < options; i++)
+  {
+    decode(offset, number, next);
+    if (first.number == next.number)
+    {
+      *next_dst++ = separator;
+      memmove(next_dst, message + next.offset, next.length);
+      next_dst += next.length;
+    }
+  }
+  return next_dst - joined;
+}
@@ -65,6 +65,14 @@ namespace CoAPType {
   };
 }
 
+namespace CoAPOption {
+  enum Enum {
+    URI_PATH = 11,
+    MAX_AGE = 14,
+    URI_QUERY = 15
+  };
+}
+
 class CoAP
 {
   public:
@@ -72,3 +80,75 @@ class CoAP
     static CoAPType::Enum type(const unsigned char *message);
     static size_t option_decode(unsigned char **option);
 };
+
+// Decodes a message's header, token, options and payload in one pass and
+// keeps their offsets, so nothing has to be scanned again afterwards.
+// Every offset is checked against the message length.
+class CoAPMessageView
+{
+  public:
+    // Options kept in the table. Any after them, as in a deeply nested
+    // event name, are decoded again from the message when asked for.
+    static const int MAX_OPTIONS = 8;
+
+    CoAPMessageView();
+
+    // Returns false, and leaves the view invalid, if the message is
+    // malformed or doesn't fit in length bytes
+    bool parse(const unsigned char *message, size_t length);
+    bool valid() const { return is_valid; }
+
+    CoAPType::Enum type() const { return CoAP::type(message); }
+    CoAPCode::Enum code() const { return CoAP::code(message); }
+    unsigned char raw_code() const { return message[1]; }
+    unsigned char id_msb() const { return message[2]; }
+    unsigned char id_lsb() const { return message[3]; }
+    size_t token_length() const { return message[0] & 0x0f; }
+    const unsigned char *token() const { return message + 4; }
+
+    int option_count() const { return options; }
+    unsigned short option_number(int index) const { return option_at(index).number; }
+    const unsigned char *option_value(int index) const { return message + option_at(index).offset; }
+    size_t option_length(int index) const { return option_at(index).length; }
+
+    // Returns the index of the nth option with the given number, or -1
+    int find_option(unsigned short number, int nth = 0) const;
+
+    // Appends the value of every later option with the same number to the
+    // value of the option at index, each after separator, in place over
+    // the bytes between them. Returns the joined length. Options after
+    // index are no longer valid afterwards.
+    size_t join_options(int index, unsigned char separator);
+
+    // A payload marker was found, though what follows may still be empty
+    bool has_payload() const { return payload_marker; }
+    const unsigned char *payload() const { return message + payload_offset; }
+    size_t payload_length() const { return payload_size; }
+
+  private:
+    struct Option
+    {
+      unsigned short number;
+      unsigned short offset;
+      unsigned short length;
+    };
+
+    const unsigned char *message;
+    bool is_valid;
+    int options;
+    Option option[MAX_OPTIONS];
+    // Where the options past the table start, and the option number
+    // their deltas are relative to
+    unsigned short spill_offset;
+    unsigned short spill_number;
+    bool payload_marker;
+    unsigned short payload_offset;
+    unsigned short payload_size;
+
+    static bool extended(const unsigned char *message, size_t length,
+                         size_t &offset, unsigned int &value);
+    // Decodes the option header at offset, which parse() has already
+    // checked, moving offset past its value
+    void decode(size_t &offset, unsigned int &number, Option &result) const;
+    Option option_at(int index) const;
+};
@@ -37,7 +37,9 @@ int ciphertext_from_nonce_and_id(const unsigned char *nonce,
   rsa_context rsa;
   init_rsa_context_with_public_key(&rsa, pubkey);
 
+  mpi_arena_begin();
   int ret = rsa_pkcs1_encrypt(&rsa, RSA_PUBLIC, 52, plaintext, ciphertext);
+  mpi_arena_end();
   rsa_free(&rsa);
   return ret;
 }
@@ -49,10 +51,20 @@ int decipher_aes_credentials(const unsigned char *private_key,
   rsa_context rsa;
   init_rsa_context_with_private_key(&rsa, private_key);
 
+  int ret = decipher_aes_credentials_with_rsa(&rsa, ciphertext, aes_credentials);
+  rsa_free(&rsa);
+  return ret;
+}
+
+int decipher_aes_credentials_with_rsa(rsa_context *rsa,
+                                      const unsigned char *ciphertext,
+                                      unsigned char *aes_credentials)
+{
   int len = 128;
-  int ret = rsa_pkcs1_decrypt(&rsa, RSA_PRIVATE, &len, ciphertext,
+  mpi_arena_begin();
+  int ret = rsa_pkcs1_decrypt(rsa, RSA_PRIVATE, &len, ciphertext,
                               aes_credentials, 40);
-  rsa_free(&rsa);
+  mpi_arena_end();
   return ret;
 }
 
@@ -70,12 +82,22 @@ int verify_signature(const unsigned char *signature,
   rsa_context rsa;
   init_rsa_context_with_public_key(&rsa, pubkey);
 
-  int ret = rsa_pkcs1_verify(&rsa, RSA_PUBLIC, RSA_RAW, 20,
-                             expected_hmac, signature);
+  int ret = verify_signature_with_rsa(&rsa, signature, expected_hmac);
   rsa_free(&rsa);
   return ret;
 }
 
+int verify_signature_with_rsa(rsa_context *rsa,
+                              const unsigned char *signature,
+                              const unsigned char *expected_hmac)
+{
+  mpi_arena_begin();
+  int ret = rsa_pkcs1_verify(rsa, RSA_PUBLIC, RSA_RAW, 20,
+                             expected_hmac, signature);
+  mpi_arena_end();
+  return ret;
+}
+
 void init_rsa_context_with_public_key(rsa_context *rsa,
                                       const unsigned char *pubkey)
 {
@@ -170,3 +192,29 @@ void init_rsa_context_with_private_key(rsa_context *rsa,
 
   mpi_read_binary(&rsa->QP, private_key + i, 64);
 }
+
+/* R^2 mod M for the Montgomery multiplications in mpi_exp_mod(), worked
+ * out the same way mpi_exp_mod() does when it is given an empty cache.
+ */
+static void montgomery_constant(mpi *RR, const mpi *M)
+{
+  if (0 == M->n)
+  {
+    // no such modulus in this key
+    return;
+  }
+  mpi_free(RR);
+  mpi_lset(RR, 1);
+  mpi_shift_l(RR, M->n * 2 * 8 * sizeof(t_int));
+  mpi_mod_mpi(RR, RR, M);
+}
+
+/* Fills in the R^2 caches of a key that will be used many times, so no
+ * single RSA operation has to pay for them.
+ */
+void precompute_rsa_constants(rsa_context *rsa)
+{
+  montgomery_constant(&rsa->RN, &rsa->N);
+  montgomery_constant(&rsa->RP, &rsa->P);
+  montgomery_constant(&rsa->RQ, &rsa->Q);
+}
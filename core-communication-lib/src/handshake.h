@@ -53,6 +53,16 @@ void init_rsa_context_with_public_key(rsa_context *rsa,
 void init_rsa_context_with_private_key(rsa_context *rsa,
                                        const unsigned char *private_key);
 
+void precompute_rsa_constants(rsa_context *rsa);
+
+int decipher_aes_credentials_with_rsa(rsa_context *rsa,
+                                      const unsigned char *ciphertext,
+                                      unsigned char *aes_credentials);
+
+int verify_signature_with_rsa(rsa_context *rsa,
+                              const unsigned char *signature,
+                              const unsigned char *expected_hmac);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,185 @@
+/**
+  ******************************************************************************
+  * @file    ring_buffer.h
+  * @authors  Val Blant
+  * @version V1.0.0
+  * @brief   Single producer, single consumer byte ring
+  ******************************************************************************
+  Copyright (c) 2013 Spark Labs, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+  ******************************************************************************
+  */
+
+#ifndef __RING_BUFFER_H
+#define __RING_BUFFER_H
+
+#include <string.h>
+
+// A byte ring of N bytes, N a power of two, holding up to N - 1 bytes.
+//
+// One side may only put, one side may only get, and they may run in
+// different contexts, e.g. an interrupt handler filling it while the main
+// loop drains it. Only the producer moves head and only the consumer moves
+// tail, and each side publishes its index after touching the bytes, so no
+// locking is needed on a single core.
+//
+// write_span()/commit() and read_span()/consume() hand out the contiguous
+// free or filled part of the ring, so recv(), DMA or send() can work on the
+// ring directly instead of through a copy.
+template <unsigned int N>
+class RingBuffer
+{
+  public:
+    RingBuffer() : head(0), tail(0) { }
+
+    // Empties the ring. Neither side may be using it at the time.
+    void clear() { head = tail = 0; }
+
+    static unsigned int capacity() { return N - 1; }
+    unsigned int size() const { return (head - tail) & MASK; }
+    unsigned int space() const { return (tail - head - 1) & MASK; }
+    bool empty() const { return head == tail; }
+
+    // The storage itself, for owners that also use it as a plain buffer
+    // while the ring is empty
+    unsigned char *data() { return buffer; }
+
+    /********** Producer **********/
+
+    bool put(unsigned char c)
+    {
+      unsigned int h = head;
+      unsigned int next = (h + 1) & MASK;
+      if (next == tail)
+        return false;
+      buffer[h] = c;
+      barrier();
+      head = next;
+      return true;
+    }
+
+    // Returns where the next bytes go and sets length to how many fit there
+    // without wrapping
+    unsigned char *write_span(unsigned int &length)
+    {
+      unsigned int h = head;
+      unsigned int t = tail;
+      if (h >= t)
+        length = N - h - (0 == t ? 1 : 0);
+      else
+        length = t - h - 1;
+      return buffer + h;
+    }
+
+    // Publishes length bytes written at write_span()
+    void commit(unsigned int length)
+    {
+      barrier();
+      head = (head + length) & MASK;
+    }
+
+    // Returns the number of bytes copied in, which is less than length if
+    // the ring fills up
+    unsigned int push(const unsigned char *src, unsigned int length)
+    {
+      unsigned int count = 0;
+      for (int i = 0; i < 2 && count < length; i++)
+      {
+        unsigned int span;
+        unsigned char *dst = write_span(span);
+        if (span > length - count)
+          span = length - count;
+        memcpy(dst, src + count, span);
+        commit(span);
+        count += span;
+      }
+      return count;
+    }
+
+    /********** Consumer **********/
+
+    // Returns the next byte, or -1 if there is none
+    int get()
+    {
+      unsigned int t = tail;
+      if (t == head)
+        return -1;
+      barrier();
+      unsigned char c = buffer[t];
+      barrier();
+      tail = (t + 1) & MASK;
+      return c;
+    }
+
+    int peek()
+    {
+      unsigned int t = tail;
+      if (t == head)
+        return -1;
+      barrier();
+      return buffer[t];
+    }
+
+    // Returns the oldest bytes and sets length to how many are there
+    // without wrapping
+    const unsigned char *read_span(unsigned int &length)
+    {
+      unsigned int h = head;
+      unsigned int t = tail;
+      length = (h >= t) ? h - t : N - t;
+      barrier();
+      return buffer + t;
+    }
+
+    // Releases length bytes returned by read_span()
+    void consume(unsigned int length)
+    {
+      barrier();
+      tail = (tail + length) & MASK;
+    }
+
+    // Returns the number of bytes copied out, which is less than length if
+    // the ring runs empty
+    unsigned int pop(unsigned char *dst, unsigned int length)
+    {
+      unsigned int count = 0;
+      for (int i = 0; i < 2 && count < length; i++)
+      {
+        unsigned int span;
+        const unsigned char *src = read_span(span);
+        if (span > length - count)
+          span = length - count;
+        memcpy(dst + count, src, span);
+        consume(span);
+        count += span;
+      }
+      return count;
+    }
+
+  private:
+    static const unsigned int MASK = N - 1;
+
+    // fails to compile unless N is a power of two
+    typedef char size_must_be_a_power_of_two[(1 < N && 0 == (N & (N - 1))) ? 1 : -1];
+
+    // keeps the compiler from moving buffer accesses across index updates
+    static void barrier() { __asm__ __volatile__ ("" ::: "memory"); }
+
+    unsigned char buffer[N];
+    volatile unsigned int head;
+    volatile unsigned int tail;
+};
+
+#endif // __RING_BUFFER_H
@@ -35,16 +35,27 @@
 #define PRODUCT_FIRMWARE_VERSION (0xffff)
 #endif
 
-SparkProtocol::SparkProtocol(void) : QUEUE_SIZE(640), expecting_ping_ack(false),
-                                     initialized(false), updating(false)
+SparkProtocol::SparkProtocol(void) : QUEUE_SIZE(1024), expecting_ping_ack(false),
+                                     initialized(false), updating(false),
+                                     session_cached(false), resumption_enabled(false)
 {
   queue_init();
+  io_init();
+}
+
+SparkProtocol::~SparkProtocol(void)
+{
+  if (initialized)
+  {
+    rsa_free(&server_rsa);
+    rsa_free(&core_rsa);
+  }
 }
 
 void SparkProtocol::queue_init(void)
 {
-  queue_front = queue_back = queue;
-  queue_mem_boundary = queue + QUEUE_SIZE;
+  queue_ring.clear();
+  queue = queue_ring.data();
 }
 
 bool SparkProtocol::is_initialized(void)
@@ -62,12 +73,23 @@ void SparkProtocol::init(const char *id,
                          const SparkCallbacks &callbacks,
                          const SparkDescriptor &descriptor)
 {
-  memcpy(server_public_key, keys.server_public, 294);
-  memcpy(core_private_key, keys.core_private, 612);
+  if (initialized)
+  {
+    // keys from an earlier init()
+    rsa_free(&server_rsa);
+    rsa_free(&core_rsa);
+  }
+  init_rsa_context_with_public_key(&server_rsa, keys.server_public);
+  init_rsa_context_with_private_key(&core_rsa, keys.core_private);
+  precompute_rsa_constants(&server_rsa);
+  precompute_rsa_constants(&core_rsa);
   memcpy(device_id, id, 12);
 
   // when using this lib in C, constructor is never called
   queue_init();
+  io_init();
+  forget_session();
+  resumption_enabled = false;
 
   callback_send = callbacks.send;
   callback_receive = callbacks.receive;
@@ -96,23 +118,37 @@ void SparkProtocol::init(const char *id,
 
 int SparkProtocol::handshake(void)
 {
+  // anything half sent or received belongs to the previous session
+  io_init();
+
   memcpy(queue + 40, device_id, 12);
   int err = blocking_receive(queue, 40);
   if (0 > err) return err;
 
-  rsa_context rsa;
-  init_rsa_context_with_public_key(&rsa, server_public_key);
-  err = rsa_pkcs1_encrypt(&rsa, RSA_PUBLIC, 52, queue, queue + 52);
-  rsa_free(&rsa);
+  bool resumed = false;
+  if (can_resume_session())
+  {
+    err = resume_session(queue);
+    if (0 > err) return err;
+    resumed = (0 == err);
+  }
 
-  if (err) return err;
+  if (!resumed)
+  {
+    // the temporaries of every RSA operation live in the bignum arena
+    mpi_arena_begin();
+    err = rsa_pkcs1_encrypt(&server_rsa, RSA_PUBLIC, 52, queue, queue + 52);
+    mpi_arena_end();
 
-  blocking_send(queue + 52, 256);
-  err = blocking_receive(queue, 384);
-  if (0 > err) return err;
+    if (err) return err;
+
+    blocking_send(queue + 52, 256);
+    err = blocking_receive(queue, 384);
+    if (0 > err) return err;
 
-  err = set_key(queue);
-  if (err) return err;
+    err = set_key(queue);
+    if (err) return err;
+  }
 
   queue[0] = 0x00;
   queue[1] = 0x10;
@@ -125,39 +161,62 @@ int SparkProtocol::handshake(void)
 
 // Returns true if no errors and still connected.
 // Returns false if there was an error, and we are probably disconnected.
+// Never waits on the socket: each call only moves the current incoming and
+// outgoing messages along as far as the socket allows right now.
 bool SparkProtocol::event_loop(void)
 {
-  int bytes_received = callback_receive(queue, 2);
-  if (2 <= bytes_received)
+  if (0 > send_pending())
   {
+    // error, or the server stopped reading
+    return false;
+  }
+
+  int received = receive_pending();
+  if (0 > received)
+  {
+    // error, disconnected
+    return false;
+  }
+
+  if (received)
+  {
+    // A message only gets handled once the replies to the previous one are
+    // out, so its own replies always fit in the send buffer.
+    if (send_front != send_back)
+    {
+      return true;
+    }
+
     bool success = handle_received_message();
+    receive_length = -1;
+    receive_count = 0;
     if (!success)
     {
       // bail if and only if there was an error
       return false;
     }
   }
-  else
+  else if (0 > receive_length && 0 == receive_count)
   {
-    if (0 > bytes_received)
-    {
-      // error, disconnected
-      return false;
-    }
-
+    // nothing in flight from the server
     if (updating)
     {
       system_tick_t millis_since_last_chunk = callback_millis() - last_chunk_millis;
 
       if (3000 < millis_since_last_chunk)
       {
-        queue[0] = 0;
-        queue[1] = 16;
-        chunk_missed(queue + 2, chunk_index);
-        if (0 > blocking_send(queue, 18))
+        unsigned char *buf = send_space(18);
+        if (buf)
         {
-          // error
-          return false;
+          buf[0] = 0;
+          buf[1] = 16;
+          chunk_missed(buf + 2, chunk_index);
+          commit_send(18);
+          if (0 > send_pending())
+          {
+            // error
+            return false;
+          }
         }
 
         last_chunk_millis = callback_millis();
@@ -180,10 +239,15 @@ bool SparkProtocol::event_loop(void)
       {
         if (15000 < millis_since_last_message)
         {
-          queue[0] = 0;
-          queue[1] = 16;
-          ping(queue + 2);
-          blocking_send(queue, 18);
+          unsigned char *buf = send_space(18);
+          if (buf)
+          {
+            buf[0] = 0;
+            buf[1] = 16;
+            ping(buf + 2);
+            commit_send(18);
+            send_pending();
+          }
 
           expecting_ping_ack = true;
           last_message_millis = callback_millis();
@@ -260,8 +324,43 @@ int SparkProtocol::blocking_receive(unsigned char *buf, int length)
   return byte_count;
 }
 
+namespace {
+  // Requests are told apart by their code and the first byte of their
+  // first Uri-Path option
+  struct RequestRoute
+  {
+    unsigned char code;
+    char path;
+    CoAPMessageType::Enum type;
+  };
+
+  const RequestRoute request_routes[] = {
+    { 0x01, 'v', CoAPMessageType::VARIABLE_REQUEST },
+    { 0x01, 'd', CoAPMessageType::DESCRIBE },
+    { 0x02, 'E', CoAPMessageType::EVENT },
+    { 0x02, 'e', CoAPMessageType::EVENT },
+    { 0x02, 'h', CoAPMessageType::HELLO },
+    { 0x02, 'f', CoAPMessageType::FUNCTION_CALL },
+    { 0x02, 'u', CoAPMessageType::UPDATE_BEGIN },
+    { 0x02, 'c', CoAPMessageType::CHUNK },
+    { 0x03, 'k', CoAPMessageType::KEY_CHANGE },
+    { 0x03, 'u', CoAPMessageType::UPDATE_DONE },
+    { 0x03, 's', CoAPMessageType::SIGNAL_START }
+  };
+
+  const int NUM_REQUEST_ROUTES = sizeof(request_routes) / sizeof(RequestRoute);
+}
+
 CoAPMessageType::Enum
   SparkProtocol::received_message(unsigned char *buf, int length)
+{
+  CoAPMessageView message;
+  return received_message(buf, length, message);
+}
+
+CoAPMessageType::Enum
+  SparkProtocol::received_message(unsigned char *buf, int length,
+                                  CoAPMessageView &message)
 {
   unsigned char next_iv[16];
   memcpy(next_iv, buf, 16);
@@ -271,50 +370,54 @@ CoAPMessageType::Enum
 
   memcpy(iv_receive, next_iv, 16);
 
-  char path = buf[ 5 + (buf[0] & 0x0F) ];
+  // PKCS #7 padding must be 1-16, and is not part of the CoAP message
+  unsigned char pad = 0 < length ? buf[length - 1] : 0;
+  if (0 == pad || 16 < pad || length < pad)
+  {
+    return CoAPMessageType::ERROR;
+  }
 
-  switch (CoAP::code(buf))
+  if (!message.parse(buf, length - pad))
+  {
+    return CoAPMessageType::ERROR;
+  }
+
+  switch (message.code())
   {
-    case CoAPCode::GET:
-      switch (path)
-      {
-        case 'v': return CoAPMessageType::VARIABLE_REQUEST;
-        case 'd': return CoAPMessageType::DESCRIBE;
-        default: break;
-      } break;
-    case CoAPCode::POST:
-      switch (path)
-      {
-        case 'E':
-        case 'e':
-          return CoAPMessageType::EVENT;
-        case 'h': return CoAPMessageType::HELLO;
-        case 'f': return CoAPMessageType::FUNCTION_CALL;
-        case 'u': return CoAPMessageType::UPDATE_BEGIN;
-        case 'c': return CoAPMessageType::CHUNK;
-        default: break;
-      } break;
-    case CoAPCode::PUT:
-      switch (path)
-      {
-        case 'k': return CoAPMessageType::KEY_CHANGE;
-        case 'u': return CoAPMessageType::UPDATE_DONE;
-        case 's':
-          if (buf[8]) return CoAPMessageType::SIGNAL_START;
-          else return CoAPMessageType::SIGNAL_STOP;
-        default: break;
-      } break;
     case CoAPCode::EMPTY:
-      switch (CoAP::type(buf))
-      {
-        case CoAPType::CON: return CoAPMessageType::PING;
-        default: return CoAPMessageType::EMPTY_ACK;
-      } break;
+      if (CoAPType::CON == message.type())
+        return CoAPMessageType::PING;
+      return CoAPMessageType::EMPTY_ACK;
     case CoAPCode::CONTENT:
       return CoAPMessageType::TIME;
     default:
       break;
   }
+
+  int path = message.find_option(CoAPOption::URI_PATH);
+  if (0 > path || 0 == message.option_length(path))
+  {
+    return CoAPMessageType::ERROR;
+  }
+
+  const unsigned char code = message.raw_code();
+  const char first = message.option_value(path)[0];
+  for (int i = 0; i < NUM_REQUEST_ROUTES; i++)
+  {
+    if (code == request_routes[i].code && first == request_routes[i].path)
+    {
+      if (CoAPMessageType::SIGNAL_START == request_routes[i].type)
+      {
+        int query = message.find_option(CoAPOption::URI_QUERY);
+        if (0 > query || 0 == message.option_length(query) ||
+            0 == message.option_value(query)[0])
+        {
+          return CoAPMessageType::SIGNAL_STOP;
+        }
+      }
+      return request_routes[i].type;
+    }
+  }
   return CoAPMessageType::ERROR;
 }
 
@@ -480,11 +583,20 @@ bool SparkProtocol::send_event(const char *event_name, const char *data,
     return false;
   }
 
+  // length, header and options, padding, name and data
+  unsigned char *buf = send_space(2 + 16 + 16 + MAX_EVENT_NAME_LENGTH + MAX_EVENT_DATA_LENGTH);
+  if (!buf)
+  {
+    // still busy sending earlier messages
+    return false;
+  }
+
   uint16_t msg_id = next_message_id();
-  size_t msglen = event(queue + 2, msg_id, event_name, data, ttl, event_type);
-  size_t wrapped_len = wrap(queue, msglen);
+  size_t msglen = event(buf + 2, msg_id, event_name, data, ttl, event_type);
+  size_t wrapped_len = wrap(buf, msglen);
+  commit_send(wrapped_len);
 
-  return (0 <= blocking_send(queue, wrapped_len));
+  return (0 <= send_pending());
 }
 
 size_t SparkProtocol::time_request(unsigned char *buf)
@@ -513,45 +625,68 @@ bool SparkProtocol::send_time_request(void)
     return false;
   }
 
-  size_t msglen = time_request(queue + 2);
-  size_t wrapped_len = wrap(queue, msglen);
+  unsigned char *buf = send_space(18);
+  if (!buf)
+  {
+    return false;
+  }
+
+  size_t msglen = time_request(buf + 2);
+  size_t wrapped_len = wrap(buf, msglen);
+  commit_send(wrapped_len);
 
-  return (0 <= blocking_send(queue, wrapped_len));
+  return (0 <= send_pending());
 }
 
 bool SparkProtocol::send_subscription(const char *event_name, const char *device_id)
 {
+  // length, header and options, padding, name and device id
+  unsigned char *buf = send_space(2 + 16 + 16 + MAX_EVENT_NAME_LENGTH + 64);
+  if (!buf)
+  {
+    return false;
+  }
+
   uint16_t msg_id = next_message_id();
-  size_t msglen = subscription(queue + 2, msg_id, event_name, device_id);
+  size_t msglen = subscription(buf + 2, msg_id, event_name, device_id);
 
   size_t buflen = (msglen & ~15) + 16;
   char pad = buflen - msglen;
-  memset(queue + 2 + msglen, pad, pad); // PKCS #7 padding
+  memset(buf + 2 + msglen, pad, pad); // PKCS #7 padding
 
-  encrypt(queue + 2, buflen);
+  encrypt(buf + 2, buflen);
 
-  queue[0] = (buflen >> 8) & 0xff;
-  queue[1] = buflen & 0xff;
+  buf[0] = (buflen >> 8) & 0xff;
+  buf[1] = buflen & 0xff;
+  commit_send(buflen + 2);
 
-  return (0 <= blocking_send(queue, buflen + 2));
+  return (0 <= send_pending());
 }
 
 bool SparkProtocol::send_subscription(const char *event_name,
                                       SubscriptionScope::Enum scope)
 {
+  // length, header and options, padding, name and device id
+  unsigned char *buf = send_space(2 + 16 + 16 + MAX_EVENT_NAME_LENGTH + 64);
+  if (!buf)
+  {
+    return false;
+  }
+
   uint16_t msg_id = next_message_id();
-  size_t msglen = subscription(queue + 2, msg_id, event_name, scope);
+  size_t msglen = subscription(buf + 2, msg_id, event_name, scope);
 
   size_t buflen = (msglen & ~15) + 16;
   char pad = buflen - msglen;
-  memset(queue + 2 + msglen, pad, pad); // PKCS #7 padding
+  memset(buf + 2 + msglen, pad, pad); // PKCS #7 padding
 
-  encrypt(queue + 2, buflen);
+  encrypt(buf + 2, buflen);
 
-  queue[0] = (buflen >> 8) & 0xff;
-  queue[1] = buflen & 0xff;
+  buf[0] = (buflen >> 8) & 0xff;
+  buf[1] = buflen & 0xff;
+  commit_send(buflen + 2);
 
-  return (0 <= blocking_send(queue, buflen + 2));
+  return (0 <= send_pending());
 }
 
 bool SparkProtocol::add_event_handler(const char *event_name, EventHandler handler)
@@ -708,92 +843,159 @@ int SparkProtocol::presence_announcement(unsigned char *buf, const char *id)
 }
 
 
-/********** Queue **********/
+/********** Resumable I/O **********/
 
-int SparkProtocol::queue_bytes_available()
+void SparkProtocol::io_init(void)
 {
-  int unoccupied = queue_front - queue_back - 1;
-  if (unoccupied < 0)
-    return unoccupied + QUEUE_SIZE;
-  else
-    return unoccupied;
+  send_front = send_back = send_message_end = 0;
+  receive_length = -1;
+  receive_count = 0;
 }
 
-int SparkProtocol::queue_push(const char *src, int length)
+// Returns where a message of up to length bytes can be built, ready for
+// commit_send(), or NULL if the send buffer can't take it yet
+unsigned char *SparkProtocol::send_space(int length)
+{
+  if (send_front == send_back)
+  {
+    send_front = send_back = send_message_end = 0;
+  }
+  else if (SEND_BUFFER_SIZE - send_back < length)
+  {
+    // slide what's left to the front
+    memmove(send_buffer, send_buffer + send_front, send_back - send_front);
+    send_back -= send_front;
+    send_message_end -= send_front;
+    send_front = 0;
+  }
+
+  if (SEND_BUFFER_SIZE - send_back < length)
+  {
+    return NULL;
+  }
+  return send_buffer + send_back;
+}
+
+// Queues the length bytes that were built at send_space()
+void SparkProtocol::commit_send(int length)
+{
+  if (send_front == send_back)
+  {
+    last_send_millis = callback_millis();
+  }
+  send_back += length;
+}
+
+// Copies an already encrypted message into the send buffer and sends as much
+// of it as the socket takes right away.
+// Returns 0 or more on success, or -1 on error
+int SparkProtocol::queue_send(const unsigned char *buf, int length)
 {
-  int available = queue_bytes_available();
-  if (queue_back >= queue_front)
+  unsigned char *dst = send_space(length);
+  if (!dst)
   {
-    int tail_available = queue_mem_boundary - queue_back;
-    if (length <= available)
+    return -1;
+  }
+  memcpy(dst, buf, length);
+  commit_send(length);
+  return send_pending();
+}
+
+// Sends queued messages, one callback_send() per message, until the socket
+// stops taking bytes.
+// Returns the number of bytes still queued, or -1 on error or when nothing
+// could be sent for IO_TIMEOUT_MILLIS
+int SparkProtocol::send_pending(void)
+{
+  while (send_front < send_back)
+  {
+    if (send_front == send_message_end)
+    {
+      // each message starts with its 2-byte length
+      unsigned char *message = send_buffer + send_front;
+      send_message_end = send_front + 2 + (message[0] << 8 | message[1]);
+    }
+    while (send_front < send_message_end)
     {
-      if (length <= tail_available)
+      int bytes_or_error = callback_send(send_buffer + send_front, send_message_end - send_front);
+      if (0 > bytes_or_error)
       {
-        memcpy(queue_back, src, length);
-        queue_back += length;
+        // error, disconnected
+        return bytes_or_error;
       }
-      else
+      else if (0 == bytes_or_error)
       {
-        int head_needed = length - tail_available;
-        memcpy(queue_back, src, tail_available);
-        memcpy(queue, src + tail_available, head_needed);
-        queue_back = queue + head_needed;
+        if (IO_TIMEOUT_MILLIS < callback_millis() - last_send_millis)
+        {
+          // timed out, disconnect
+          return -1;
+        }
+        return send_back - send_front;
       }
-      return length;
+      send_front += bytes_or_error;
+      last_send_millis = callback_millis();
     }
-    else
+  }
+  return 0;
+}
+
+// Receives whatever has arrived of the current message into the queue.
+// Returns 1 once the whole message is there, 0 while waiting for more, or -1
+// on error or when the message stalled for IO_TIMEOUT_MILLIS
+int SparkProtocol::receive_pending(void)
+{
+  while (0 > receive_length || receive_count < receive_length)
+  {
+    int wanted = (0 > receive_length ? 2 : receive_length) - receive_count;
+    int bytes_or_error = callback_receive(queue + receive_count, wanted);
+    if (0 > bytes_or_error)
+    {
+      // error, disconnected
+      return bytes_or_error;
+    }
+    else if (0 == bytes_or_error)
     {
-      // queue_back is greater than or equal to queue_front
-      // and length is greater than available
-      if (available < tail_available)
+      if ((0 <= receive_length || 0 < receive_count) &&
+          IO_TIMEOUT_MILLIS < callback_millis() - last_receive_millis)
       {
-        // queue_front is equal to queue, so don't fill the last bucket
-        memcpy(queue_back, src, available);
-        queue_back += available;
+        // timed out in the middle of a message, disconnect
+        return -1;
       }
-      else
-      {
-        int head_available = available - tail_available;
-        memcpy(queue_back, src, tail_available);
-        memcpy(queue, src + tail_available, head_available);
-        queue_back = queue + head_available;
+      return 0;
+    }
+
+    receive_count += bytes_or_error;
+    last_receive_millis = callback_millis();
+
+    if (0 > receive_length && 2 == receive_count)
+    {
+      receive_length = queue[0] << 8 | queue[1];
+      receive_count = 0;
+      if (receive_length > QUEUE_SIZE) { // TODO add sanity check on data, e.g. CRC
+        receive_length = -1;
+        return -1;
       }
-      return available;
     }
   }
-  else
-  {
-    // queue_back is less than queue_front
-    int count = length < available ? length : available;
-    memcpy(queue_back, src, count);
-    queue_back += count;
-    return count;
-  }
+  return 1;
 }
 
-int SparkProtocol::queue_pop(char *dst, int length)
+
+/********** Queue **********/
+
+int SparkProtocol::queue_bytes_available()
 {
-  if (queue_back >= queue_front)
-  {
-    int filled = queue_back - queue_front;
-    int count = length <= filled ? length : filled;
+  return queue_ring.space();
+}
 
-    memcpy(dst, queue_front, count);
-    queue_front += count;
-    return count;
-  }
-  else
-  {
-    int tail_filled = queue_mem_boundary - queue_front;
-    int head_requested = length - tail_filled;
-    int head_filled = queue_back - queue;
-    int head_count = head_requested < head_filled ? head_requested : head_filled;
-    
-    memcpy(dst, queue_front, tail_filled);
-    memcpy(dst + tail_filled, queue, head_count);
-    queue_front = queue + head_count;
-    return tail_filled + head_count;
-  }
+int SparkProtocol::queue_push(const char *src, int length)
+{
+  return queue_ring.push((const unsigned char *)src, length);
+}
+
+int SparkProtocol::queue_pop(char *dst, int length)
+{
+  return queue_ring.pop((unsigned char *)dst, length);
 }
 
 ProtocolState::Enum SparkProtocol::state()
@@ -822,16 +1024,9 @@ bool SparkProtocol::handle_received_message(void)
 {
   last_message_millis = callback_millis();
   expecting_ping_ack = false;
-  int len = queue[0] << 8 | queue[1];
-  if (len > QUEUE_SIZE) { // TODO add sanity check on data, e.g. CRC
-      return false;
-  }
-  if (0 > blocking_receive(queue, len))
-  {
-    // error
-    return false;
-  }
-  CoAPMessageType::Enum message_type = received_message(queue, len);
+  int len = receive_length;
+  CoAPMessageView message;
+  CoAPMessageType::Enum message_type = received_message(queue, len, message);
   unsigned char token = queue[4];
   unsigned char *msg_to_send = queue + len;
   switch (message_type)
@@ -841,7 +1036,7 @@ bool SparkProtocol::handle_received_message(void)
       int desc_len = description(queue + 2, token, queue[2], queue[3]);
       queue[0] = (desc_len >> 8) & 0xff;
       queue[1] = desc_len & 0xff;
-      if (0 > blocking_send(queue, desc_len + 2))
+      if (0 > queue_send(queue, desc_len + 2))
       {
         // error
         return false;
@@ -854,35 +1049,28 @@ bool SparkProtocol::handle_received_message(void)
       *msg_to_send = 0;
       *(msg_to_send + 1) = 16;
       empty_ack(msg_to_send + 2, queue[2], queue[3]);
-      if (0 > blocking_send(msg_to_send, 18))
+      if (0 > queue_send(msg_to_send, 18))
       {
         // error
         return false;
       }
 
-      // copy the function key
+      // copy the function key, the second Uri-Path option
       char function_key[13];
       memset(function_key, 0, 13);
-      int function_key_length = queue[7] & 0x0F;
-      memcpy(function_key, queue + 8, function_key_length);
-
-      // How long is the argument?
-      int q_index = 8 + function_key_length;
-      int query_length = queue[q_index] & 0x0F;
-      if (13 == query_length)
+      int key = message.find_option(CoAPOption::URI_PATH, 1);
+      if (0 <= key)
       {
-        ++q_index;
-        query_length = 13 + queue[q_index];
-      }
-      else if (14 == query_length)
-      {
-        ++q_index;
-        query_length = queue[q_index] << 8;
-        ++q_index;
-        query_length |= queue[q_index];
-        query_length += 269;
+        size_t function_key_length = message.option_length(key);
+        if (12 < function_key_length)
+          function_key_length = 12;
+        memcpy(function_key, message.option_value(key), function_key_length);
       }
 
+      // the argument is the first Uri-Query option
+      int query = message.find_option(CoAPOption::URI_QUERY);
+      size_t query_length = 0 > query ? 0 : message.option_length(query);
+
       // allocated memory bounds check
       if (MAX_FUNCTION_ARG_LENGTH <= query_length)
       {
@@ -890,7 +1078,8 @@ bool SparkProtocol::handle_received_message(void)
       }
 
       // save a copy of the argument
-      memcpy(function_arg, queue + q_index + 1, query_length);
+      if (query_length)
+        memcpy(function_arg, message.option_value(query), query_length);
       function_arg[query_length] = 0; // null terminate string
 
       // call the given user function
@@ -900,7 +1089,7 @@ bool SparkProtocol::handle_received_message(void)
       *msg_to_send = 0;
       *(msg_to_send + 1) = 16;
       function_return(msg_to_send + 2, token, return_value);
-      if (0 > blocking_send(msg_to_send, 18))
+      if (0 > queue_send(msg_to_send, 18))
       {
         // error
         return false;
@@ -909,14 +1098,17 @@ bool SparkProtocol::handle_received_message(void)
     }
     case CoAPMessageType::VARIABLE_REQUEST:
     {
-      // copy the variable key
-      int variable_key_length = queue[7] & 0x0F;
-      if (12 < variable_key_length)
-        variable_key_length = 12;
-
+      // copy the variable key, the second Uri-Path option
       char variable_key[13];
-      memcpy(variable_key, queue + 8, variable_key_length);
-      memset(variable_key + variable_key_length, 0, 13 - variable_key_length);
+      memset(variable_key, 0, 13);
+      int key = message.find_option(CoAPOption::URI_PATH, 1);
+      if (0 <= key)
+      {
+        size_t variable_key_length = message.option_length(key);
+        if (12 < variable_key_length)
+          variable_key_length = 12;
+        memcpy(variable_key, message.option_value(key), variable_key_length);
+      }
 
       queue[0] = 0;
       queue[1] = 16; // default buffer length
@@ -937,8 +1129,8 @@ bool SparkProtocol::handle_received_message(void)
       {
         char *str_val = (char *)descriptor.get_variable(variable_key);
 
-        // 2-byte leading length, 16 potential padding bytes
-        int max_length = QUEUE_SIZE - 2 - 16;
+        // 2-byte leading length, 6-byte header, 16 potential padding bytes
+        int max_length = SEND_BUFFER_SIZE - 2 - 6 - 16;
         int str_length = strlen(str_val);
         if (str_length > max_length) {
           str_length = max_length;
@@ -955,7 +1147,7 @@ bool SparkProtocol::handle_received_message(void)
       }
 
       // buffer length may have changed if variable is a long string
-      if (0 > blocking_send(queue, (queue[0] << 8) + queue[1] + 2))
+      if (0 > queue_send(queue, (queue[0] << 8) + queue[1] + 2))
       {
         // error
         return false;
@@ -970,17 +1162,25 @@ bool SparkProtocol::handle_received_message(void)
       *msg_to_send = 0;
       *(msg_to_send + 1) = 16;
       empty_ack(msg_to_send + 2, queue[2], queue[3]);
-      if (0 > blocking_send(msg_to_send, 18))
+      if (0 > queue_send(msg_to_send, 18))
       {
         // error
         return false;
       }
 
-      // check crc
-      unsigned int given_crc = queue[8] << 24 | queue[9] << 16 | queue[10] << 8 | queue[11];
-      if (callback_calculate_crc(queue + 13, len - 13 - queue[len - 1]) == given_crc)
+      // check crc, carried in the first Uri-Query option
+      unsigned int given_crc = 0;
+      int crc = message.find_option(CoAPOption::URI_QUERY);
+      if (0 <= crc && 4 == message.option_length(crc))
+      {
+        const unsigned char *c = message.option_value(crc);
+        given_crc = c[0] << 24 | c[1] << 16 | c[2] << 8 | c[3];
+      }
+      unsigned char *chunk = (unsigned char *)message.payload();
+      if (0 <= crc &&
+          callback_calculate_crc(chunk, message.payload_length()) == given_crc)
       {
-        unsigned short next_chunk_index = callback_save_firmware_chunk(queue + 13, len - 13 - queue[len - 1]);
+        unsigned short next_chunk_index = callback_save_firmware_chunk(chunk, message.payload_length());
         if (next_chunk_index > chunk_index)
         {
           chunk_received(msg_to_send + 2, token, ChunkReceivedCode::OK);
@@ -995,7 +1195,7 @@ bool SparkProtocol::handle_received_message(void)
       {
         chunk_received(msg_to_send + 2, token, ChunkReceivedCode::BAD);
       }
-      if (0 > blocking_send(msg_to_send, 18))
+      if (0 > queue_send(msg_to_send, 18))
       {
         // error
         return false;
@@ -1007,7 +1207,7 @@ bool SparkProtocol::handle_received_message(void)
       *msg_to_send = 0;
       *(msg_to_send + 1) = 16;
       empty_ack(msg_to_send + 2, queue[2], queue[3]);
-      if (0 > blocking_send(msg_to_send, 18))
+      if (0 > queue_send(msg_to_send, 18))
       {
         // error
         return false;
@@ -1020,7 +1220,7 @@ bool SparkProtocol::handle_received_message(void)
 
       // send update_reaady
       update_ready(msg_to_send + 2, token);
-      if (0 > blocking_send(msg_to_send, 18))
+      if (0 > queue_send(msg_to_send, 18))
       {
         // error
         return false;
@@ -1031,7 +1231,7 @@ bool SparkProtocol::handle_received_message(void)
       *msg_to_send = 0;
       *(msg_to_send + 1) = 16;
       coded_ack(msg_to_send + 2, token, ChunkReceivedCode::OK, queue[2], queue[3]);
-      if (0 > blocking_send(msg_to_send, 18))
+      if (0 > queue_send(msg_to_send, 18))
       {
         // error
         return false;
@@ -1042,6 +1242,23 @@ bool SparkProtocol::handle_received_message(void)
       break;
     case CoAPMessageType::EVENT:
     {
+      // the event name is every Uri-Path option after the first one,
+      // joined with slashes in place over the option headers between them
+      int first = message.find_option(CoAPOption::URI_PATH, 1);
+      if (0 > first)
+      {
+        // ignore bad message, no event name
+        break;
+      }
+      unsigned char *event_name = (unsigned char *)message.option_value(first);
+      const size_t event_name_length = message.join_options(first, '/');
+
+      unsigned char *data = NULL;
+      if (message.has_payload())
+      {
+        data = (unsigned char *)message.payload();
+      }
+
       const int NUM_HANDLERS = sizeof(event_handlers) / sizeof(EventHandler);
       for (int i = 0; i < NUM_HANDLERS; i++)
       {
@@ -1050,40 +1267,6 @@ bool SparkProtocol::handle_received_message(void)
           break;
         }
 
-        unsigned char pad = queue[len - 1];
-        if (0 == pad || 16 < pad)
-        {
-          // ignore bad message, PKCS #7 padding must be 1-16
-          break;
-        }
-        // end of CoAP message
-        unsigned char *end = queue + len - pad;
-
-        unsigned char *event_name = queue + 6;
-        size_t event_name_length = CoAP::option_decode(&event_name);
-        if (0 == event_name_length)
-        {
-          // error, malformed CoAP option
-          break;
-        }
-
-        unsigned char *next_src = event_name + event_name_length;
-        unsigned char *next_dst = next_src;
-        while (next_src < end && 0x00 == (*next_src & 0xf0))
-        {
-          // there's another Uri-Path option, i.e., event name with slashes
-          size_t option_len = CoAP::option_decode(&next_src);
-          *next_dst++ = '/';
-          if (next_dst != next_src)
-          {
-            // at least one extra byte has been used to encode a CoAP Uri-Path option length
-            memmove(next_dst, next_src, option_len);
-          }
-          next_src += option_len;
-          next_dst += option_len;
-        }
-        event_name_length = next_dst - event_name;
-
         const size_t MAX_FILTER_LENGTH = sizeof(event_handlers[i].filter);
         const size_t filter_length = strnlen(event_handlers[i].filter, MAX_FILTER_LENGTH);
         if (event_name_length < filter_length)
@@ -1095,20 +1278,10 @@ bool SparkProtocol::handle_received_message(void)
         const int cmp = memcmp(event_handlers[i].filter, event_name, filter_length);
         if (0 == cmp)
         {
-          if (next_src < end && 0x30 == (*next_src & 0xf0))
-          {
-            // Max-Age option is next, which we ignore
-            size_t next_len = CoAP::option_decode(&next_src);
-            next_src += next_len;
-          }
-
-          unsigned char *data = NULL;
-          if (next_src < end && 0xff == *next_src)
+          if (data)
           {
-            // payload is next
-            data = next_src + 1;
-            // null terminate data string
-            *end = 0;
+            // null terminate data string, over the padding
+            data[message.payload_length()] = 0;
           }
           // null terminate event name string
           event_name[event_name_length] = 0;
@@ -1126,7 +1299,7 @@ bool SparkProtocol::handle_received_message(void)
       queue[0] = 0;
       queue[1] = 16;
       coded_ack(queue + 2, token, ChunkReceivedCode::OK, queue[2], queue[3]);
-      if (0 > blocking_send(queue, 18))
+      if (0 > queue_send(queue, 18))
       {
         // error
         return false;
@@ -1138,7 +1311,7 @@ bool SparkProtocol::handle_received_message(void)
       queue[0] = 0;
       queue[1] = 16;
       coded_ack(queue + 2, token, ChunkReceivedCode::OK, queue[2], queue[3]);
-      if (0 > blocking_send(queue, 18))
+      if (0 > queue_send(queue, 18))
       {
         // error
         return false;
@@ -1152,14 +1325,18 @@ bool SparkProtocol::handle_received_message(void)
       break;
 
     case CoAPMessageType::TIME:
-      callback_set_time(queue[6] << 24 | queue[7] << 16 | queue[8] << 8 | queue[9]);
+      if (4 <= message.payload_length())
+      {
+        const unsigned char *t = message.payload();
+        callback_set_time(t[0] << 24 | t[1] << 16 | t[2] << 8 | t[3]);
+      }
       break;
 
     case CoAPMessageType::PING:
       *msg_to_send = 0;
       *(msg_to_send + 1) = 16;
       empty_ack(msg_to_send + 2, queue[2], queue[3]);
-      if (0 > blocking_send(msg_to_send, 18))
+      if (0 > queue_send(msg_to_send, 18))
       {
         // error
         return false;
@@ -1215,29 +1392,132 @@ int SparkProtocol::set_key(const unsigned char *signed_encrypted_credentials)
   unsigned char credentials[40];
   unsigned char hmac[20];
 
-  if (0 != decipher_aes_credentials(core_private_key,
-                                    signed_encrypted_credentials,
-                                    credentials))
+  if (0 != decipher_aes_credentials_with_rsa(&core_rsa,
+                                             signed_encrypted_credentials,
+                                             credentials))
     return 1;
 
   calculate_ciphertext_hmac(signed_encrypted_credentials, credentials, hmac);
 
-  if (0 == verify_signature(signed_encrypted_credentials + 128,
-                            server_public_key,
-                            hmac))
+  if (0 == verify_signature_with_rsa(&server_rsa,
+                                     signed_encrypted_credentials + 128,
+                                     hmac))
   {
-    memcpy(key,        credentials,      16);
-    memcpy(iv_send,    credentials + 16, 16);
-    memcpy(iv_receive, credentials + 16, 16);
-    memcpy(salt,       credentials + 32,  8);
-    _message_id = *(credentials + 32) << 8 | *(credentials + 33);
-    _token = *(credentials + 34);
-
+    load_credentials(credentials);
     return 0;
   }
   else return 2;
 }
 
+void SparkProtocol::load_credentials(const unsigned char *credentials)
+{
+  memcpy(key,        credentials,      16);
+  memcpy(iv_send,    credentials + 16, 16);
+  memcpy(iv_receive, credentials + 16, 16);
+  memcpy(salt,       credentials + 32,  8);
+  _message_id = *(credentials + 32) << 8 | *(credentials + 33);
+  _token = *(credentials + 34);
+
+  memcpy(session_credentials, credentials, 40);
+  session_cached = true;
+}
+
+/********** Session Resumption **********/
+
+void SparkProtocol::enable_session_resumption(bool enable)
+{
+  resumption_enabled = enable;
+  if (!enable)
+    forget_session();
+}
+
+void SparkProtocol::forget_session(void)
+{
+  memset(session_credentials, 0, 40);
+  session_cached = false;
+}
+
+// The resume request begins with two RESUME_MARKER bytes where the server
+// otherwise expects the RSA ciphertext, which is less than the server's
+// modulus. So unless the modulus itself begins with 0xFFFF, no ciphertext
+// can be mistaken for a resume request.
+bool SparkProtocol::can_resume_session(void)
+{
+  if (!resumption_enabled || !session_cached)
+    return false;
+
+  mpi marker;
+  mpi_init(&marker);
+  mpi_lset(&marker, RESUME_MARKER << 8 | RESUME_MARKER);
+  mpi_shift_l(&marker, server_rsa.len * 8 - 16);
+  bool unambiguous = 0 > mpi_cmp_mpi(&server_rsa.N, &marker);
+  mpi_free(&marker);
+  return unambiguous;
+}
+
+// Instead of the RSA encrypted nonce and id, sends
+//   0xFF 0xFF, id[12], HMAC-SHA1(credentials, nonce[40] id[12])
+// and expects back the server's 20 byte proof
+//   HMAC-SHA1(credentials, nonce[40] our_hmac[20])
+// after which both sides switch to the credentials
+//   HMAC-SHA1(credentials, nonce[40] 0x01) HMAC-SHA1(credentials, nonce[40] 0x02)
+// truncated to 40 bytes, so no key and IV pair is ever used twice.
+// Any other 20 bytes mean the server has no such session, and it waits for
+// the usual RSA exchange on the same connection.
+//
+// Returns 0 if the session was resumed, 1 if the caller should fall back to
+// RSA, or a negative number if the connection failed.
+int SparkProtocol::resume_session(const unsigned char *nonce_and_id)
+{
+  unsigned char *request = queue + 52;
+  unsigned char *proof = request + 34;
+  unsigned char expected[20];
+  sha1_context sha;
+
+  request[0] = RESUME_MARKER;
+  request[1] = RESUME_MARKER;
+  memcpy(request + 2, device_id, 12);
+  sha1_hmac(session_credentials, 40, nonce_and_id, 52, request + 14);
+
+  int err = blocking_send(request, 34);
+  if (0 <= err)
+    err = blocking_receive(proof, 20);
+  if (0 > err)
+  {
+    forget_session();
+    return err;
+  }
+
+  sha1_hmac_starts(&sha, session_credentials, 40);
+  sha1_hmac_update(&sha, nonce_and_id, 40);
+  sha1_hmac_update(&sha, request + 14, 20);
+  sha1_hmac_finish(&sha, expected);
+
+  unsigned char difference = 0;
+  for (int i = 0; i < 20; ++i)
+    difference |= expected[i] ^ proof[i];
+  if (difference)
+  {
+    forget_session();
+    return 1;
+  }
+
+  unsigned char derived[40];
+  for (unsigned char label = 1; label <= 2; ++label)
+  {
+    sha1_hmac_starts(&sha, session_credentials, 40);
+    sha1_hmac_update(&sha, nonce_and_id, 40);
+    sha1_hmac_update(&sha, &label, 1);
+    sha1_hmac_finish(&sha, expected);
+    memcpy(derived + 20 * (label - 1), expected, 20);
+  }
+  load_credentials(derived);
+  memset(derived, 0, 40);
+  memset(&sha, 0, sizeof(sha));
+
+  return 0;
+}
+
 inline void SparkProtocol::empty_ack(unsigned char *buf,
                                      unsigned char message_id_msb,
                                      unsigned char message_id_lsb)
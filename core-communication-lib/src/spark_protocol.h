@@ -30,6 +30,7 @@
 #include "spark_descriptor.h"
 #include "coap.h"
 #include "events.h"
+#include "ring_buffer.h"
 #include "tropicssl/rsa.h"
 #include "tropicssl/aes.h"
 
@@ -83,6 +84,7 @@ class SparkProtocol
     static int presence_announcement(unsigned char *buf, const char *id);
 
     SparkProtocol();
+    ~SparkProtocol();
 
     void init(const char *id,
               const SparkKeys &keys,
@@ -94,6 +96,10 @@ class SparkProtocol
     void reset_updating(void);
 
     int set_key(const unsigned char *signed_encrypted_credentials);
+    // Lets handshake() skip the RSA exchange when the server still knows
+    // the last session, see resume_session(). Off until enabled after init(),
+    // since the server has to support it.
+    void enable_session_resumption(bool enable);
     int blocking_send(const unsigned char *buf, int length);
     int blocking_receive(unsigned char *buf, int length);
 
@@ -140,8 +146,9 @@ class SparkProtocol
 
   private:
     char device_id[12];
-    unsigned char server_public_key[294];
-    unsigned char core_private_key[612];
+    // parsed once in init() and kept for every handshake after that
+    rsa_context server_rsa;
+    rsa_context core_rsa;
     aes_context aes;
 
     int (*callback_send)(const unsigned char *buf, int buflen);
@@ -172,6 +179,8 @@ class SparkProtocol
     char function_arg[MAX_FUNCTION_ARG_LENGTH];
 
     size_t wrap(unsigned char *buf, size_t msglen);
+    CoAPMessageType::Enum received_message(unsigned char *buf, int length,
+                                           CoAPMessageView &message);
     bool handle_received_message(void);
     unsigned short next_message_id();
     unsigned char next_token();
@@ -187,11 +196,45 @@ class SparkProtocol
                           unsigned char message_id_lsb);
 
     /********** Queue **********/
-    unsigned char queue[640];
-    const unsigned char *queue_mem_boundary;
-    unsigned char *queue_front;
-    unsigned char *queue_back;
+    // The ring's storage doubles as the buffer messages are received and
+    // built in, so the queue API must not be used while connected
+    RingBuffer<1024> queue_ring;
+    unsigned char *queue;
     void queue_init(void);
+
+    /********** Session Resumption **********/
+    // The credentials the current session was keyed from, kept in RAM so
+    // a reconnect can prove it holds them with an HMAC instead of RSA
+    static const unsigned char RESUME_MARKER = 0xFF;
+    unsigned char session_credentials[40];
+    bool session_cached;
+    bool resumption_enabled;
+    bool can_resume_session(void);
+    int resume_session(const unsigned char *nonce_and_id);
+    void forget_session(void);
+    void load_credentials(const unsigned char *credentials);
+
+    /********** Resumable I/O **********/
+    // event_loop() never waits on the socket. Incoming messages are collected
+    // into the queue across as many passes as it takes, and outgoing ones are
+    // encrypted into the send buffer and drained from there, in the same order
+    // they were encrypted, since each one chains the CBC IV of the next.
+    static const int SEND_BUFFER_SIZE = 640;
+    static const system_tick_t IO_TIMEOUT_MILLIS = 20000;
+    unsigned char send_buffer[SEND_BUFFER_SIZE];
+    int send_front;   // first byte not sent yet
+    int send_back;    // end of the queued bytes
+    int send_message_end;  // end of the message being sent
+    system_tick_t last_send_millis;
+    int receive_length;   // length of the message, or -1 while reading its 2-byte length
+    int receive_count;    // bytes of the length or the message received so far
+    system_tick_t last_receive_millis;
+    void io_init(void);
+    unsigned char *send_space(int length);
+    int queue_send(const unsigned char *buf, int length);
+    void commit_send(int length);
+    int send_pending(void);
+    int receive_pending(void);
 };
 
 #endif // __SPARK_PROTOCOL_H
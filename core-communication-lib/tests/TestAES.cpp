@@ -65,3 +65,166 @@ TEST(AESSelfTestSucceeds)
 {
   CHECK_EQUAL(0, aes_self_test(0));
 }
+
+// NIST SP 800-38A F.2.2, CBC-AES128.Decrypt
+struct AESCBCFixture
+{
+  static const uint8_t key[16];
+  static const uint8_t iv[16];
+  static const uint8_t ciphertext[64];
+  static const uint8_t plaintext[64];
+
+  aes_context ctx;
+  uint8_t next_iv[16];
+
+  AESCBCFixture()
+  {
+    aes_setkey_dec(&ctx, key, 128);
+    memcpy(next_iv, iv, 16);
+  }
+};
+
+const uint8_t AESCBCFixture::key[16] = {
+  0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+  0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+
+const uint8_t AESCBCFixture::iv[16] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+  0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+
+const uint8_t AESCBCFixture::ciphertext[64] = {
+  0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46,
+  0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+  0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee,
+  0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+  0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b,
+  0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+  0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09,
+  0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7 };
+
+const uint8_t AESCBCFixture::plaintext[64] = {
+  0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+  0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+  0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+  0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+  0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+  0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+  0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17,
+  0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10 };
+
+TEST_FIXTURE(AESCBCFixture, DecryptsSeveralBlocksIntoSeparateBuffer)
+{
+  uint8_t buf[64];
+  aes_crypt_cbc(&ctx, AES_DECRYPT, 64, next_iv, ciphertext, buf);
+  CHECK_ARRAY_EQUAL(plaintext, buf, 64);
+}
+
+TEST_FIXTURE(AESCBCFixture, DecryptsSeveralBlocksInPlace)
+{
+  uint8_t buf[64];
+  memcpy(buf, ciphertext, 64);
+  aes_crypt_cbc(&ctx, AES_DECRYPT, 64, next_iv, buf, buf);
+  CHECK_ARRAY_EQUAL(plaintext, buf, 64);
+}
+
+TEST_FIXTURE(AESCBCFixture, DecryptLeavesLastCiphertextBlockAsIV)
+{
+  uint8_t buf[64];
+  memcpy(buf, ciphertext, 64);
+  aes_crypt_cbc(&ctx, AES_DECRYPT, 64, next_iv, buf, buf);
+  CHECK_ARRAY_EQUAL(ciphertext + 48, next_iv, 16);
+}
+
+TEST_FIXTURE(AESCBCFixture, DecryptingInPiecesMatchesDecryptingAtOnce)
+{
+  uint8_t buf[64];
+  memcpy(buf, ciphertext, 64);
+  aes_crypt_cbc(&ctx, AES_DECRYPT, 16, next_iv, buf, buf);
+  aes_crypt_cbc(&ctx, AES_DECRYPT, 48, next_iv, buf + 16, buf + 16);
+  CHECK_ARRAY_EQUAL(plaintext, buf, 64);
+}
+
+TEST_FIXTURE(AESCBCFixture, DecryptingNothingLeavesIVAlone)
+{
+  uint8_t buf[16] = {0};
+  aes_crypt_cbc(&ctx, AES_DECRYPT, 0, next_iv, buf, buf);
+  CHECK_ARRAY_EQUAL(iv, next_iv, 16);
+}
+
+// NIST SP 800-38A F.5.1, CTR-AES128.Encrypt, with the same key and
+// plaintext as above. The counter carries out of its low bytes on the way.
+struct AESCTRFixture
+{
+  static const uint8_t initial_counter[16];
+  static const uint8_t ciphertext[64];
+
+  aes_context ctx;
+  uint8_t counter[16];
+  uint8_t stream_block[16];
+  int offset;
+
+  AESCTRFixture() : offset(0)
+  {
+    aes_setkey_enc(&ctx, AESCBCFixture::key, 128);
+    memcpy(counter, initial_counter, 16);
+  }
+};
+
+const uint8_t AESCTRFixture::initial_counter[16] = {
+  0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+  0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+
+const uint8_t AESCTRFixture::ciphertext[64] = {
+  0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26,
+  0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+  0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff,
+  0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+  0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e,
+  0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+  0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1,
+  0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee };
+
+TEST_FIXTURE(AESCTRFixture, CTREncryptsNISTExample)
+{
+  uint8_t buf[64];
+  aes_crypt_ctr(&ctx, 64, &offset, counter, stream_block, AESCBCFixture::plaintext, buf);
+  CHECK_ARRAY_EQUAL(ciphertext, buf, 64);
+  CHECK_EQUAL(0, offset);
+}
+
+TEST_FIXTURE(AESCTRFixture, CTRDecryptsInPlace)
+{
+  uint8_t buf[64];
+  memcpy(buf, ciphertext, 64);
+  aes_crypt_ctr(&ctx, 64, &offset, counter, stream_block, buf, buf);
+  CHECK_ARRAY_EQUAL(AESCBCFixture::plaintext, buf, 64);
+}
+
+TEST_FIXTURE(AESCTRFixture, CTRResumesMidBlock)
+{
+  uint8_t buf[64];
+  aes_crypt_ctr(&ctx, 5, &offset, counter, stream_block, AESCBCFixture::plaintext, buf);
+  CHECK_EQUAL(5, offset);
+  aes_crypt_ctr(&ctx, 40, &offset, counter, stream_block, AESCBCFixture::plaintext + 5, buf + 5);
+  aes_crypt_ctr(&ctx, 19, &offset, counter, stream_block, AESCBCFixture::plaintext + 45, buf + 45);
+  CHECK_ARRAY_EQUAL(ciphertext, buf, 64);
+}
+
+TEST_FIXTURE(AESCTRFixture, CTRDecryptsUnalignedBuffers)
+{
+  uint8_t in[65];
+  uint8_t out[67];
+  memcpy(in + 1, ciphertext, 64);
+  aes_crypt_ctr(&ctx, 64, &offset, counter, stream_block, in + 1, out + 3);
+  CHECK_ARRAY_EQUAL(AESCBCFixture::plaintext, out + 3, 64);
+}
+
+TEST_FIXTURE(AESCTRFixture, CTRLeavesCounterAtNextBlock)
+{
+  uint8_t buf[64];
+  aes_crypt_ctr(&ctx, 64, &offset, counter, stream_block, AESCBCFixture::plaintext, buf);
+  const uint8_t next[16] = {
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+    0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xff, 0x03 };
+  CHECK_ARRAY_EQUAL(next, counter, 16);
+}
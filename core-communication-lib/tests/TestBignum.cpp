@@ -0,0 +1,249 @@
+#include <string.h>
+#include "UnitTest++.h"
+#include "tropicssl/config.h"
+#include "tropicssl/bignum.h"
+
+struct BignumFixture
+{
+  static const char N1024[];
+  static const char A1024[];
+  static const char E1024[];
+  static const char X1024[];
+  static const char N512[];
+  static const char A512[];
+  static const char X512[];
+
+  mpi A, E, N, X, Y;
+
+  BignumFixture()
+  {
+    mpi_init(&A); mpi_init(&E); mpi_init(&N); mpi_init(&X); mpi_init(&Y);
+  }
+
+  ~BignumFixture()
+  {
+    mpi_free(&Y); mpi_free(&X); mpi_free(&N); mpi_free(&E); mpi_free(&A);
+  }
+
+  // Y = A^E mod N by square and multiply with mpi_mul_mpi and mpi_mod_mpi,
+  // which share no code with the Montgomery multiply
+  void reference_exp_mod()
+  {
+    mpi_lset(&Y, 1);
+    for (int i = mpi_msb(&E) - 1; i >= 0; i--)
+    {
+      mpi_mul_mpi(&Y, &Y, &Y);
+      mpi_mod_mpi(&Y, &Y, &N);
+      if ((E.p[i / (8 * sizeof(t_int))] >> (i % (8 * sizeof(t_int)))) & 1)
+      {
+        mpi_mul_mpi(&Y, &Y, &A);
+        mpi_mod_mpi(&Y, &Y, &N);
+      }
+    }
+  }
+};
+
+// X = A^E mod N, worked out independently
+const char BignumFixture::N1024[] =
+  "ED19C2CBC377F79C4181C14E5B84BEFE10A7DD62DFA9B6C005E638C247D7E1ED"
+  "7C568415E1109301819A491BBCD399762BF5C7D5A04F0301518884AF2BE0C133"
+  "7931DB9D7B2836162B82A35FC263B4204B30BD90FF3FA312647B630F7D42A132"
+  "4CAE8E39E278C19B54AA01F9EF63CD2C0E1089135AEBDCD9256AE9713FDFEFE7";
+
+const char BignumFixture::A1024[] =
+  "C14F3CCF065BF843CD6A9F626AAFCFF691220764EC94EB485601CEFEF880D484"
+  "DCEADE622C9ACEAB189271AB8800858562DCE7998B006BD39E9C3323F971F1FC"
+  "51E8300D06AD001F246966F41AC3DCD873931D4E3404F1DE349BBBCDC341DF8E"
+  "36D689AC84542A6D78165D63F14C32F494940765B6E43FE2FA43027AD9541A6F";
+
+const char BignumFixture::E1024[] =
+  "CE0D56E7318AF2D42DB1D626EBCBCF8A48BFE7718A4C44B5504A603AAFA0DA73"
+  "99FBE2FD34FD85E0D1582F10C13625E2810243920C69DF7D328935F5B4BD6700"
+  "7421D88906E36D6334ECDFDCCFFB82A2C027197C1FE21625334507D49C89BE5D"
+  "83C5289E5F46E4F4E9B28C9AEDDABC7BD73CD67BB131A40E8D278B620BF35B6C";
+
+const char BignumFixture::X1024[] =
+  "C92C54745D5798BC753C6D8EF07782DB1D8322386B9C682EA5FB770E0BC38C36"
+  "C0D3D8C56FC3B1A14EC73B3BB1F75E800DD85C7C184C798D0B239ABC09D586E0"
+  "050D7BD032FC2708B645B0C3B9FA691ABD0EE0C2EE3F7606C2D5AD9BFA8916E0"
+  "E50DEEE7962A6DE363C39744C54ED597C08B382FF409B773F4AAD5F6CBCBB821";
+
+// X = A^E1024 mod N
+const char BignumFixture::N512[] =
+  "9B11E0C149FD5452399610E72902784BFC3FF63FED4E9DF37A327B8E0BA1320B"
+  "295F8E2AEFEC9EE73F563B81B70E2A13395C6FCC745B0E8732A3F4E2C277AB57";
+
+const char BignumFixture::A512[] =
+  "8F6324CF64531BBBA8A50AC3EA971B7D90C1BD0E5F79C835D293726049F88679"
+  "BD9D02144252C869A1C7FDD8E3CBD54FD9D78AA275517A07C74344B48A800AC1";
+
+const char BignumFixture::X512[] =
+  "79151E1F432BA9BF1563B59255BFBB827D16B534621D3A4296B08A920F10F0B8"
+  "02B5B870BC93AD7F8C05F0873C81D922E196188A109D7B7417E83743A881D4BC";
+
+SUITE(Bignum)
+{
+  TEST(SelfTestPasses)
+  {
+    CHECK_EQUAL(0, mpi_self_test(0));
+  }
+
+  TEST_FIXTURE(BignumFixture, ExpModMatchesKnownAnswerFor1024BitModulus)
+  {
+    mpi_read_string(&N, 16, N1024);
+    mpi_read_string(&A, 16, A1024);
+    mpi_read_string(&E, 16, E1024);
+    mpi_read_string(&Y, 16, X1024);
+    CHECK_EQUAL(0, mpi_exp_mod(&X, &A, &E, &N, NULL));
+    CHECK_EQUAL(0, mpi_cmp_mpi(&X, &Y));
+  }
+
+  TEST_FIXTURE(BignumFixture, ExpModMatchesKnownAnswerFor512BitModulus)
+  {
+    mpi_read_string(&N, 16, N512);
+    mpi_read_string(&A, 16, A512);
+    mpi_read_string(&E, 16, E1024);
+    mpi_read_string(&Y, 16, X512);
+    CHECK_EQUAL(0, mpi_exp_mod(&X, &A, &E, &N, NULL));
+    CHECK_EQUAL(0, mpi_cmp_mpi(&X, &Y));
+  }
+
+  TEST_FIXTURE(BignumFixture, ExpModWithPublicExponentMatchesReference)
+  {
+    mpi_read_string(&N, 16, N1024);
+    mpi_read_string(&A, 16, A1024);
+    mpi_lset(&E, 65537);
+    CHECK_EQUAL(0, mpi_exp_mod(&X, &A, &E, &N, NULL));
+    reference_exp_mod();
+    CHECK_EQUAL(0, mpi_cmp_mpi(&X, &Y));
+  }
+
+  TEST_FIXTURE(BignumFixture, RepeatedSquaringMatchesReference)
+  {
+    // a power of two exponent is nothing but Montgomery squares
+    mpi_read_string(&N, 16, N1024);
+    mpi_read_string(&A, 16, A1024);
+    mpi_lset(&E, 1);
+    mpi_shift_l(&E, 200);
+    CHECK_EQUAL(0, mpi_exp_mod(&X, &A, &E, &N, NULL));
+    reference_exp_mod();
+    CHECK_EQUAL(0, mpi_cmp_mpi(&X, &Y));
+  }
+
+  TEST_FIXTURE(BignumFixture, LargestOperandsCarryIntoTopLimb)
+  {
+    // N = 2^1024 - 1 and A = N - 2 keep every limb at its maximum
+    char ones[257];
+    memset(ones, 'F', 256);
+    ones[256] = 0;
+    mpi_read_string(&N, 16, ones);
+    ones[255] = 'D';
+    mpi_read_string(&A, 16, ones);
+    mpi_read_string(&E, 16, "FEDCBA9876543210FEDCBA9876543211");
+    CHECK_EQUAL(0, mpi_exp_mod(&X, &A, &E, &N, NULL));
+    reference_exp_mod();
+    CHECK_EQUAL(0, mpi_cmp_mpi(&X, &Y));
+  }
+
+  TEST_FIXTURE(BignumFixture, MinusOneToOddPowerIsMinusOne)
+  {
+    mpi_read_string(&N, 16, N1024);
+    mpi_sub_int(&A, &N, 1);
+    mpi_lset(&E, 65537);
+    CHECK_EQUAL(0, mpi_exp_mod(&X, &A, &E, &N, NULL));
+    CHECK_EQUAL(0, mpi_cmp_mpi(&X, &A));
+  }
+
+  TEST_FIXTURE(BignumFixture, ReusedRRGivesSameResult)
+  {
+    mpi RR;
+    mpi_init(&RR);
+    mpi_read_string(&N, 16, N1024);
+    mpi_read_string(&A, 16, A1024);
+    mpi_read_string(&E, 16, E1024);
+    mpi_read_string(&Y, 16, X1024);
+    CHECK_EQUAL(0, mpi_exp_mod(&X, &A, &E, &N, &RR));
+    CHECK_EQUAL(0, mpi_exp_mod(&X, &A, &E, &N, &RR));
+    CHECK_EQUAL(0, mpi_cmp_mpi(&X, &Y));
+    mpi_free(&RR);
+  }
+
+#if defined(TROPICSSL_MPI_ARENA_SIZE)
+  TEST_FIXTURE(BignumFixture, LimbsGrownInsideArenaScopeComeFromTheArena)
+  {
+    int used = mpi_arena_used();
+    mpi_arena_begin();
+    CHECK_EQUAL(0, mpi_grow(&A, 16));
+    CHECK(mpi_arena_used() >= used + 16 * (int) sizeof(t_int));
+    mpi_free(&A);
+    CHECK_EQUAL(used, mpi_arena_used());
+    mpi_arena_end();
+  }
+
+  TEST_FIXTURE(BignumFixture, LimbsGrownOutsideArenaScopeComeFromTheHeap)
+  {
+    int used = mpi_arena_used();
+    CHECK_EQUAL(0, mpi_grow(&A, 16));
+    CHECK_EQUAL(used, mpi_arena_used());
+  }
+
+  TEST_FIXTURE(BignumFixture, ArenaReclaimsBlocksFreedOutOfOrder)
+  {
+    int used = mpi_arena_used();
+    mpi_arena_begin();
+    mpi_grow(&A, 8);
+    mpi_grow(&X, 8);
+    int both = mpi_arena_used();
+    mpi_free(&A);
+    CHECK_EQUAL(both, mpi_arena_used());
+    mpi_free(&X);
+    CHECK_EQUAL(used, mpi_arena_used());
+    mpi_arena_end();
+  }
+
+  TEST_FIXTURE(BignumFixture, TopArenaBlockGrowsInPlace)
+  {
+    mpi_arena_begin();
+    mpi_lset(&A, 12345);
+    t_int *limbs = A.p;
+    CHECK_EQUAL(0, mpi_grow(&A, 32));
+    CHECK(limbs == A.p);
+    CHECK_EQUAL(32, A.n);
+    CHECK_EQUAL(0, mpi_cmp_int(&A, 12345));
+    for (int i = 1; i < 32; i++)
+      CHECK_EQUAL(0u, A.p[i]);
+    mpi_free(&A);
+    mpi_arena_end();
+  }
+
+  TEST_FIXTURE(BignumFixture, OversizedRequestFallsBackToTheHeap)
+  {
+    int used = mpi_arena_used();
+    int misses = mpi_arena_misses();
+    mpi_arena_begin();
+    CHECK_EQUAL(0, mpi_grow(&A, TROPICSSL_MPI_ARENA_SIZE / sizeof(t_int) + 1));
+    CHECK_EQUAL(used, mpi_arena_used());
+    CHECK_EQUAL(misses + 1, mpi_arena_misses());
+    mpi_free(&A);
+    mpi_arena_end();
+  }
+
+  TEST_FIXTURE(BignumFixture, ResultOutlivingArenaScopeStaysValid)
+  {
+    int used = mpi_arena_used();
+    mpi_read_string(&N, 16, N1024);
+    mpi_read_string(&A, 16, A1024);
+    mpi_read_string(&E, 16, E1024);
+    mpi_read_string(&Y, 16, X1024);
+    mpi_arena_begin();
+    CHECK_EQUAL(0, mpi_exp_mod(&X, &A, &E, &N, NULL));
+    mpi_arena_end();
+
+    // X was grown in the arena and pins its block until it is freed
+    CHECK(mpi_arena_used() > used);
+    CHECK_EQUAL(0, mpi_cmp_mpi(&X, &Y));
+    mpi_free(&X);
+    CHECK_EQUAL(used, mpi_arena_used());
+  }
+#endif
+}
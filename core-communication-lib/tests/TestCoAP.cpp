@@ -617,4 +617,206 @@ SUITE(CoAP)
     size_t expected = 0;
     CHECK_EQUAL(expected, option_length);
   }
+
+  TEST(MessageViewDecodesHeaderAndToken)
+  {
+    const unsigned char message[] = { 0x52, 0x02, 0x12, 0x34, 0xab, 0xcd };
+    CoAPMessageView view;
+    CHECK(view.parse(message, sizeof(message)));
+    CHECK(view.valid());
+    CHECK_EQUAL(CoAPType::NON, view.type());
+    CHECK_EQUAL(CoAPCode::POST, view.code());
+    CHECK_EQUAL(0x12, view.id_msb());
+    CHECK_EQUAL(0x34, view.id_lsb());
+    CHECK_EQUAL(2U, view.token_length());
+    CHECK_EQUAL(0xcd, view.token()[1]);
+    CHECK_EQUAL(0, view.option_count());
+    CHECK(!view.has_payload());
+  }
+
+  TEST(MessageViewDecodesOptionsInOrder)
+  {
+    // Uri-Path "f", Uri-Path "brew", Uri-Query "x=1"
+    const unsigned char message[] = {
+      0x41, 0x02, 0x00, 0x01, 0x77,
+      0xb1, 'f', 0x04, 'b', 'r', 'e', 'w', 0x43, 'x', '=', '1' };
+    CoAPMessageView view;
+    CHECK(view.parse(message, sizeof(message)));
+    CHECK_EQUAL(3, view.option_count());
+    CHECK_EQUAL(11, view.option_number(0));
+    CHECK_EQUAL(11, view.option_number(1));
+    CHECK_EQUAL(15, view.option_number(2));
+    CHECK_EQUAL(4U, view.option_length(1));
+    CHECK_ARRAY_EQUAL("brew", (const char *)view.option_value(1), 4);
+    CHECK_ARRAY_EQUAL("x=1", (const char *)view.option_value(2), 3);
+  }
+
+  TEST(MessageViewFindsNthOption)
+  {
+    const unsigned char message[] = {
+      0x40, 0x02, 0x00, 0x01,
+      0xb1, 'e', 0x01, 'a', 0x01, 'b', 0x31, 60 };
+    CoAPMessageView view;
+    CHECK(view.parse(message, sizeof(message)));
+    CHECK_EQUAL(0, view.find_option(CoAPOption::URI_PATH));
+    CHECK_EQUAL(2, view.find_option(CoAPOption::URI_PATH, 2));
+    CHECK_EQUAL(-1, view.find_option(CoAPOption::URI_PATH, 3));
+    CHECK_EQUAL(3, view.find_option(CoAPOption::MAX_AGE));
+    CHECK_EQUAL(-1, view.find_option(CoAPOption::URI_QUERY));
+  }
+
+  TEST(MessageViewDecodesOneByteExtendedLength)
+  {
+    unsigned char message[6 + 20];
+    memset(message, 'a', sizeof(message));
+    message[0] = 0x40; message[1] = 0x02; message[2] = 0; message[3] = 1;
+    message[4] = 0xbd; // Uri-Path, length 13 + next byte
+    message[5] = 7;
+    CoAPMessageView view;
+    CHECK(view.parse(message, sizeof(message)));
+    CHECK_EQUAL(1, view.option_count());
+    CHECK_EQUAL(20U, view.option_length(0));
+    CHECK_EQUAL(message + 6, view.option_value(0));
+  }
+
+  TEST(MessageViewDecodesTwoByteExtendedLength)
+  {
+    unsigned char message[7 + 300];
+    memset(message, 'a', sizeof(message));
+    message[0] = 0x40; message[1] = 0x02; message[2] = 0; message[3] = 1;
+    message[4] = 0xbe; // Uri-Path, length 269 + next two bytes
+    message[5] = 0;
+    message[6] = 31;
+    CoAPMessageView view;
+    CHECK(view.parse(message, sizeof(message)));
+    CHECK_EQUAL(300U, view.option_length(0));
+    CHECK_EQUAL(message + 7, view.option_value(0));
+  }
+
+  TEST(MessageViewDecodesExtendedDelta)
+  {
+    // option 11, then option 11 + 13 + 4 = 28
+    const unsigned char message[] = {
+      0x40, 0x01, 0x00, 0x01, 0xb1, 'v', 0xd1, 4, 'z' };
+    CoAPMessageView view;
+    CHECK(view.parse(message, sizeof(message)));
+    CHECK_EQUAL(28, view.option_number(1));
+  }
+
+  TEST(MessageViewFindsPayload)
+  {
+    const unsigned char message[] = {
+      0x51, 0x45, 0x00, 0x01, 0x88, 0xff, 0x52, 0x9d, 0x8a, 0x6a };
+    CoAPMessageView view;
+    CHECK(view.parse(message, sizeof(message)));
+    CHECK(view.has_payload());
+    CHECK_EQUAL(message + 6, view.payload());
+    CHECK_EQUAL(4U, view.payload_length());
+  }
+
+  TEST(MessageViewAllowsEmptyPayloadAfterMarker)
+  {
+    const unsigned char message[] = { 0x40, 0x02, 0x00, 0x01, 0xb1, 'e', 0xff };
+    CoAPMessageView view;
+    CHECK(view.parse(message, sizeof(message)));
+    CHECK(view.has_payload());
+    CHECK_EQUAL(0U, view.payload_length());
+  }
+
+  TEST(MessageViewRejectsShortHeader)
+  {
+    const unsigned char message[] = { 0x40, 0x02, 0x00 };
+    CoAPMessageView view;
+    CHECK(!view.parse(message, sizeof(message)));
+    CHECK(!view.valid());
+  }
+
+  TEST(MessageViewRejectsWrongVersion)
+  {
+    const unsigned char message[] = { 0x80, 0x02, 0x00, 0x01 };
+    CoAPMessageView view;
+    CHECK(!view.parse(message, sizeof(message)));
+  }
+
+  TEST(MessageViewRejectsTruncatedToken)
+  {
+    const unsigned char message[] = { 0x44, 0x02, 0x00, 0x01, 0xaa, 0xbb };
+    CoAPMessageView view;
+    CHECK(!view.parse(message, sizeof(message)));
+  }
+
+  TEST(MessageViewRejectsOptionPastEnd)
+  {
+    const unsigned char message[] = { 0x40, 0x02, 0x00, 0x01, 0xb4, 'a', 'b' };
+    CoAPMessageView view;
+    CHECK(!view.parse(message, sizeof(message)));
+  }
+
+  TEST(MessageViewRejectsTruncatedExtendedLength)
+  {
+    const unsigned char message[] = { 0x40, 0x02, 0x00, 0x01, 0xbe, 0x00 };
+    CoAPMessageView view;
+    CHECK(!view.parse(message, sizeof(message)));
+  }
+
+  TEST(MessageViewRejectsReservedLength)
+  {
+    const unsigned char message[] = { 0x40, 0x02, 0x00, 0x01, 0xbf, 'a' };
+    CoAPMessageView view;
+    CHECK(!view.parse(message, sizeof(message)));
+  }
+
+  TEST(MessageViewReadsOptionsPastTheTable)
+  {
+    // Uri-Path "e", then a Uri-Path of one letter each, then Max-Age 60
+    unsigned char message[4 + 2 * (CoAPMessageView::MAX_OPTIONS + 3) + 2];
+    message[0] = 0x40; message[1] = 0x02; message[2] = 0; message[3] = 1;
+    message[4] = 0xb1;
+    message[5] = 'e';
+    int i = 6;
+    for (char letter = 'a'; i < (int)sizeof(message) - 2; i += 2)
+    {
+      message[i] = 0x01;
+      message[i + 1] = letter++;
+    }
+    message[i] = 0x31;
+    message[i + 1] = 60;
+    CoAPMessageView view;
+    CHECK(view.parse(message, sizeof(message)));
+    CHECK_EQUAL(CoAPMessageView::MAX_OPTIONS + 4, view.option_count());
+    int last_path = view.find_option(CoAPOption::URI_PATH, CoAPMessageView::MAX_OPTIONS + 2);
+    CHECK_EQUAL(CoAPMessageView::MAX_OPTIONS + 2, last_path);
+    CHECK_EQUAL('a' + CoAPMessageView::MAX_OPTIONS + 1, *view.option_value(last_path));
+    CHECK_EQUAL(CoAPMessageView::MAX_OPTIONS + 3, view.find_option(CoAPOption::MAX_AGE));
+    CHECK_EQUAL(60, *view.option_value(CoAPMessageView::MAX_OPTIONS + 3));
+  }
+
+  TEST(MessageViewJoinsDeeplyNestedEventName)
+  {
+    // Uri-Path "e", then one Uri-Path per segment of the name, as the
+    // Cloud sends them, then the payload
+    const char *name = "a/b/c/d/e/f/g/h/i/j/k/lmnop";
+    unsigned char message[80] = { 0x50, 0x02, 0x12, 0x34, 0xb1, 'e' };
+    size_t length = 6;
+    for (const char *segment = name; segment; )
+    {
+      const char *slash = strchr(segment, '/');
+      size_t segment_length = slash ? slash - segment : strlen(segment);
+      message[length++] = segment_length;
+      memcpy(message + length, segment, segment_length);
+      length += segment_length;
+      segment = slash ? slash + 1 : NULL;
+    }
+    message[length++] = 0xff;
+    memcpy(message + length, "data", 4);
+    length += 4;
+    CoAPMessageView view;
+    CHECK(view.parse(message, length));
+    CHECK(CoAPMessageView::MAX_OPTIONS < view.option_count());
+    int first = view.find_option(CoAPOption::URI_PATH, 1);
+    const unsigned char *event_name = view.option_value(first);
+    CHECK_EQUAL(strlen(name), view.join_options(first, '/'));
+    CHECK_ARRAY_EQUAL(name, (const char *)event_name, strlen(name));
+    CHECK_ARRAY_EQUAL("data", (const char *)view.payload(), 4);
+  }
 }
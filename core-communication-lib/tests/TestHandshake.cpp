@@ -190,3 +190,78 @@ TEST_FIXTURE(HandshakeFixture, VerifiedSignatureIsHMAC)
   int err = verify_signature(signature, pubkey, expected_hmac);
   CHECK_EQUAL(0, err);
 }
+
+TEST_FIXTURE(HandshakeFixture, PrecomputedConstantsMatchOnesCachedOnFirstUse)
+{
+  uint8_t aes_credentials[40];
+  rsa_context lazy, eager;
+  init_rsa_context_with_private_key(&lazy, private_key);
+  init_rsa_context_with_private_key(&eager, private_key);
+  precompute_rsa_constants(&eager);
+
+  decipher_aes_credentials_with_rsa(&lazy, encrypted_aes_credentials,
+                                    aes_credentials);
+  CHECK_EQUAL(0, mpi_cmp_mpi(&lazy.RP, &eager.RP));
+  CHECK_EQUAL(0, mpi_cmp_mpi(&lazy.RQ, &eager.RQ));
+
+  rsa_free(&eager);
+  rsa_free(&lazy);
+
+  init_rsa_context_with_public_key(&lazy, pubkey);
+  init_rsa_context_with_public_key(&eager, pubkey);
+  precompute_rsa_constants(&eager);
+
+  verify_signature_with_rsa(&lazy, signature, expected_hmac);
+  CHECK_EQUAL(0, mpi_cmp_mpi(&lazy.RN, &eager.RN));
+
+  rsa_free(&eager);
+  rsa_free(&lazy);
+}
+
+TEST_FIXTURE(HandshakeFixture, CachedPrivateKeyDecryptsRepeatedly)
+{
+  uint8_t first[40];
+  uint8_t second[40];
+  rsa_context rsa;
+  init_rsa_context_with_private_key(&rsa, private_key);
+  precompute_rsa_constants(&rsa);
+
+  CHECK_EQUAL(0, decipher_aes_credentials_with_rsa(&rsa, encrypted_aes_credentials, first));
+  CHECK_EQUAL(0, decipher_aes_credentials_with_rsa(&rsa, encrypted_aes_credentials, second));
+  CHECK_ARRAY_EQUAL(first, second, 40);
+
+  rsa_free(&rsa);
+}
+
+TEST_FIXTURE(HandshakeFixture, CachedPublicKeyVerifiesRepeatedly)
+{
+  rsa_context rsa;
+  init_rsa_context_with_public_key(&rsa, pubkey);
+  precompute_rsa_constants(&rsa);
+
+  CHECK_EQUAL(0, verify_signature_with_rsa(&rsa, signature, expected_hmac));
+  CHECK_EQUAL(0, verify_signature_with_rsa(&rsa, signature, expected_hmac));
+
+  rsa_free(&rsa);
+}
+
+TEST_FIXTURE(HandshakeFixture, RSAOperationsFitInTheBignumArena)
+{
+  uint8_t aes_credentials[40];
+  rsa_context private_rsa, public_rsa;
+  init_rsa_context_with_private_key(&private_rsa, private_key);
+  init_rsa_context_with_public_key(&public_rsa, pubkey);
+  precompute_rsa_constants(&private_rsa);
+  precompute_rsa_constants(&public_rsa);
+
+  int used = mpi_arena_used();
+  int misses = mpi_arena_misses();
+  CHECK_EQUAL(0, decipher_aes_credentials_with_rsa(&private_rsa, encrypted_aes_credentials,
+                                                   aes_credentials));
+  CHECK_EQUAL(0, verify_signature_with_rsa(&public_rsa, signature, expected_hmac));
+  CHECK_EQUAL(used, mpi_arena_used());
+  CHECK_EQUAL(misses, mpi_arena_misses());
+
+  rsa_free(&public_rsa);
+  rsa_free(&private_rsa);
+}
@@ -91,6 +91,21 @@ SUITE(Queue)
     CHECK_EQUAL(0, available);
   }
 
+  TEST(QueuePopsNoMoreThanRequestedWhenWrapped)
+  {
+    SparkProtocol spark_protocol;
+    int size = spark_protocol.QUEUE_SIZE - 1;
+    char buf[size];
+    memset(buf, 'w', size);
+    spark_protocol.queue_push(buf, size);
+    spark_protocol.queue_pop(buf, size);
+    spark_protocol.queue_push(buf, 100);
+    memset(buf, 0, 100);
+    int popped = spark_protocol.queue_pop(buf, 1);
+    CHECK_EQUAL(1, popped);
+    CHECK_EQUAL(0, buf[1]);
+  }
+
   TEST(QueueCannotPopMoreThanFilled)
   {
     SparkProtocol spark_protocol;
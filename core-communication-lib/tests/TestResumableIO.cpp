@@ -0,0 +1,190 @@
+#include "UnitTest++.h"
+#include "spark_protocol.h"
+#include "ConstructorFixture.h"
+#include <string.h>
+
+// After the handshake, swaps in a socket that only moves a few bytes
+// per event_loop() pass, like a slow cloud link would.
+struct SlowLinkFixture : public ConstructorFixture
+{
+  static const uint8_t *incoming;
+  static int incoming_length;
+  static int incoming_position;
+  static int receive_budget;
+  static uint8_t outgoing[256];
+  static int outgoing_length;
+  static int send_budget;
+
+  static int slow_receive(unsigned char *buf, int buflen);
+  static int slow_send(const unsigned char *buf, int buflen);
+
+  SlowLinkFixture()
+  {
+    incoming = NULL;
+    incoming_length = incoming_position = 0;
+    receive_budget = send_budget = 0;
+    outgoing_length = 0;
+    next_millis = 0;
+    spark_protocol.handshake();
+    callbacks.send = slow_send;
+    callbacks.receive = slow_receive;
+    spark_protocol.init(id, keys, callbacks, descriptor);
+  }
+};
+
+const uint8_t *SlowLinkFixture::incoming = NULL;
+int SlowLinkFixture::incoming_length = 0;
+int SlowLinkFixture::incoming_position = 0;
+int SlowLinkFixture::receive_budget = 0;
+uint8_t SlowLinkFixture::outgoing[256];
+int SlowLinkFixture::outgoing_length = 0;
+int SlowLinkFixture::send_budget = 0;
+
+int SlowLinkFixture::slow_receive(unsigned char *buf, int buflen)
+{
+  int count = incoming_length - incoming_position;
+  if (count > buflen) count = buflen;
+  if (count > receive_budget) count = receive_budget;
+  memcpy(buf, incoming + incoming_position, count);
+  incoming_position += count;
+  receive_budget -= count;
+  return count;
+}
+
+int SlowLinkFixture::slow_send(const unsigned char *buf, int buflen)
+{
+  int count = buflen < send_budget ? buflen : send_budget;
+  memcpy(outgoing + outgoing_length, buf, count);
+  outgoing_length += count;
+  send_budget -= count;
+  return count;
+}
+
+static const uint8_t describe[18] = {
+  0x00, 0x10,
+  0x4d, 0x2b, 0x01, 0x6f, 0x13, 0xee, 0xde, 0xdc,
+  0xaf, 0x79, 0x23, 0xfb, 0x76, 0x81, 0xb3, 0x7a };
+
+static const uint8_t description[50] = {
+  0x00, 0x30,
+  0x8c, 0x75, 0x7e, 0x24, 0xf7, 0x56, 0xde, 0x78,
+  0xd8, 0x4f, 0x19, 0x80, 0xa8, 0xe0, 0xd1, 0x84,
+  0xb0, 0x96, 0x00, 0x94, 0x76, 0x92, 0x11, 0xc8,
+  0x84, 0xf5, 0x95, 0x6a, 0xe4, 0x16, 0x21, 0x61,
+  0x10, 0xf5, 0xe5, 0x1a, 0xf1, 0x78, 0x0b, 0x75,
+  0x6a, 0xed, 0x83, 0xc5, 0xe0, 0x5d, 0x5c, 0x5a };
+
+SUITE(ResumableIO)
+{
+  TEST_FIXTURE(SlowLinkFixture, EventLoopReturnsWhenNothingArrives)
+  {
+    CHECK(spark_protocol.event_loop());
+    CHECK_EQUAL(0, outgoing_length);
+  }
+
+  TEST_FIXTURE(SlowLinkFixture, MessageArrivingOneByteAtATimeIsAnsweredOnceComplete)
+  {
+    incoming = describe;
+    incoming_length = 18;
+    send_budget = 256;
+    for (int i = 0; i < 17; ++i)
+    {
+      receive_budget = 1;
+      CHECK(spark_protocol.event_loop());
+    }
+    CHECK_EQUAL(0, outgoing_length);
+
+    receive_budget = 1;
+    CHECK(spark_protocol.event_loop());
+    CHECK_EQUAL(50, outgoing_length);
+    CHECK_ARRAY_EQUAL(description, outgoing, 50);
+  }
+
+  TEST_FIXTURE(SlowLinkFixture, ReplyTricklesOutOverSeveralPasses)
+  {
+    incoming = describe;
+    incoming_length = 18;
+    receive_budget = 18;
+    send_budget = 8;
+    CHECK(spark_protocol.event_loop());
+    CHECK_EQUAL(8, outgoing_length);
+
+    int passes = 1;
+    while (outgoing_length < 50 && passes < 10)
+    {
+      send_budget = 8;
+      CHECK(spark_protocol.event_loop());
+      ++passes;
+    }
+    CHECK_EQUAL(7, passes);
+    CHECK_ARRAY_EQUAL(description, outgoing, 50);
+  }
+
+  TEST_FIXTURE(SlowLinkFixture, NextMessageIsReadWhileRepliesWait)
+  {
+    uint8_t two_describes[36];
+    memcpy(two_describes, describe, 18);
+    memcpy(two_describes + 18, describe, 18);
+    incoming = two_describes;
+    incoming_length = 36;
+    receive_budget = 36;
+    CHECK(spark_protocol.event_loop());
+    CHECK(spark_protocol.event_loop());
+    CHECK_EQUAL(0, outgoing_length);
+    CHECK_EQUAL(36, incoming_position);
+
+    send_budget = 256;
+    CHECK(spark_protocol.event_loop());
+    CHECK_EQUAL(50, outgoing_length);
+    CHECK_ARRAY_EQUAL(description, outgoing, 50);
+  }
+
+  TEST_FIXTURE(SlowLinkFixture, StalledMessageDisconnectsAfter20Seconds)
+  {
+    incoming = describe;
+    incoming_length = 18;
+    receive_budget = 5;
+    CHECK(spark_protocol.event_loop());
+
+    next_millis = 20000;
+    CHECK(spark_protocol.event_loop());
+    next_millis = 20001;
+    CHECK(!spark_protocol.event_loop());
+  }
+
+  TEST_FIXTURE(SlowLinkFixture, StalledReplyDisconnectsAfter20Seconds)
+  {
+    incoming = describe;
+    incoming_length = 18;
+    receive_budget = 18;
+    send_budget = 8;
+    CHECK(spark_protocol.event_loop());
+
+    next_millis = 20000;
+    CHECK(spark_protocol.event_loop());
+    next_millis = 20001;
+    CHECK(!spark_protocol.event_loop());
+  }
+
+  TEST_FIXTURE(SlowLinkFixture, SendEventFailsInsteadOfWaitingWhenBufferIsFull)
+  {
+    // each event takes 66 bytes, and the send buffer holds 640
+    int queued = 0;
+    for (int i = 0; i < 20; ++i)
+    {
+      next_millis = i * 1000;
+      if (!spark_protocol.send_event("event", "0123456789012345678901234567890123456789",
+                                     60, EventType::PUBLIC))
+        break;
+      ++queued;
+    }
+    CHECK_EQUAL(8, queued);
+    CHECK_EQUAL(0, outgoing_length);
+
+    send_budget = 2 * 66;
+    CHECK(spark_protocol.event_loop());
+    next_millis = 20000;
+    CHECK(spark_protocol.send_event("event", "0123456789012345678901234567890123456789",
+                                    60, EventType::PUBLIC));
+  }
+}
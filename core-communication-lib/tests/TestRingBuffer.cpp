@@ -0,0 +1,138 @@
+#include "UnitTest++.h"
+#include "ring_buffer.h"
+
+SUITE(RingBuffer)
+{
+  TEST(NewRingIsEmpty)
+  {
+    RingBuffer<16> ring;
+    CHECK(ring.empty());
+    CHECK_EQUAL(0u, ring.size());
+    CHECK_EQUAL(15u, ring.space());
+    CHECK_EQUAL(-1, ring.get());
+    CHECK_EQUAL(-1, ring.peek());
+  }
+
+  TEST(PutThenGetReturnsSameBytesInOrder)
+  {
+    RingBuffer<16> ring;
+    CHECK(ring.put('a'));
+    CHECK(ring.put('b'));
+    CHECK_EQUAL(2u, ring.size());
+    CHECK_EQUAL('a', ring.peek());
+    CHECK_EQUAL('a', ring.get());
+    CHECK_EQUAL('b', ring.get());
+    CHECK(ring.empty());
+  }
+
+  TEST(PutFailsWhenFull)
+  {
+    RingBuffer<8> ring;
+    for (int i = 0; i < 7; i++)
+      CHECK(ring.put(i));
+    CHECK(!ring.put(7));
+    CHECK_EQUAL(0u, ring.space());
+  }
+
+  TEST(HighBytesComeBackPositive)
+  {
+    RingBuffer<8> ring;
+    ring.put(0xff);
+    CHECK_EQUAL(255, ring.get());
+  }
+
+  TEST(PushAndPopWrapAroundTheEnd)
+  {
+    RingBuffer<16> ring;
+    unsigned char src[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+    unsigned char dst[12];
+    CHECK_EQUAL(10u, ring.push(src, 10));
+    CHECK_EQUAL(10u, ring.pop(dst, 10));
+    CHECK_EQUAL(12u, ring.push(src, 12));
+    CHECK_EQUAL(12u, ring.pop(dst, 12));
+    CHECK_ARRAY_EQUAL(src, dst, 12);
+  }
+
+  TEST(PushStopsWhenFull)
+  {
+    RingBuffer<16> ring;
+    unsigned char src[20];
+    memset(src, 'x', 20);
+    CHECK_EQUAL(15u, ring.push(src, 20));
+    CHECK_EQUAL(0u, ring.push(src, 1));
+  }
+
+  TEST(PopStopsAtRequestedLengthWhenWrapped)
+  {
+    RingBuffer<16> ring;
+    unsigned char src[14] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13 };
+    unsigned char dst[16];
+    ring.push(src, 12);
+    ring.pop(dst, 12);
+    ring.push(src, 10);
+    memset(dst, '*', 16);
+    CHECK_EQUAL(2u, ring.pop(dst, 2));
+    CHECK_EQUAL('*', dst[2]);
+    CHECK_EQUAL(8u, ring.size());
+  }
+
+  TEST(WriteSpanEndsAtTheEndOfStorage)
+  {
+    RingBuffer<16> ring;
+    unsigned char dst[16];
+    unsigned char src[12] = { 0 };
+    ring.push(src, 12);
+    ring.pop(dst, 12);
+
+    unsigned int length;
+    unsigned char *span = ring.write_span(length);
+    CHECK_EQUAL(4u, length);
+    CHECK(ring.data() + 12 == span);
+    memcpy(span, "abcd", 4);
+    ring.commit(4);
+
+    span = ring.write_span(length);
+    CHECK_EQUAL(11u, length);
+    CHECK(ring.data() == span);
+  }
+
+  TEST(WriteSpanLeavesOneFreeByte)
+  {
+    RingBuffer<16> ring;
+    unsigned int length;
+    ring.write_span(length);
+    CHECK_EQUAL(15u, length);
+  }
+
+  TEST(ReadSpanReturnsFilledBytesUpToTheEnd)
+  {
+    RingBuffer<16> ring;
+    unsigned char src[14] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13 };
+    unsigned char dst[16];
+    ring.push(src, 12);
+    ring.pop(dst, 12);
+    ring.push(src, 6);
+
+    unsigned int length;
+    const unsigned char *span = ring.read_span(length);
+    CHECK_EQUAL(4u, length);
+    CHECK_ARRAY_EQUAL(src, span, 4);
+    ring.consume(4);
+
+    span = ring.read_span(length);
+    CHECK_EQUAL(2u, length);
+    CHECK_ARRAY_EQUAL(src + 4, span, 2);
+    ring.consume(2);
+    CHECK(ring.empty());
+  }
+
+  TEST(ClearEmptiesTheRing)
+  {
+    RingBuffer<8> ring;
+    ring.put(1);
+    ring.put(2);
+    ring.clear();
+    CHECK(ring.empty());
+    CHECK_EQUAL(7u, ring.space());
+  }
+}
@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <string.h>
+#include "UnitTest++.h"
+#include "tropicssl/sha1.h"
+
+struct SHA1Fixture
+{
+  static const uint8_t empty_digest[20];
+  static const uint8_t two_block_digest[20];
+  static const uint8_t million_a_digest[20];
+  static const uint8_t pattern_digest[20];
+  static const uint8_t long_key_hmac[20];
+  static const uint8_t pattern_hmac[20];
+
+  // the bytes (i * 7) & 0xff, as in the benchmark
+  uint8_t pattern[1001];
+  uint8_t digest[20];
+
+  SHA1Fixture()
+  {
+    for (int i = 0; i < (int)sizeof(pattern); i++)
+      pattern[i] = (uint8_t)(i * 7);
+  }
+};
+
+// FIPS 180-2 examples, and digests from Python's hashlib / hmac
+const uint8_t SHA1Fixture::empty_digest[20] = {
+  0xda, 0x39, 0xa3, 0xee, 0x5e, 0x6b, 0x4b, 0x0d, 0x32, 0x55,
+  0xbf, 0xef, 0x95, 0x60, 0x18, 0x90, 0xaf, 0xd8, 0x07, 0x09 };
+
+const uint8_t SHA1Fixture::two_block_digest[20] = {
+  0x84, 0x98, 0x3e, 0x44, 0x1c, 0x3b, 0xd2, 0x6e, 0xba, 0xae,
+  0x4a, 0xa1, 0xf9, 0x51, 0x29, 0xe5, 0xe5, 0x46, 0x70, 0xf1 };
+
+const uint8_t SHA1Fixture::million_a_digest[20] = {
+  0x34, 0xaa, 0x97, 0x3c, 0xd4, 0xc4, 0xda, 0xa4, 0xf6, 0x1e,
+  0xeb, 0x2b, 0xdb, 0xad, 0x27, 0x31, 0x65, 0x34, 0x01, 0x6f };
+
+const uint8_t SHA1Fixture::pattern_digest[20] = {
+  0x38, 0xf3, 0xaa, 0x58, 0x7f, 0x4a, 0xa0, 0x49, 0x65, 0xa3,
+  0x59, 0xf9, 0x15, 0x10, 0x92, 0x75, 0x9b, 0x3a, 0x4c, 0x2a };
+
+// RFC 2202 test case 6
+const uint8_t SHA1Fixture::long_key_hmac[20] = {
+  0xaa, 0x4a, 0xe5, 0xe1, 0x52, 0x72, 0xd0, 0x0e, 0x95, 0x70,
+  0x56, 0x37, 0xce, 0x8a, 0x3b, 0x55, 0xed, 0x40, 0x21, 0x12 };
+
+// key 00 01 .. 27, the first 300 pattern bytes
+const uint8_t SHA1Fixture::pattern_hmac[20] = {
+  0xa5, 0xbb, 0xc5, 0xe7, 0x21, 0x29, 0x04, 0x30, 0x6d, 0xde,
+  0x1c, 0xf6, 0x25, 0x11, 0xf0, 0x98, 0xba, 0x8d, 0xd3, 0xca };
+
+SUITE(SHA1)
+{
+  TEST_FIXTURE(SHA1Fixture, EmptyMessage)
+  {
+    sha1(pattern, 0, digest);
+    CHECK_ARRAY_EQUAL(empty_digest, digest, 20);
+  }
+
+  TEST_FIXTURE(SHA1Fixture, TwoBlockMessage)
+  {
+    const char *message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    sha1((const unsigned char *)message, strlen(message), digest);
+    CHECK_ARRAY_EQUAL(two_block_digest, digest, 20);
+  }
+
+  TEST_FIXTURE(SHA1Fixture, MillionAs)
+  {
+    uint8_t a[1000];
+    memset(a, 'a', sizeof(a));
+    sha1_context ctx;
+    sha1_starts(&ctx);
+    for (int i = 0; i < 1000; i++)
+      sha1_update(&ctx, a, sizeof(a));
+    sha1_finish(&ctx, digest);
+    CHECK_ARRAY_EQUAL(million_a_digest, digest, 20);
+  }
+
+  TEST_FIXTURE(SHA1Fixture, ManyBlocksInOneUpdate)
+  {
+    sha1(pattern, 1000, digest);
+    CHECK_ARRAY_EQUAL(pattern_digest, digest, 20);
+  }
+
+  TEST_FIXTURE(SHA1Fixture, UnalignedInput)
+  {
+    uint8_t shifted[1001];
+    memcpy(shifted + 1, pattern, 1000);
+    sha1(shifted + 1, 1000, digest);
+    CHECK_ARRAY_EQUAL(pattern_digest, digest, 20);
+  }
+
+  TEST_FIXTURE(SHA1Fixture, AnySplitOfTheInputGivesTheSameDigest)
+  {
+    // every split point puts a different amount in the context's buffer
+    // before the remaining whole blocks go through in one run
+    sha1_context ctx;
+    for (int split = 0; split <= 200; split++)
+    {
+      sha1_starts(&ctx);
+      sha1_update(&ctx, pattern, split);
+      sha1_update(&ctx, pattern + split, 1000 - split);
+      sha1_finish(&ctx, digest);
+      CHECK_ARRAY_EQUAL(pattern_digest, digest, 20);
+    }
+  }
+
+  TEST_FIXTURE(SHA1Fixture, HMACWithKeyLongerThanABlock)
+  {
+    uint8_t key[80];
+    memset(key, 0xaa, sizeof(key));
+    const char *message = "Test Using Larger Than Block-Size Key - Hash Key First";
+    sha1_hmac(key, sizeof(key), (const unsigned char *)message, strlen(message), digest);
+    CHECK_ARRAY_EQUAL(long_key_hmac, digest, 20);
+  }
+
+  TEST_FIXTURE(SHA1Fixture, HMACOverSeveralBlocks)
+  {
+    uint8_t key[40];
+    for (int i = 0; i < 40; i++)
+      key[i] = i;
+    sha1_hmac(key, sizeof(key), pattern, 300, digest);
+    CHECK_ARRAY_EQUAL(pattern_hmac, digest, 20);
+  }
+}
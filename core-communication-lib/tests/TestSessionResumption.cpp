@@ -0,0 +1,239 @@
+#include "UnitTest++.h"
+#include "spark_protocol.h"
+#include "handshake.h"
+#include "ConstructorFixture.h"
+#include <string.h>
+
+// Plays the cloud's side of the handshake from a script, and remembers
+// everything the core sent. Running off the end of the script looks like
+// a dropped connection.
+struct ResumptionFixture : public ConstructorFixture
+{
+  static uint8_t incoming[512];
+  static int incoming_length;
+  static int incoming_position;
+  static uint8_t outgoing[512];
+  static int outgoing_length;
+
+  static int script_receive(unsigned char *buf, int buflen);
+  static int script_send(const unsigned char *buf, int buflen);
+
+  uint8_t credentials[40];
+
+  ResumptionFixture()
+  {
+    callbacks.send = script_send;
+    callbacks.receive = script_receive;
+    spark_protocol.init(id, keys, callbacks, descriptor);
+    decipher_aes_credentials(private_key, signed_encrypted_credentials, credentials);
+    reset_link();
+  }
+
+  void reset_link()
+  {
+    incoming_length = incoming_position = outgoing_length = 0;
+  }
+
+  void script(const uint8_t *data, int length)
+  {
+    memcpy(incoming + incoming_length, data, length);
+    incoming_length += length;
+  }
+
+  int full_handshake()
+  {
+    reset_link();
+    script(nonce, 40);
+    script(signed_encrypted_credentials, 384);
+    return spark_protocol.handshake();
+  }
+
+  // What a cloud that remembers 'session' answers to 'request'
+  static void server_proof(const uint8_t *session, const uint8_t *server_nonce,
+                           const uint8_t *request, uint8_t *proof)
+  {
+    sha1_context sha;
+    sha1_hmac_starts(&sha, session, 40);
+    sha1_hmac_update(&sha, server_nonce, 40);
+    sha1_hmac_update(&sha, request + 14, 20);
+    sha1_hmac_finish(&sha, proof);
+  }
+
+  static void derive(const uint8_t *session, const uint8_t *server_nonce,
+                     uint8_t *derived)
+  {
+    uint8_t block[20];
+    sha1_context sha;
+    for (unsigned char label = 1; label <= 2; ++label)
+    {
+      sha1_hmac_starts(&sha, session, 40);
+      sha1_hmac_update(&sha, server_nonce, 40);
+      sha1_hmac_update(&sha, &label, 1);
+      sha1_hmac_finish(&sha, block);
+      memcpy(derived + 20 * (label - 1), block, 20);
+    }
+  }
+
+  // Sends the resume request's proof back, as a cloud holding 'session'
+  // would, once the core has sent its request. The request depends only on
+  // the nonce, the id and the session, so it can be worked out up front.
+  void script_resume(const uint8_t *session, const uint8_t *server_nonce)
+  {
+    uint8_t nonce_and_id[52];
+    uint8_t request[34];
+    uint8_t proof[20];
+    memcpy(nonce_and_id, server_nonce, 40);
+    memcpy(nonce_and_id + 40, id, 12);
+    sha1_hmac(session, 40, nonce_and_id, 52, request + 14);
+    server_proof(session, server_nonce, request, proof);
+
+    script(server_nonce, 40);
+    script(proof, 20);
+  }
+};
+
+uint8_t ResumptionFixture::incoming[512];
+int ResumptionFixture::incoming_length = 0;
+int ResumptionFixture::incoming_position = 0;
+uint8_t ResumptionFixture::outgoing[512];
+int ResumptionFixture::outgoing_length = 0;
+
+int ResumptionFixture::script_receive(unsigned char *buf, int buflen)
+{
+  int count = incoming_length - incoming_position;
+  if (0 == count) return -1;
+  if (count > buflen) count = buflen;
+  memcpy(buf, incoming + incoming_position, count);
+  incoming_position += count;
+  return count;
+}
+
+int ResumptionFixture::script_send(const unsigned char *buf, int buflen)
+{
+  memcpy(outgoing + outgoing_length, buf, buflen);
+  outgoing_length += buflen;
+  return buflen;
+}
+
+static const uint8_t other_nonce[40] = {
+  0x6a, 0x2f, 0x90, 0x11, 0xc4, 0x3e, 0x58, 0x07,
+  0xb9, 0xd2, 0x4e, 0x81, 0x1c, 0xf3, 0x65, 0xa0,
+  0x27, 0x9b, 0x0d, 0xe6, 0x52, 0x38, 0xcf, 0x74,
+  0x13, 0xae, 0x89, 0x5d, 0xf0, 0x46, 0xb1, 0x2c,
+  0x97, 0x0e, 0x63, 0xda, 0x38, 0x85, 0x1f, 0xc2 };
+
+SUITE(SessionResumption)
+{
+  TEST_FIXTURE(ResumptionFixture, HandshakeUsesRSAUnlessResumptionIsEnabled)
+  {
+    CHECK_EQUAL(0, full_handshake());
+    CHECK_EQUAL(0, full_handshake());
+    CHECK_EQUAL(256 + 18, outgoing_length);
+  }
+
+  TEST_FIXTURE(ResumptionFixture, FirstHandshakeUsesRSA)
+  {
+    spark_protocol.enable_session_resumption(true);
+    CHECK_EQUAL(0, full_handshake());
+    CHECK_EQUAL(256 + 18, outgoing_length);
+  }
+
+  TEST_FIXTURE(ResumptionFixture, ReconnectProvesSessionWithHMAC)
+  {
+    spark_protocol.enable_session_resumption(true);
+    full_handshake();
+
+    reset_link();
+    script_resume(credentials, other_nonce);
+    CHECK_EQUAL(0, spark_protocol.handshake());
+    CHECK_EQUAL(34 + 18, outgoing_length);
+
+    uint8_t nonce_and_id[52];
+    uint8_t hmac[20];
+    memcpy(nonce_and_id, other_nonce, 40);
+    memcpy(nonce_and_id + 40, id, 12);
+    sha1_hmac(credentials, 40, nonce_and_id, 52, hmac);
+    CHECK_EQUAL(0xFF, outgoing[0]);
+    CHECK_EQUAL(0xFF, outgoing[1]);
+    CHECK_ARRAY_EQUAL((const uint8_t *)id, outgoing + 2, 12);
+    CHECK_ARRAY_EQUAL(hmac, outgoing + 14, 20);
+  }
+
+  TEST_FIXTURE(ResumptionFixture, ResumedSessionUsesFreshKeys)
+  {
+    spark_protocol.enable_session_resumption(true);
+    full_handshake();
+
+    reset_link();
+    script_resume(credentials, other_nonce);
+    spark_protocol.handshake();
+
+    // the hello after the resume request decrypts with the derived key and IV
+    uint8_t derived[40];
+    derive(credentials, other_nonce, derived);
+    uint8_t hello[16];
+    aes_context aes;
+    aes_setkey_dec(&aes, derived, 128);
+    aes_crypt_cbc(&aes, AES_DECRYPT, 16, derived + 16, outgoing + 36, hello);
+    CHECK_EQUAL(0x50, hello[0]);
+    CHECK_EQUAL(0x02, hello[1]);
+    CHECK_EQUAL(0xb1, hello[4]);
+    CHECK_EQUAL('h', hello[5]);
+  }
+
+  TEST_FIXTURE(ResumptionFixture, NextResumptionChainsFromDerivedKeys)
+  {
+    spark_protocol.enable_session_resumption(true);
+    full_handshake();
+
+    reset_link();
+    script_resume(credentials, other_nonce);
+    spark_protocol.handshake();
+
+    uint8_t derived[40];
+    derive(credentials, other_nonce, derived);
+    reset_link();
+    script_resume(derived, nonce);
+    CHECK_EQUAL(0, spark_protocol.handshake());
+    CHECK_EQUAL(34 + 18, outgoing_length);
+  }
+
+  TEST_FIXTURE(ResumptionFixture, UnknownSessionFallsBackToRSAOnSameConnection)
+  {
+    spark_protocol.enable_session_resumption(true);
+    full_handshake();
+
+    reset_link();
+    uint8_t refusal[20];
+    memset(refusal, 0, 20);
+    script(other_nonce, 40);
+    script(refusal, 20);
+    script(signed_encrypted_credentials, 384);
+    CHECK_EQUAL(0, spark_protocol.handshake());
+    CHECK_EQUAL(34 + 256 + 18, outgoing_length);
+  }
+
+  TEST_FIXTURE(ResumptionFixture, DroppedResumeForgetsSession)
+  {
+    spark_protocol.enable_session_resumption(true);
+    full_handshake();
+
+    reset_link();
+    script(other_nonce, 40);
+    CHECK(0 > spark_protocol.handshake());
+
+    CHECK_EQUAL(0, full_handshake());
+    CHECK_EQUAL(256 + 18, outgoing_length);
+  }
+
+  TEST_FIXTURE(ResumptionFixture, DisablingResumptionForgetsSession)
+  {
+    spark_protocol.enable_session_resumption(true);
+    full_handshake();
+    spark_protocol.enable_session_resumption(false);
+    spark_protocol.enable_session_resumption(true);
+
+    CHECK_EQUAL(0, full_handshake());
+    CHECK_EQUAL(256 + 18, outgoing_length);
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stdio.h>
+#include <time.h>
+
+// Runs body until at least a quarter second has passed and prints the rate,
+// counting bytes_per_run bytes per pass
+#define BENCH(name, bytes_per_run, body)                                  \
+  do {                                                                    \
+    long runs = 0;                                                        \
+    clock_t start = clock();                                              \
+    clock_t elapsed;                                                      \
+    do {                                                                  \
+      for (int bench_i = 0; bench_i < 64; bench_i++) { body; }            \
+      runs += 64;                                                         \
+      elapsed = clock() - start;                                          \
+    } while (elapsed < CLOCKS_PER_SEC / 4);                               \
+    double seconds = (double)elapsed / CLOCKS_PER_SEC;                    \
+    printf("  %-40s %10.1f MB/s %12.0f runs/s\n", name,                   \
+           runs * (double)(bytes_per_run) / seconds / 1e6, runs / seconds); \
+  } while (0)
+
+// Keeps the optimizer from dropping work whose result is unused
+extern volatile unsigned int bench_sink;
+
+void bench_ring_buffer(void);
+void bench_bignum(void);
+void bench_sha1(void);
+void bench_aes(void);
+
+#endif // __BENCH_H
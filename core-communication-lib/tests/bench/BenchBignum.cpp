@@ -0,0 +1,59 @@
+#include <string.h>
+#include "Bench.h"
+#include "tropicssl/bignum.h"
+
+namespace {
+
+const char modulus[] =
+  "ED19C2CBC377F79C4181C14E5B84BEFE10A7DD62DFA9B6C005E638C247D7E1ED"
+  "7C568415E1109301819A491BBCD399762BF5C7D5A04F0301518884AF2BE0C133"
+  "7931DB9D7B2836162B82A35FC263B4204B30BD90FF3FA312647B630F7D42A132"
+  "4CAE8E39E278C19B54AA01F9EF63CD2C0E1089135AEBDCD9256AE9713FDFEFE7";
+
+const char base[] =
+  "C14F3CCF065BF843CD6A9F626AAFCFF691220764EC94EB485601CEFEF880D484"
+  "DCEADE622C9ACEAB189271AB8800858562DCE7998B006BD39E9C3323F971F1FC"
+  "51E8300D06AD001F246966F41AC3DCD873931D4E3404F1DE349BBBCDC341DF8E"
+  "36D689AC84542A6D78165D63F14C32F494940765B6E43FE2FA43027AD9541A6F";
+
+const char private_exponent[] =
+  "CE0D56E7318AF2D42DB1D626EBCBCF8A48BFE7718A4C44B5504A603AAFA0DA73"
+  "99FBE2FD34FD85E0D1582F10C13625E2810243920C69DF7D328935F5B4BD6700"
+  "7421D88906E36D6334ECDFDCCFFB82A2C027197C1FE21625334507D49C89BE5D"
+  "83C5289E5F46E4F4E9B28C9AEDDABC7BD73CD67BB131A40E8D278B620BF35B6C";
+
+}
+
+void bench_bignum(void)
+{
+  printf("Bignum\n");
+
+  mpi N, A, E, X, RR;
+  mpi_init(&N); mpi_init(&A); mpi_init(&E); mpi_init(&X); mpi_init(&RR);
+  mpi_read_string(&N, 16, modulus);
+  mpi_read_string(&A, 16, base);
+
+  // RR is cached by the caller, as rsa_public()/rsa_private() do
+  mpi_lset(&E, 65537);
+  BENCH("exp_mod 1024-bit, e = 65537", 128, {
+    mpi_exp_mod(&X, &A, &E, &N, &RR);
+    bench_sink += X.p[0];
+  });
+
+  mpi_read_string(&E, 16, private_exponent);
+  BENCH("exp_mod 1024-bit, 1024-bit exponent", 128, {
+    mpi_exp_mod(&X, &A, &E, &N, &RR);
+    bench_sink += X.p[0];
+  });
+
+  // the size of each CRT half of an RSA-1024 private key operation
+  mpi_read_string(&N, 16, modulus + 128);
+  mpi_read_string(&E, 16, private_exponent + 128);
+  mpi_free(&RR);
+  BENCH("exp_mod 512-bit, 512-bit exponent", 64, {
+    mpi_exp_mod(&X, &A, &E, &N, &RR);
+    bench_sink += X.p[0];
+  });
+
+  mpi_free(&RR); mpi_free(&X); mpi_free(&E); mpi_free(&A); mpi_free(&N);
+}
@@ -0,0 +1,73 @@
+#include "Bench.h"
+#include "ring_buffer.h"
+
+namespace {
+
+// The usual modulo ring, as in spark_wiring_usartserial.cpp, for comparison
+struct ModuloRing
+{
+  static const unsigned int SIZE = 640;
+  unsigned char buffer[SIZE];
+  volatile unsigned int head;
+  volatile unsigned int tail;
+
+  ModuloRing() : head(0), tail(0) { }
+
+  bool put(unsigned char c)
+  {
+    unsigned int next = (head + 1) % SIZE;
+    if (next == tail)
+      return false;
+    buffer[head] = c;
+    head = next;
+    return true;
+  }
+
+  int get()
+  {
+    if (head == tail)
+      return -1;
+    unsigned char c = buffer[tail];
+    tail = (tail + 1) % SIZE;
+    return c;
+  }
+};
+
+unsigned char payload[512];
+
+}
+
+void bench_ring_buffer(void)
+{
+  printf("RingBuffer\n");
+
+  ModuloRing modulo;
+  BENCH("modulo ring, put/get 512 bytes", 512, {
+    for (int i = 0; i < 512; i++) modulo.put(payload[i]);
+    for (int i = 0; i < 512; i++) bench_sink += modulo.get();
+  });
+
+  RingBuffer<1024> ring;
+  BENCH("RingBuffer<1024>, put/get 512 bytes", 512, {
+    for (int i = 0; i < 512; i++) ring.put(payload[i]);
+    for (int i = 0; i < 512; i++) bench_sink += ring.get();
+  });
+
+  unsigned char out[512];
+  BENCH("RingBuffer<1024>, push/pop 512 bytes", 512, {
+    ring.push(payload, 512);
+    ring.pop(out, 512);
+    bench_sink += out[bench_i];
+  });
+
+  BENCH("RingBuffer<1024>, spans of 512 bytes", 512, {
+    unsigned int length;
+    unsigned char *dst = ring.write_span(length);
+    if (length > 512) length = 512;
+    memcpy(dst, payload, length);
+    ring.commit(length);
+    const unsigned char *src = ring.read_span(length);
+    bench_sink += src[0];
+    ring.consume(length);
+  });
+}
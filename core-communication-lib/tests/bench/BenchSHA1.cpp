@@ -0,0 +1,43 @@
+#include <string.h>
+#include "Bench.h"
+#include "tropicssl/sha1.h"
+
+void bench_sha1(void)
+{
+  printf("SHA-1\n");
+
+  static unsigned char data[1025];
+  unsigned char digest[20];
+  sha1_context ctx;
+  for (int i = 0; i < (int)sizeof(data); i++)
+    data[i] = (unsigned char)(i * 7);
+
+  BENCH("sha1 1 KB, 64-byte updates", 1024, {
+    sha1_starts(&ctx);
+    for (int j = 0; j < 1024; j += 64)
+      sha1_update(&ctx, data + j, 64);
+    sha1_finish(&ctx, digest);
+    bench_sink += digest[0];
+  });
+
+  BENCH("sha1 1 KB, one update", 1024, {
+    sha1(data, 1024, digest);
+    bench_sink += digest[0];
+  });
+
+  BENCH("sha1 1 KB, one update, unaligned", 1024, {
+    sha1(data + 1, 1024, digest);
+    bench_sink += digest[0];
+  });
+
+  // a secure channel request: 40-byte key, 48-byte frame
+  BENCH("hmac-sha1 48-byte frame", 48, {
+    sha1_hmac(data, 40, data + 64, 48, digest);
+    bench_sink += digest[0];
+  });
+
+  BENCH("hmac-sha1 512-byte frame", 512, {
+    sha1_hmac(data, 40, data + 64, 512, digest);
+    bench_sink += digest[0];
+  });
+}
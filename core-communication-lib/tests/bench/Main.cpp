@@ -0,0 +1,12 @@
+#include "Bench.h"
+
+volatile unsigned int bench_sink;
+
+int main(int, char const *[])
+{
+  bench_ring_buffer();
+  bench_bignum();
+  bench_sha1();
+  bench_aes();
+  return 0;
+}
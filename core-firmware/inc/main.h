@@ -89,6 +89,7 @@ extern "C" {
 //#define RGB_NOTIFICATIONS_CONNECTING_ONLY
 
 #define USART_RX_DATA_SIZE			256
+#define USB_RX_RING_SIZE			128	// Must be a power of 2, and hold at least one packet
 
 /* Exported functions ------------------------------------------------------- */
 void Timing_Decrement(void);
@@ -28,8 +28,11 @@
 
 #include "spark_wiring_client.h"
 #include "spark_wiring.h"
+#include "ring_buffer.h"
 
-#define TCPCLIENT_BUF_MAX_SIZE	128
+#define TCPCLIENT_BUF_MAX_SIZE	128	// Must be a power of 2
+#define TCPCLIENT_TX_BUF_MAX_SIZE	128	// Small writes are coalesced here into one CC3000 send()
+#define TCPCLIENT_TX_FLUSH_DELAY	10	// Milliseconds a partial transmit buffer may wait before it is sent
 
 class TCPClient : public Client {
 
@@ -43,6 +46,7 @@ public:
 	virtual int connect(const char *host, uint16_t port);
 	virtual size_t write(uint8_t);
 	virtual size_t write(const uint8_t *buffer, size_t size);
+	virtual size_t write(const uint8_t * const buffers[], const size_t sizes[], int count);
 	virtual int available();
 	virtual int read();
 	virtual int read(uint8_t *buffer, size_t size);
@@ -56,13 +60,29 @@ public:
 
 	using Print::write;
 
+	// Sends everything queued by write() right away, like flush(). Returns false if that
+	// send, or an earlier deferred one for this socket, failed.
+	bool sendQueued();
+
+	// Sends queued output once TCPCLIENT_TX_FLUSH_DELAY has passed. Called from the main loop.
+	static void sendPendingIfDue();
+
 private:
 	static uint16_t _srcport;
 	long _sock;
-	uint8_t _buffer[TCPCLIENT_BUF_MAX_SIZE];
-	uint16_t _offset;
-	uint16_t _total;
+	RingBuffer<TCPCLIENT_BUF_MAX_SIZE> _rxBuffer;
+	// Output queued by write(). TCPClient objects are copied around by value, so
+	// the queue is shared by all of them, and belongs to whichever socket filled it.
+	static long _txSock;
+	static uint8_t _txBuffer[TCPCLIENT_TX_BUF_MAX_SIZE];
+	static uint16_t _txCount;
+	static system_tick_t _txDeadline;
+	// Socket whose queued output failed to send after write() had already returned. Its
+	// next write(), sendQueued() and connected() fail until it is stopped.
+	static long _txFailedSock;
 	inline int bufferCount();
+	void clearReceiveBuffer();
+	static bool sendPending();
 };
 
 #endif
@@ -43,6 +43,8 @@ public:
 	virtual void begin();
 	virtual size_t write(uint8_t);
 	virtual size_t write(const uint8_t *buf, size_t size);
+	virtual size_t write(const uint8_t * const buffers[], const size_t sizes[], int count);
+	virtual void flush();
 
 	using Print::write;
 };
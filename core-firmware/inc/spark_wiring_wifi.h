@@ -38,7 +38,7 @@ class IPAddress;
 class WiFiClass
 {
 public:
-	WiFiClass() {}
+	WiFiClass() : _pingPending(false) {}
 	~WiFiClass() {}
 
         uint8_t* macAddress(uint8_t* mac);
@@ -49,6 +49,8 @@ public:
         int8_t RSSI();
         uint32_t ping(IPAddress remoteIP);
         uint32_t ping(IPAddress remoteIP, uint8_t nTries);
+        bool pingStart(IPAddress remoteIP, uint8_t nTries);
+        int pingResult(void);
 
         static void connect(void);
         static void disconnect(void);
@@ -72,6 +74,8 @@ private:
         uint32_t _functionStart;
         uint8_t _loopCount;
         int8_t _returnValue;
+        bool _pingPending;
+        system_tick_t _pingDeadline;
 };
 
 extern WiFiClass WiFi;
@@ -88,6 +88,7 @@ extern volatile uint8_t SPARK_LED_FADE;
 
 extern volatile uint8_t WLAN_DISCONNECT;
 extern volatile uint8_t WLAN_DHCP;
+extern volatile uint32_t WLAN_DISCONNECT_EVENTS;
 extern volatile uint8_t WLAN_MANUAL_CONNECT;
 extern volatile uint8_t WLAN_DELETE_PROFILES;
 extern volatile uint8_t WLAN_SMART_CONFIG_START;
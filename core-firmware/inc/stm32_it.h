@@ -69,6 +69,7 @@ void TIM3_IRQHandler(void);
 void TIM4_IRQHandler(void);
 void RTC_IRQHandler(void);
 void RTCAlarm_IRQHandler(void);
+void DMA1_Channel4_IRQHandler(void);
 void DMA1_Channel5_IRQHandler(void);
 void USB_LP_CAN1_RX0_IRQHandler(void);
 
@@ -0,0 +1,294 @@
+/**
+ * Persistent log of door events, kept in the unused External Flash above the random seeds.
+ *
+ * The log is a ring of fixed-size 8-byte DoorEvent records spanning every 4KB sector between
+ * HISTORY_START_ADDRESS and HISTORY_END_ADDRESS. The sector following the one currently being written
+ * is always kept erased, which is how the head of the ring is found again after a reboot. Once the ring
+ * wraps, the oldest sector is erased just ahead of the writer, so wear is spread evenly over all sectors.
+ *
+ * The device never learns the real time (it runs in MANUAL mode, without the Cloud), so events carry
+ * the seconds since boot instead, the same clock as StatusBeacon's Uptime. A BOOT event is logged on
+ * every boot, so an event belongs to the boot of the nearest older BOOT event. Clients can put wall clock
+ * times on the current boot's events by comparing with a beacon's Uptime. Older boots can only be
+ * ordered. Like Uptime, the seconds wrap after about 49.7 days.
+ *
+ * log() only appends to a small RAM batch. The batch is programmed into flash from loop() once it fills
+ * up or HISTORY_FLUSH_DELAY expires, so a request never waits on an erase or a program cycle.
+ *
+ * @author Val Blant
+ */
+
+#ifndef LIBRARIES_GARAGE_DOORHISTORY_H_
+#define LIBRARIES_GARAGE_DOORHISTORY_H_
+
+#include "application.h"
+#include <spark_secure_channel/SparkRandomNumberGenerator.h>
+#include "Timer.h"
+#include "utils.h"
+
+
+#define HISTORY_START_ADDRESS	(CURRENT_SEED_INDEX_ADDRESS + sFLASH_PAGESIZE) // Skip the sector holding the seed index
+#define HISTORY_END_ADDRESS		0x200000 // End of the 2MB SST25VF016
+#define HISTORY_SECTOR_COUNT	((HISTORY_END_ADDRESS - HISTORY_START_ADDRESS) / sFLASH_PAGESIZE)
+
+#define HISTORY_RECORDS_PER_SECTOR	(sFLASH_PAGESIZE / sizeof(DoorEvent))
+#define HISTORY_RECORD_SLOTS		(HISTORY_SECTOR_COUNT * HISTORY_RECORDS_PER_SECTOR)
+
+#define HISTORY_BATCH_SIZE		32		// Records held in RAM before they must be programmed (256 bytes)
+#define HISTORY_FLUSH_THRESHOLD	16		// Program the batch as soon as this many records are waiting
+#define HISTORY_FLUSH_DELAY		10000	// ...or this many milliseconds after the first record was queued
+
+
+/**
+ * One entry of the door history, exactly as it is stored in External Flash.
+ */
+struct DoorEvent {
+	enum Type { BOOT, DOOR_OPENED, DOOR_CLOSED, COMMAND_OPEN, COMMAND_CLOSE, COMMAND_PRESS_BUTTON };
+	enum Source { SOURCE_DEVICE, SOURCE_SENSOR, SOURCE_SECURE_CHANNEL };
+
+	uint32_t timestamp;	// Seconds since boot when the event was logged. Not a real time, see above.
+	uint8_t type;		// DoorEvent::Type
+	uint8_t door;		// Index of the door. We only have one for now.
+	uint8_t source;		// DoorEvent::Source
+	uint8_t check;		// Guards against torn writes and tells a written slot from an erased one
+
+	uint8_t computeCheck() const {
+		const uint8_t* bytes = (const uint8_t*) this;
+		uint8_t c = 0x5A;
+		for ( unsigned int i = 0; i < sizeof(DoorEvent) - 1; i++ ) {
+			c ^= bytes[i];
+		}
+		return c;
+	}
+
+	bool isValid() const { return check == computeCheck() && type != 0xFF; }
+};
+
+
+class DoorHistory {
+public:
+	DoorHistory() :
+		head(0),
+		batchCount(0),
+		droppedRecords(0),
+		ready(false),
+		flushTimer(HISTORY_FLUSH_DELAY) {
+
+	}
+
+	/**
+	 * Locates the head of the ring in External Flash. Must be called from setup(), since flash
+	 * is not available during static initialization.
+	 */
+	void begin();
+
+	/**
+	 * Queues an event for writing. Never touches the flash, so it is safe to call from the request path.
+	 */
+	void log(DoorEvent::Type type, DoorEvent::Source source, uint8_t door = 0);
+
+	/**
+	 * Programs queued events into flash if enough of them have accumulated, or if they have waited
+	 * for too long. Call this from the main loop.
+	 */
+	void loop();
+
+	/**
+	 * Programs all queued events into flash right away
+	 */
+	void flush();
+
+	/**
+	 * Copies up to 'maxRecords' events into 'records', newest first, after skipping the 'skip' newest ones.
+	 * Events still waiting in RAM are included. Returns the number of events copied.
+	 */
+	int read(uint32_t skip, DoorEvent records[], int maxRecords);
+
+	/**
+	 * Number of events lost because the RAM batch was full
+	 */
+	uint32_t getDroppedRecords() { return droppedRecords; }
+
+private:
+	/**
+	 * Index of the next free slot in the ring
+	 */
+	uint32_t head;
+
+	/**
+	 * Events waiting to be programmed
+	 */
+	DoorEvent batch[HISTORY_BATCH_SIZE];
+	int batchCount;
+
+	uint32_t droppedRecords;
+	bool ready;
+
+	/**
+	 * Started when the first event is queued into an empty batch
+	 */
+	Timer flushTimer;
+
+	static uint32_t slotAddress(uint32_t slot) {
+		return HISTORY_START_ADDRESS + slot * sizeof(DoorEvent);
+	}
+
+	static uint32_t sectorAddress(uint32_t sector) {
+		return HISTORY_START_ADDRESS + (sector % HISTORY_SECTOR_COUNT) * sFLASH_PAGESIZE;
+	}
+
+	static bool isSlotErased(uint32_t slot);
+
+	/**
+	 * Programs 'count' events starting at the head, erasing the next sector whenever the head enters a new one
+	 */
+	void program(const DoorEvent records[], int count);
+};
+
+
+bool DoorHistory::isSlotErased(uint32_t slot) {
+	uint32_t raw[2];
+	sFLASH_ReadBuffer((uint8_t*) raw, slotAddress(slot), sizeof(raw));
+
+	return raw[0] == 0xFFFFFFFF && raw[1] == 0xFFFFFFFF;
+}
+
+void DoorHistory::begin() {
+	// The head sector is the last written sector that is followed by an erased one
+	//
+	int headSector = -1;
+	for ( uint32_t sector = 0; sector < HISTORY_SECTOR_COUNT; sector++ ) {
+		uint32_t nextSector = (sector + 1) % HISTORY_SECTOR_COUNT;
+
+		if ( !isSlotErased(sector * HISTORY_RECORDS_PER_SECTOR) && isSlotErased(nextSector * HISTORY_RECORDS_PER_SECTOR) ) {
+			headSector = sector;
+			break;
+		}
+	}
+
+	if ( headSector < 0 ) {
+		// Nothing usable in flash. Start a fresh ring at the first sector.
+		//
+		debug(LOG_STR("Starting new door history log"));
+		sFLASH_EraseSector(sectorAddress(0));
+		sFLASH_EraseSector(sectorAddress(1));
+		head = 0;
+	}
+	else {
+		// Slots within a sector are written in order, so binary search for the first erased one
+		//
+		uint32_t low = headSector * HISTORY_RECORDS_PER_SECTOR;
+		uint32_t high = low + HISTORY_RECORDS_PER_SECTOR;
+		while ( low < high ) {
+			uint32_t middle = (low + high) / 2;
+			if ( isSlotErased(middle) ) {
+				high = middle;
+			}
+			else {
+				low = middle + 1;
+			}
+		}
+		head = low % HISTORY_RECORD_SLOTS;
+
+		// If the head sector is full, the next one has been pre-erased, but the one after it has not
+		//
+		if ( head % HISTORY_RECORDS_PER_SECTOR == 0 ) {
+			sFLASH_EraseSector(sectorAddress(head / HISTORY_RECORDS_PER_SECTOR + 1));
+		}
+	}
+
+	ready = true;
+
+	debug(LOG_STR("Door history head at slot "), 0); debug((int) head);
+}
+
+void DoorHistory::log(DoorEvent::Type type, DoorEvent::Source source, uint8_t door) {
+	if ( batchCount == HISTORY_BATCH_SIZE ) {
+		droppedRecords++;
+		return;
+	}
+
+	DoorEvent& event = batch[batchCount++];
+	event.timestamp = millis() / 1000;
+	event.type = type;
+	event.door = door;
+	event.source = source;
+	event.check = event.computeCheck();
+
+	if ( !flushTimer.isRunning() ) {
+		flushTimer.start();
+	}
+}
+
+void DoorHistory::loop() {
+	if ( batchCount >= HISTORY_FLUSH_THRESHOLD || (flushTimer.isRunning() && flushTimer.isElapsed()) ) {
+		flush();
+	}
+}
+
+void DoorHistory::flush() {
+	if ( !ready || batchCount == 0 ) {
+		return;
+	}
+
+	program(batch, batchCount);
+
+	batchCount = 0;
+	flushTimer.stop();
+}
+
+void DoorHistory::program(const DoorEvent records[], int count) {
+	while ( count > 0 ) {
+		// Write as much as fits into the current sector with one auto-increment program
+		//
+		uint32_t roomInSector = HISTORY_RECORDS_PER_SECTOR - (head % HISTORY_RECORDS_PER_SECTOR);
+		int chunk = count < (int) roomInSector ? count : roomInSector;
+
+		sFLASH_WriteBuffer((const uint8_t*) records, slotAddress(head), chunk * sizeof(DoorEvent));
+
+		records += chunk;
+		count -= chunk;
+		head = (head + chunk) % HISTORY_RECORD_SLOTS;
+
+		// Entering a new sector. Keep the one after it erased, dropping the oldest events once we wrap.
+		//
+		if ( head % HISTORY_RECORDS_PER_SECTOR == 0 ) {
+			sFLASH_EraseSector(sectorAddress(head / HISTORY_RECORDS_PER_SECTOR + 1));
+		}
+	}
+}
+
+int DoorHistory::read(uint32_t skip, DoorEvent records[], int maxRecords) {
+	int copied = 0;
+
+	// Newest events are still in RAM
+	//
+	while ( copied < maxRecords && skip < (uint32_t) batchCount ) {
+		records[copied++] = batch[batchCount - 1 - skip];
+		skip++;
+	}
+
+	if ( !ready ) {
+		return copied;
+	}
+
+	// Then walk backwards through the ring. One sector is always erased, so that bounds the walk.
+	//
+	uint32_t flashSkip = skip - batchCount;
+	while ( copied < maxRecords && flashSkip < HISTORY_RECORD_SLOTS - HISTORY_RECORDS_PER_SECTOR ) {
+		uint32_t slot = (head + HISTORY_RECORD_SLOTS - 1 - flashSkip) % HISTORY_RECORD_SLOTS;
+
+		DoorEvent event;
+		sFLASH_ReadBuffer((uint8_t*) &event, slotAddress(slot), sizeof(event));
+		if ( !event.isValid() ) {
+			break; // Reached the erased part of the ring
+		}
+
+		records[copied++] = event;
+		flashSkip++;
+	}
+
+	return copied;
+}
+
+#endif /* LIBRARIES_GARAGE_DOORHISTORY_H_ */
@@ -9,6 +9,7 @@
 #define LIBRARIES_GARAGE_GARAGE_H_
 
 #include <spark_secure_channel/SparkSecureChannelServer.h>
+#include "DoorHistory.h"
 #include "Timer.h"
 #include "application.h"
 
@@ -19,12 +20,17 @@
 // Response string mappings for each State
 static const char * GarageStateStrings[] { "DOOR_OPEN", "DOOR_CLOSED", "DOOR_MOVING" };
 
+#define HISTORY_RESPONSE_HEADER_SIZE	6	// Skip[4], Count[1], More[1]
+#define HISTORY_RECORDS_PER_RESPONSE	((MAX_RESPONSE_PAYLOAD_SIZE - HISTORY_RESPONSE_HEADER_SIZE) / sizeof(DoorEvent))
+
 class Garage : public SecureMessageConsumer {
 
 public:
 	enum State { DOOR_OPEN, DOOR_CLOSED, DOOR_MOVING };
 
-	Garage() : doorTravelTimer(4500) {
+	Garage(DoorHistory* history) : doorTravelTimer(4500), relayPulseTimer(1000), lastDoorState(DOOR_MOVING) {
+		doorHistory = history;
+
 		pinMode(DOOR_SENSOR_PIN, INPUT_PULLUP); // Using internal 40k pull-up resistor
 		pinMode(DOOR_CONTROL_PIN, OUTPUT);
 		digitalWrite(DOOR_CONTROL_PIN, LOW); // Open transistor switch
@@ -46,7 +52,7 @@ public:
 	State getDoorStatus();
 
 	/**
-	 * Simulates a manual click of the button in the garage
+	 * Simulates a manual click of the button in the garage. The relay is released by loop(), so this returns right away.
 	 */
 	void pressDoorSwitch();
 
@@ -59,6 +65,19 @@ public:
 	 */
 	String processMessage(String command);
 
+	/**
+	 * Handles commands with binary responses:
+	 *
+	 *  "HISTORY <skip>" - Answers with [Skip[4], Count[1], More[1], DoorEvent[Count]], newest events first.
+	 *  					Clients page through the log by increasing <skip> until More is 0.
+	 */
+	int processBinaryMessage(String command, uint8_t response[], int maxResponseLength);
+
+	/**
+	 * Call this from the main loop. Ends relay pulses, and logs door movements observed by the sensor.
+	 */
+	void loop();
+
 
 private:
 
@@ -67,6 +86,21 @@ private:
 	 */
 	Timer doorTravelTimer;
 
+	/**
+	 * How long the door switch relay is held closed
+	 */
+	Timer relayPulseTimer;
+
+	/**
+	 * Where door events are recorded
+	 */
+	DoorHistory* doorHistory;
+
+	/**
+	 * Last settled door state, used to detect movements
+	 */
+	State lastDoorState;
+
 	/**
 	 * Reads the magnetic reed switch sensor attached to the garage door.
 	 *
@@ -82,18 +116,21 @@ private:
 String Garage::processMessage(String command) {
 	bool respond = true;
 
-	debug("Garage received command: ", 0); debug(command);
+	debug(LOG_STR("Garage received command: "), 0); debug(command);
 
 	if ( command == "OPEN" ) {
 //		debug("Opening bay doors...");
+		doorHistory->log(DoorEvent::COMMAND_OPEN, DoorEvent::SOURCE_SECURE_CHANNEL);
 		openDoor();
 	}
 	else if ( command == "CLOSE" ) {
 //		debug("Closing bay doors...");
+		doorHistory->log(DoorEvent::COMMAND_CLOSE, DoorEvent::SOURCE_SECURE_CHANNEL);
 		closeDoor();
 	}
 	else if ( command == "PRESS_BUTTON" ) {
-		debug("Simulating manual button click...");
+		debug(LOG_STR("Simulating manual button click..."));
+		doorHistory->log(DoorEvent::COMMAND_PRESS_BUTTON, DoorEvent::SOURCE_SECURE_CHANNEL);
 		pressDoorSwitch();
 	}
 	else if ( command == "GET_STATUS" ) {
@@ -107,9 +144,61 @@ String Garage::processMessage(String command) {
 	return respond ? GarageStateStrings[ getDoorStatus() ] : "";
 }
 
+int Garage::processBinaryMessage(String command, uint8_t response[], int maxResponseLength) {
+	if ( !command.startsWith("HISTORY") || maxResponseLength < HISTORY_RESPONSE_HEADER_SIZE ) {
+		return -1;
+	}
+
+	long requestedSkip = command.length() > 8 ? command.substring(8).toInt() : 0;
+	uint32_t skip = requestedSkip > 0 ? requestedSkip : 0; // The ring holds more than 65535 events
+
+	int maxRecords = (maxResponseLength - HISTORY_RESPONSE_HEADER_SIZE) / sizeof(DoorEvent);
+	if ( maxRecords > (int) HISTORY_RECORDS_PER_RESPONSE ) {
+		maxRecords = HISTORY_RECORDS_PER_RESPONSE;
+	}
+
+	// Ask for one more than we can send, so we know whether the client should keep paging
+	//
+	DoorEvent records[HISTORY_RECORDS_PER_RESPONSE + 1];
+	int count = doorHistory->read(skip, records, maxRecords + 1);
+	uint8_t more = count > maxRecords;
+	if ( more ) {
+		count = maxRecords;
+	}
+
+	memcpy(response, &skip, 4);
+	response[4] = count;
+	response[5] = more;
+	memcpy(response + HISTORY_RESPONSE_HEADER_SIZE, records, count * sizeof(DoorEvent));
+
+	return HISTORY_RESPONSE_HEADER_SIZE + count * sizeof(DoorEvent);
+}
+
+void Garage::loop() {
+	if ( relayPulseTimer.isRunning() && relayPulseTimer.isElapsed() ) {
+		digitalWrite(DOOR_CONTROL_PIN, LOW);
+
+//		debug("Door timer started.");
+		doorTravelTimer.start(); // Give the door time to travel
+	}
+
+	State state = getDoorStatus();
+
+	// The first settled reading after boot is logged too, so the history shows where the door was
+	//
+	if ( state != DOOR_MOVING && state != lastDoorState ) {
+		doorHistory->log(state == DOOR_OPEN ? DoorEvent::DOOR_OPENED : DoorEvent::DOOR_CLOSED, DoorEvent::SOURCE_SENSOR);
+		lastDoorState = state;
+	}
+}
+
 
 Garage::State Garage::getDoorStatus() {
 
+	if ( relayPulseTimer.isRunning() ) {
+		return DOOR_MOVING; // Switch is still being pressed
+	}
+
 	if ( doorTravelTimer.isRunning() ) {
 		if ( doorTravelTimer.isElapsed() ) {
 //			debug("Door Timer Elapsed.");
@@ -141,13 +230,12 @@ Garage::State Garage::readDoorSensor() {
 }
 
 void Garage::pressDoorSwitch() {
-	digitalWrite(DOOR_CONTROL_PIN, HIGH);
-	delay(1000);
-	digitalWrite(DOOR_CONTROL_PIN, LOW);
-
-//	debug("Door timer started.");
-	doorTravelTimer.start(); // Give the door time to travel
+	if ( relayPulseTimer.isRunning() ) {
+		return; // Already pressed
+	}
 
+	digitalWrite(DOOR_CONTROL_PIN, HIGH);
+	relayPulseTimer.start(); // loop() releases the switch
 }
 
 
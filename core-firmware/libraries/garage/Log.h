@@ -0,0 +1,339 @@
+/**
+ * Asynchronous logger behind the debug() calls in utils.h.
+ *
+ * Writing to the USB Serial is slow: every byte is copied into the USB buffer, and waits another
+ * 100us whenever the CC3000 is raising its interrupt. So log calls made on the request path only
+ * append a compact record to a RAM ring, and formatting and printing is deferred to drain(), which
+ * the main loop calls between requests.
+ *
+ * String literals live in internal flash and never go away, so only their address is queued.
+ * Integers are queued as values. Anything else (RAM strings, String, Printable, byte buffers)
+ * is copied into the ring. When the ring is full the record is dropped and counted, the caller
+ * never waits.
+ *
+ * Records are [Type|NewLine[1], Payload], where Payload is a 4-byte pointer or integer,
+ * or [Length[1], Bytes[Length]].
+ *
+ * Tokenized mode (build with LOG_TOKENIZED=y):
+ * 	Literals wrapped in LOG_STR() are moved out of the firmware image into the .log_tokens section,
+ * 	which the linker scripts mark as INFO, so it only exists in the ELF. Their address, minus
+ * 	LOG_TOKEN_BASE, is the token. drain() then writes packed binary records instead of text:
+ *
+ * 		[0xA0 | NewLine[bit 3] | Type[bits 0-2], Payload]
+ *
+ * 	TOKEN records carry a 2-byte token, INTEGER and DROPPED records a zigzag varint, and TEXT and BYTES
+ * 	records [Length[1], Bytes[Length]]. tools/decode_log.py rebuilds the text using the string table
+ * 	found in the ELF.
+ *
+ * @author Val Blant
+ */
+
+#ifndef LIBRARIES_GARAGE_LOG_H_
+#define LIBRARIES_GARAGE_LOG_H_
+
+#include "application.h"
+
+
+#define LOG_LEVEL_NONE		0
+#define LOG_LEVEL_ERROR		1
+#define LOG_LEVEL_WARN		2
+#define LOG_LEVEL_INFO		3
+#define LOG_LEVEL_DEBUG		4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL	LOG_LEVEL_DEBUG	// Messages above this level are compiled out
+#endif
+
+#define LOG_RING_SIZE				512	// Bytes. Must be a power of 2.
+#define LOG_RING_MASK				(LOG_RING_SIZE - 1)
+#define LOG_MAX_COPY				64	// Longest RAM string or buffer copied into one record
+#define LOG_DRAIN_RECORDS_PER_PASS	8	// Bounds the time drain() spends printing per main loop pass
+
+#define LOG_TOKEN_BASE		0xF0000000	// Address of the .log_tokens section in the linker scripts
+
+#ifdef LOG_TOKENIZED
+#define LOG_STR(s)			({ static const char logToken[] __attribute__((section(".log_tokens"), used)) = s; (const char*) logToken; })
+#else
+#define LOG_STR(s)			(s)
+#endif
+
+/**
+ * Singleton class
+ */
+class Log {
+public:
+	/**
+	 * This class is a singleton.
+	 */
+	static Log& getInstance() {
+		static Log instance;
+		return instance;
+	}
+
+	void appendText(const char text[], bool newLine);
+	void appendText(const char text[], size_t length, bool newLine);
+	void appendInt(int value, bool newLine);
+	void appendBytes(const uint8_t buffer[], size_t size);
+	void appendPrintable(const Printable& printable, bool newLine);
+
+	/**
+	 * Prints up to LOG_DRAIN_RECORDS_PER_PASS queued records to 'out'. Call this from idle time.
+	 */
+	void drain(Print& out);
+
+	/**
+	 * Prints everything that is queued
+	 */
+	void flush(Print& out) {
+		while ( head != tail ) {
+			drain(out);
+		}
+	}
+
+	/**
+	 * Number of records lost because the ring was full
+	 */
+	uint32_t getDroppedRecords() { return droppedRecords; }
+
+private:
+	enum RecordType { LITERAL, INTEGER, TEXT, BYTES, TOKEN, DROPPED };
+	static const uint8_t NEW_LINE_FLAG = 0x80;
+	static const uint8_t BINARY_RECORD_MARKER = 0xA0;
+	static const uint8_t BINARY_NEW_LINE_FLAG = 0x08;
+
+	Log() : head(0), tail(0), droppedRecords(0), reportedDroppedRecords(0) {};
+
+	// Make sure these are unaccessible. Otherwise we may accidently get copies of
+	// the singleton appearing.
+	//
+	Log(Log const&);
+	void operator=(Log const&);
+
+	uint8_t ring[LOG_RING_SIZE];
+
+	/**
+	 * Free running byte counters. Writers only move head, drain() only moves tail.
+	 */
+	uint16_t head;
+	uint16_t tail;
+
+	uint32_t droppedRecords;
+	uint32_t reportedDroppedRecords;
+
+	/**
+	 * Returns false and counts a drop if 'size' bytes don't fit
+	 */
+	bool reserve(size_t size) {
+		if ( (uint16_t)(LOG_RING_SIZE - (uint16_t)(head - tail)) < size ) {
+			droppedRecords++;
+			return false;
+		}
+		return true;
+	}
+
+	void put(uint8_t byte) { ring[head++ & LOG_RING_MASK] = byte; }
+	void putWord(uint32_t word) { put(word); put(word >> 8); put(word >> 16); put(word >> 24); }
+
+	uint8_t get() { return ring[tail++ & LOG_RING_MASK]; }
+	uint32_t getWord() { uint32_t w = get(); w |= get() << 8; w |= get() << 16; w |= (uint32_t) get() << 24; return w; }
+
+	static bool isInInternalFlash(const void* p) {
+		return (uint32_t) p >= USB_DFU_ADDRESS && (uint32_t) p < INTERNAL_FLASH_END_ADDRESS;
+	}
+
+	static bool isToken(const void* p) {
+#ifdef LOG_TOKENIZED
+		return (uint32_t) p >= LOG_TOKEN_BASE;
+#else
+		return false;
+#endif
+	}
+
+	void drainText(Print& out);
+	void drainBinary(Print& out);
+
+	/**
+	 * Writes 'value' zigzag encoded as a base 128 varint, so small numbers of either sign take a single byte
+	 */
+	static void writeVarint(Print& out, int32_t value) {
+		uint32_t zigzag = ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+		while ( zigzag >= 0x80 ) {
+			out.write((uint8_t) (zigzag | 0x80));
+			zigzag >>= 7;
+		}
+		out.write((uint8_t) zigzag);
+	}
+
+	/**
+	 * Used to capture Printables into a record
+	 */
+	class CaptureBuffer : public Print {
+	public:
+		CaptureBuffer() : length(0) {}
+		size_t write(uint8_t c) {
+			if ( length < sizeof(text) ) {
+				text[length++] = c;
+			}
+			return 1;
+		}
+		char text[LOG_MAX_COPY];
+		size_t length;
+	};
+};
+
+
+void Log::appendText(const char text[], bool newLine) {
+	if ( isInInternalFlash(text) || isToken(text) ) {
+		if ( reserve(5) ) {
+			put(LITERAL | (newLine ? NEW_LINE_FLAG : 0));
+			putWord((uint32_t) text);
+		}
+	}
+	else {
+		appendText(text, strlen(text), newLine);
+	}
+}
+
+void Log::appendText(const char text[], size_t length, bool newLine) {
+	if ( length > LOG_MAX_COPY ) {
+		length = LOG_MAX_COPY;
+	}
+
+	if ( reserve(2 + length) ) {
+		put(TEXT | (newLine ? NEW_LINE_FLAG : 0));
+		put(length);
+		for ( size_t i = 0; i < length; i++ ) {
+			put(text[i]);
+		}
+	}
+}
+
+void Log::appendInt(int value, bool newLine) {
+	if ( reserve(5) ) {
+		put(INTEGER | (newLine ? NEW_LINE_FLAG : 0));
+		putWord(value);
+	}
+}
+
+void Log::appendBytes(const uint8_t buffer[], size_t size) {
+	if ( size > LOG_MAX_COPY ) {
+		size = LOG_MAX_COPY;
+	}
+
+	if ( reserve(2 + size) ) {
+		put(BYTES | NEW_LINE_FLAG);
+		put(size);
+		for ( size_t i = 0; i < size; i++ ) {
+			put(buffer[i]);
+		}
+	}
+}
+
+void Log::appendPrintable(const Printable& printable, bool newLine) {
+	CaptureBuffer capture;
+	printable.printTo(capture);
+	appendText(capture.text, capture.length, newLine);
+}
+
+void Log::drain(Print& out) {
+#ifdef LOG_TOKENIZED
+	drainBinary(out);
+#else
+	drainText(out);
+#endif
+}
+
+void Log::drainText(Print& out) {
+	if ( droppedRecords != reportedDroppedRecords ) {
+		out.print("[Log dropped "); out.print(droppedRecords - reportedDroppedRecords); out.println(" records]");
+		reportedDroppedRecords = droppedRecords;
+	}
+
+	for ( int records = 0; records < LOG_DRAIN_RECORDS_PER_PASS && tail != head; records++ ) {
+		uint8_t header = get();
+
+		switch ( header & ~NEW_LINE_FLAG ) {
+			case LITERAL:
+				out.print((const char*) getWord());
+				break;
+
+			case INTEGER:
+				out.print((int) getWord());
+				break;
+
+			case TEXT: {
+				uint8_t length = get();
+				for ( int i = 0; i < length; i++ ) {
+					out.write(get());
+				}
+				break;
+			}
+
+			case BYTES: {
+				uint8_t size = get();
+				out.print("{");
+				for ( int i = 0; i < size; i++ ) {
+					out.print((signed char) get());
+					if ( i < size - 1 ) {
+						out.print(", ");
+					}
+				}
+				out.print("}");
+				break;
+			}
+		}
+
+		if ( header & NEW_LINE_FLAG ) {
+			out.println();
+		}
+	}
+}
+
+void Log::drainBinary(Print& out) {
+	if ( droppedRecords != reportedDroppedRecords ) {
+		out.write(BINARY_RECORD_MARKER | BINARY_NEW_LINE_FLAG | DROPPED);
+		writeVarint(out, droppedRecords - reportedDroppedRecords);
+		reportedDroppedRecords = droppedRecords;
+	}
+
+	for ( int records = 0; records < LOG_DRAIN_RECORDS_PER_PASS && tail != head; records++ ) {
+		uint8_t header = get();
+		uint8_t type = header & ~NEW_LINE_FLAG;
+		uint8_t newLine = (header & NEW_LINE_FLAG) ? BINARY_NEW_LINE_FLAG : 0;
+
+		if ( type == LITERAL ) {
+			const char* literal = (const char*) getWord();
+
+			if ( isToken(literal) ) {
+				uint16_t token = (uint32_t) literal - LOG_TOKEN_BASE;
+				out.write(BINARY_RECORD_MARKER | newLine | TOKEN);
+				out.write((const uint8_t*) &token, sizeof(token));
+			}
+			else {
+				// A literal that was not wrapped in LOG_STR(). Send it as text.
+				//
+				size_t length = strlen(literal);
+				if ( length > 0xFF ) {
+					length = 0xFF;
+				}
+				out.write(BINARY_RECORD_MARKER | newLine | TEXT);
+				out.write((uint8_t) length);
+				out.write((const uint8_t*) literal, length);
+			}
+		}
+		else if ( type == INTEGER ) {
+			out.write(BINARY_RECORD_MARKER | newLine | INTEGER);
+			writeVarint(out, getWord());
+		}
+		else {
+			uint8_t length = get();
+			out.write(BINARY_RECORD_MARKER | newLine | type);
+			out.write(length);
+			for ( int i = 0; i < length; i++ ) {
+				out.write(get());
+			}
+		}
+	}
+}
+
+#endif /* LIBRARIES_GARAGE_LOG_H_ */
@@ -0,0 +1,132 @@
+/**
+ * Runtime counters and latency histograms for the request path.
+ *
+ * Latencies are measured in DWT cycles (see cycles()) and sorted into fixed power-of-two buckets of
+ * microseconds, so recording a sample costs a division, a CLZ and an increment. Cycle counts are
+ * subtracted before they are converted, so a sample stays right when the counter wraps during it.
+ * micros() can't be used for this: it divides the same counter first, and so jumps back every 2^32
+ * cycles (~59.65s).
+ *
+ * The whole thing is reported to clients as a compact binary GET_STATS response over the secure channel:
+ *
+ * 	[Version[1], StageCount[1], BucketCount[1], CounterCount[1],
+ * 	 Counters[CounterCount][4], Histograms[StageCount][BucketCount][2]]
+ *
+ * Histogram bucket 0 counts samples below STATS_FIRST_BUCKET_LIMIT microseconds, and every following
+ * bucket doubles the limit. The last bucket counts everything slower. Bucket counts saturate at 0xFFFF.
+ *
+ * @author Val Blant
+ */
+
+#ifndef LIBRARIES_GARAGE_STATISTICS_H_
+#define LIBRARIES_GARAGE_STATISTICS_H_
+
+#include "application.h"
+
+
+#define STATS_FORMAT_VERSION		1
+#define STATS_BUCKET_COUNT			12
+#define STATS_FIRST_BUCKET_SHIFT	6	// First bucket holds samples below 64us, the last one anything above ~65ms
+#define STATS_FIRST_BUCKET_LIMIT	(1 << STATS_FIRST_BUCKET_SHIFT)
+
+/**
+ * Singleton class
+ */
+class Statistics {
+public:
+	/**
+	 * Timed stages of handling one request
+	 */
+	enum Stage { FRAME_RECEIVE, HMAC_VERIFY, DECRYPT, CONSUMER, ENCRYPT, WRITE, STAGE_COUNT };
+
+	/**
+	 * Event counters
+	 */
+	enum Counter {
+		FRAMES_RECEIVED, BAD_HMAC, SESSION_EXPIRED, WIFI_RECONNECTS, PING_FAILURES,
+		IDLE_CLIENTS_REAPED,	// TCP clients hung up on after WIFI_CLIENT_IDLE_TIMEOUT
+		CLIENTS_EVICTED,		// TCP clients replaced by a new one because all slots were taken
+		FRAMES_TIMED_OUT,		// Transmissions dropped because the rest of them never arrived
+		COUNTER_COUNT
+	};
+
+	/**
+	 * This class is a singleton.
+	 */
+	static Statistics& getInstance() {
+		static Statistics instance;
+		return instance;
+	}
+
+	void count(Counter counter) { counters[counter]++; }
+
+	/**
+	 * Current value of the free running DWT cycle counter. Latencies are differences of two of these.
+	 */
+	static uint32_t cycles() { return DWT->CYCCNT; }
+
+	/**
+	 * Adds a sample of 'elapsedCycles' to the histogram of 'stage'
+	 */
+	void recordLatency(Stage stage, uint32_t elapsedCycles);
+
+	/**
+	 * Writes the GET_STATS response into 'buffer'. Returns the number of bytes written, or -1 if
+	 * 'maxLength' is too small.
+	 */
+	int serialize(uint8_t buffer[], int maxLength);
+
+	/**
+	 * Size of the GET_STATS response
+	 */
+	static int serializedSize() {
+		return 4 + COUNTER_COUNT * sizeof(uint32_t) + STAGE_COUNT * STATS_BUCKET_COUNT * sizeof(uint16_t);
+	}
+
+private:
+	Statistics() : counters {0}, histograms {{0}} {};
+
+	// Make sure these are unaccessible. Otherwise we may accidently get copies of
+	// the singleton appearing.
+	//
+	Statistics(Statistics const&);
+	void operator=(Statistics const&);
+
+	uint32_t counters[COUNTER_COUNT];
+	uint16_t histograms[STAGE_COUNT][STATS_BUCKET_COUNT];
+};
+
+
+void Statistics::recordLatency(Stage stage, uint32_t elapsedCycles) {
+	uint32_t scaled = (elapsedCycles / SYSTEM_US_TICKS) >> STATS_FIRST_BUCKET_SHIFT;
+
+	// Bucket index is the position of the highest set bit of the scaled sample
+	//
+	int bucket = scaled == 0 ? 0 : 32 - __builtin_clz(scaled);
+	if ( bucket >= STATS_BUCKET_COUNT ) {
+		bucket = STATS_BUCKET_COUNT - 1;
+	}
+
+	if ( histograms[stage][bucket] != 0xFFFF ) {
+		histograms[stage][bucket]++;
+	}
+}
+
+int Statistics::serialize(uint8_t buffer[], int maxLength) {
+	if ( maxLength < serializedSize() ) {
+		return -1;
+	}
+
+	buffer[0] = STATS_FORMAT_VERSION;
+	buffer[1] = STAGE_COUNT;
+	buffer[2] = STATS_BUCKET_COUNT;
+	buffer[3] = COUNTER_COUNT;
+
+	uint8_t* p = buffer + 4;
+	memcpy(p, counters, sizeof(counters)); p += sizeof(counters);
+	memcpy(p, histograms, sizeof(histograms)); p += sizeof(histograms);
+
+	return p - buffer;
+}
+
+#endif /* LIBRARIES_GARAGE_STATISTICS_H_ */
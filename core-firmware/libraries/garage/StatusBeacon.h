@@ -0,0 +1,149 @@
+/**
+ * Broadcasts the door state on the LAN, so dashboards and wall displays can follow it without
+ * a connection or a handshake. Any number of listeners costs the device nothing extra.
+ *
+ * A beacon is sent whenever the door state changes, and every heartbeatInterval milliseconds otherwise.
+ * Each one is a secure channel transmission, but under a Beacon Key derived from the Master Key, so that
+ * no response to a command can ever be taken for a beacon:
+ *
+ * 	Beacon_Key = HMAC(Master_Key, "beacon")
+ *
+ * 	[Message_Length[2], IV[16], AES_CBC(Beacon_Key[0..15], IV, PAYLOAD), <==== HMAC(Beacon_Key)
+ *
+ * 	PAYLOAD = [Version[1], DoorState[1], BootIndex[2], Sequence[4], Uptime[4]]
+ *
+ * DoorState is a Garage::State. BootIndex grows on every boot (it is the random seed index, see
+ * SparkRandomNumberGenerator::getSeedIndex()), and Sequence grows with every beacon sent since then.
+ * Receivers must drop any beacon whose (BootIndex, Sequence) pair is not greater than the last one
+ * they accepted, which defeats replays. Uptime is in seconds.
+ *
+ * BootIndex is 16 bits and wraps from 65535 to 0, so receivers compare it with serial number arithmetic
+ * (RFC 1982): a BootIndex is greater than the last one if (uint16_t)(BootIndex - last) is between 1 and
+ * 32767. A replay would have to come from more than 32767 boots ago to get through.
+ *
+ * @author Val Blant
+ */
+
+#ifndef LIBRARIES_GARAGE_STATUSBEACON_H_
+#define LIBRARIES_GARAGE_STATUSBEACON_H_
+
+#include "application.h"
+#include "Garage.h"
+#include "Timer.h"
+#include "utils.h"
+#include <spark_secure_channel/SparkSecureChannelServer.h>
+#include <spark_network/UdpCommunicationChannel.h>
+
+
+#define BEACON_FORMAT_VERSION	2		// 2 since beacons have their own key
+#define BEACON_PAYLOAD_SIZE		12
+#define BEACON_KEY_LABEL		"beacon"
+
+class StatusBeacon {
+public:
+	StatusBeacon(UdpCommunicationChannel* channel, Garage* garage, uint16_t port, unsigned long heartbeatInterval) :
+		channel(channel),
+		garage(garage),
+		port(port),
+		heartbeatTimer(heartbeatInterval),
+		sequence(0),
+		lastState(Garage::DOOR_MOVING),
+		pending(true) {
+
+		sha1_hmac(	(uint8_t*) MASTER_KEY, sizeof(MASTER_KEY),
+					(uint8_t*) BEACON_KEY_LABEL, strlen(BEACON_KEY_LABEL),
+					beaconKey);
+	}
+
+	/**
+	 * Call this from the main loop. Sends a beacon if the door state changed or the heartbeat is due.
+	 */
+	void loop();
+
+private:
+	UdpCommunicationChannel* channel;
+	Garage* garage;
+
+	/**
+	 * Port the beacons are broadcast to
+	 */
+	uint16_t port;
+
+	Timer heartbeatTimer;
+
+	/**
+	 * Number of beacons sent since boot
+	 */
+	uint32_t sequence;
+
+	/**
+	 * Door state in the last beacon
+	 */
+	Garage::State lastState;
+
+	/**
+	 * true while a beacon is due but could not be sent yet, because WiFi is down
+	 */
+	bool pending;
+
+	/**
+	 * HMAC(Master_Key, "beacon"), the only key beacons are sent under
+	 */
+	uint8_t beaconKey[20];
+
+	/**
+	 * Encrypts and broadcasts a beacon for 'state'. Returns false if it could not be sent.
+	 */
+	bool send(Garage::State state);
+};
+
+
+void StatusBeacon::loop() {
+	Garage::State state = garage->getDoorStatus();
+
+	if ( state != lastState ) {
+		lastState = state;
+		pending = true;
+	}
+
+	if ( heartbeatTimer.isRunning() && heartbeatTimer.isElapsed() ) {
+		pending = true;
+	}
+
+	if ( pending && send(state) ) {
+		pending = false;
+		heartbeatTimer.start();
+	}
+}
+
+bool StatusBeacon::send(Garage::State state) {
+	if ( !WiFi.ready() ) {
+		return false;
+	}
+
+	uint8_t payload[BEACON_PAYLOAD_SIZE];
+	uint16_t bootIndex = SparkRandomNumberGenerator::getInstance().getSeedIndex();
+	uint32_t nextSequence = sequence + 1;
+	uint32_t uptime = millis() / 1000;
+
+	payload[0] = BEACON_FORMAT_VERSION;
+	payload[1] = state;
+	memcpy(payload + 2, &bootIndex, 2);
+	memcpy(payload + 4, &nextSequence, 4);
+	memcpy(payload + 8, &uptime, 4);
+
+	uint8_t transmission[MAX_TRANSMISSION_SIZE];
+	int transmissionLength = SecureChannelServer::encryptResponsePayload(payload, sizeof(payload), transmission,
+			FRAME_VERSION_CBC, beaconKey, sizeof(beaconKey));
+
+	if ( channel->broadcast(port, transmission, transmissionLength) == 0 ) {
+		return false;
+	}
+
+	// Only count beacons that went out, so receivers see no gaps caused by outages
+	//
+	sequence = nextSequence;
+	return true;
+}
+
+#endif /* LIBRARIES_GARAGE_STATUSBEACON_H_ */
@@ -0,0 +1,185 @@
+/**
+ * Cycle-accurate trace points for profiling the request path.
+ *
+ * Each trace point stores the DWT cycle counter (72 cycles per microsecond on the Spark Core) and an
+ * event ID into a RAM ring. Recording is a handful of stores with no locking: there is a single
+ * writer (the main loop), and readers only ever copy entries out. When the ring is full, the oldest
+ * entries are overwritten and counted as lost.
+ *
+ * The ring can be read in two ways:
+ * 	1) dump() prints it to a Print, such as the USB Serial, one "TRACE,<cycles>,<event>,<arg>" line per entry
+ * 	2) A valid secure channel conversation can send "GET_TRACE", which drains as many entries as fit
+ * 		into one response: [Count[1], Lost[1], CoreMHz[1], Reserved[1], TraceEntry[Count]]
+ *
+ * tools/decode_trace.py turns either form into per-stage timings. Keep its event table in sync with TraceEvent.
+ *
+ * @author Val Blant
+ */
+
+#ifndef LIBRARIES_GARAGE_TRACE_H_
+#define LIBRARIES_GARAGE_TRACE_H_
+
+#include "application.h"
+
+
+#define TRACE_POINTS	// Comment this out to compile all trace points away
+
+#define TRACE_RING_SIZE		64	// Entries. Must be a power of 2.
+#define TRACE_RING_MASK		(TRACE_RING_SIZE - 1)
+
+/**
+ * Traced stages. Each one records a _BEGIN and an _END event.
+ */
+enum TraceStage {
+	TRACE_STAGE_REQUEST,	// SecureChannelServer::processReceivedTransmission
+	TRACE_STAGE_DECRYPT,	// SecureChannelServer::decryptTransmission
+	TRACE_STAGE_ENCRYPT,	// SecureChannelServer::encryptResponsePayload
+	TRACE_STAGE_SHA1_HMAC,	// sha1_hmac
+	TRACE_STAGE_AES_CBC,	// aes_crypt_cbc
+	TRACE_STAGE_TCP_READ,	// TCPClient::read
+	TRACE_STAGE_TCP_WRITE,	// TCPServer::write
+	TRACE_STAGE_AES_CTR		// aes_crypt_ctr, together with the HMAC of the same bytes
+};
+
+/**
+ * Events stored in the ring. The low bit tells _BEGIN from _END.
+ */
+#define TRACE_EVENT_BEGIN(stage)	((uint16_t) ((stage) << 1))
+#define TRACE_EVENT_END(stage)		((uint16_t) (((stage) << 1) | 1))
+
+#ifdef TRACE_POINTS
+#define TRACE_BEGIN(stage)			Trace::getInstance().record(TRACE_EVENT_BEGIN(TRACE_STAGE_##stage), 0)
+#define TRACE_END(stage, arg)		Trace::getInstance().record(TRACE_EVENT_END(TRACE_STAGE_##stage), (arg))
+#else
+#define TRACE_BEGIN(stage)
+#define TRACE_END(stage, arg)
+#endif
+
+struct TraceEntry {
+	uint32_t cycles;	// DWT_CYCCNT when the event was recorded
+	uint16_t event;		// TRACE_EVENT_BEGIN/END(stage)
+	uint16_t arg;		// Event specific, usually a byte count
+};
+
+#define TRACE_RESPONSE_HEADER_SIZE	4
+
+/**
+ * Singleton class
+ */
+class Trace {
+public:
+	/**
+	 * This class is a singleton.
+	 */
+	static Trace& getInstance() {
+		static Trace instance;
+		return instance;
+	}
+
+	void record(uint16_t event, uint16_t arg) {
+		TraceEntry& entry = ring[writeIndex & TRACE_RING_MASK];
+		entry.cycles = DWT->CYCCNT;
+		entry.event = event;
+		entry.arg = arg;
+		writeIndex++;
+	}
+
+	/**
+	 * Prints every unread entry to 'out' and marks them read
+	 */
+	void dump(Print& out);
+
+	/**
+	 * Writes the GET_TRACE response into 'buffer', consuming the entries it contains.
+	 * Returns the number of bytes written, or -1 if 'maxLength' can't even hold the header.
+	 */
+	int drain(uint8_t buffer[], int maxLength);
+
+private:
+	Trace() : writeIndex(0), readIndex(0) {
+		// Enable the DWT cycle counter, unless it is already running. micros() reads the same
+		// counter, so it must never be reset here.
+		//
+		if ( !(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) ) {
+			CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+			DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+		}
+	};
+
+	// Make sure these are unaccessible. Otherwise we may accidently get copies of
+	// the singleton appearing.
+	//
+	Trace(Trace const&);
+	void operator=(Trace const&);
+
+	TraceEntry ring[TRACE_RING_SIZE];
+
+	/**
+	 * Free running counters. Only the writer moves writeIndex, and only readers move readIndex.
+	 */
+	volatile uint32_t writeIndex;
+	uint32_t readIndex;
+
+	/**
+	 * Skips readIndex past entries that have been overwritten. Returns how many were lost.
+	 */
+	uint32_t catchUp();
+};
+
+
+uint32_t Trace::catchUp() {
+	uint32_t lost = 0;
+
+	if ( writeIndex - readIndex > TRACE_RING_SIZE ) {
+		lost = writeIndex - readIndex - TRACE_RING_SIZE;
+		readIndex = writeIndex - TRACE_RING_SIZE;
+	}
+
+	return lost;
+}
+
+void Trace::dump(Print& out) {
+	uint32_t lost = catchUp();
+	if ( lost > 0 ) {
+		out.print("TRACE_LOST,"); out.println(lost);
+	}
+
+	uint32_t end = writeIndex;
+	while ( readIndex != end ) {
+		TraceEntry entry = ring[readIndex & TRACE_RING_MASK];
+		readIndex++;
+
+		out.print("TRACE,"); out.print(entry.cycles); out.print(",");
+		out.print(entry.event); out.print(","); out.println(entry.arg);
+	}
+}
+
+int Trace::drain(uint8_t buffer[], int maxLength) {
+	if ( maxLength < TRACE_RESPONSE_HEADER_SIZE ) {
+		return -1;
+	}
+
+	uint32_t lost = catchUp();
+
+	uint32_t available = writeIndex - readIndex;
+	uint32_t count = (maxLength - TRACE_RESPONSE_HEADER_SIZE) / sizeof(TraceEntry);
+	if ( count > available ) {
+		count = available;
+	}
+
+	buffer[0] = count;
+	buffer[1] = lost > 0xFF ? 0xFF : lost;
+	buffer[2] = SystemCoreClock / 1000000;
+	buffer[3] = 0;
+
+	uint8_t* p = buffer + TRACE_RESPONSE_HEADER_SIZE;
+	for ( uint32_t i = 0; i < count; i++ ) {
+		memcpy(p, &ring[readIndex & TRACE_RING_MASK], sizeof(TraceEntry));
+		p += sizeof(TraceEntry);
+		readIndex++;
+	}
+
+	return p - buffer;
+}
+
+#endif /* LIBRARIES_GARAGE_TRACE_H_ */
@@ -0,0 +1,114 @@
+/**
+ * Decides whether the WiFi link is still usable, without stalling the main loop.
+ *
+ * Most of the time this only looks at passive signals:
+ * 	1) Socket I/O. Any successful read or write proves the link works, so recordActivity() pushes the next check back.
+ * 	2) Unsolicited disconnects reported by the CC3000 to WLAN_Async_Callback(). These are counted, so a drop is
+ * 		noticed even if the CC3000 has reconnected on its own before we looked.
+ * 	3) The DHCP lease, through WiFi.ready().
+ *
+ * Only when the link has been quiet for 'idleTimeout' milliseconds is a single ping sent to 'pingTarget'.
+ * It is started with WiFi.pingStart() and then polled from check(), so no request waits for it.
+ *
+ * @author Val Blant
+ */
+
+#ifndef LIBRARIES_GARAGE_LINKMONITOR_H_
+#define LIBRARIES_GARAGE_LINKMONITOR_H_
+
+#include "application.h"
+#include "spark_wlan.h"
+#include "Timer.h"
+#include "utils.h"
+
+
+#define LINK_PING_TRIES	3
+
+class LinkMonitor {
+public:
+	enum Health {
+		LINK_ALIVE,
+		LINK_LOST,			// WiFi dropped, or the CC3000 reported a disconnect
+		LINK_UNRESPONSIVE	// WiFi looks up, but pingTarget did not answer
+	};
+
+	LinkMonitor(unsigned long idleTimeout, IPAddress pingTarget) :
+		idleTimer(idleTimeout),
+		pingTarget(pingTarget),
+		pinging(false),
+		disconnectEvents(0) {
+
+	}
+
+	/**
+	 * Call this once the link is up, to start monitoring from a clean slate
+	 */
+	void start();
+
+	/**
+	 * Call this after every successful read or write on the link
+	 */
+	void recordActivity() { idleTimer.start(); }
+
+	/**
+	 * Polls the link. Returns immediately.
+	 */
+	Health check();
+
+private:
+	/**
+	 * Runs out when nothing has proven the link alive for a while
+	 */
+	Timer idleTimer;
+	IPAddress pingTarget;
+
+	/**
+	 * true while a ping is in flight
+	 */
+	bool pinging;
+
+	/**
+	 * Value of WLAN_DISCONNECT_EVENTS when monitoring started
+	 */
+	uint32_t disconnectEvents;
+};
+
+
+void LinkMonitor::start() {
+	disconnectEvents = WLAN_DISCONNECT_EVENTS;
+	pinging = false;
+	idleTimer.start();
+}
+
+LinkMonitor::Health LinkMonitor::check() {
+	if ( !WiFi.ready() || WLAN_DISCONNECT_EVENTS != disconnectEvents ) {
+		pinging = false;
+		return LINK_LOST;
+	}
+
+	if ( pinging ) {
+		int receivedPackets = WiFi.pingResult();
+		if ( receivedPackets < 0 ) {
+			return LINK_ALIVE; // Still waiting. Assume the best.
+		}
+
+		pinging = false;
+		if ( receivedPackets == 0 ) {
+			return LINK_UNRESPONSIVE;
+		}
+
+		debug(LOG_STR("Ping OK"));
+		idleTimer.start();
+	}
+	else if ( idleTimer.isRunning() && idleTimer.isElapsed() ) {
+		debug(LOG_STR("Link idle. Pinging test server..."));
+		pinging = WiFi.pingStart(pingTarget, LINK_PING_TRIES);
+		if ( !pinging ) {
+			return LINK_UNRESPONSIVE;
+		}
+	}
+
+	return LINK_ALIVE;
+}
+
+#endif /* LIBRARIES_GARAGE_LINKMONITOR_H_ */
@@ -0,0 +1,363 @@
+/**
+ * Minimal mDNS / DNS-SD responder, so clients can find the garage on the LAN by name instead of by its DHCP address.
+ *
+ * It answers queries for:
+ * 	_garage._tcp.local					PTR		<host>._garage._tcp.local
+ * 	<host>._garage._tcp.local			SRV		<host>.local:<port>, and an empty TXT
+ * 	<host>.local						A		our IP address
+ *
+ * All four records always go out together in one response packet, which is built once and only has its
+ * A record patched when the IP address changes. Answering a query is therefore just a parse and a send.
+ * The response is also announced unsolicited every time WiFi comes back, so clients learn a new DHCP
+ * address right away instead of waiting for their cache to expire.
+ *
+ * Queries are polled every MDNS_POLL_INTERVAL, since every poll of the socket costs a CC3000 select().
+ *
+ * @author Val Blant
+ */
+
+#ifndef LIBRARIES_GARAGE_MDNSRESPONDER_H_
+#define LIBRARIES_GARAGE_MDNSRESPONDER_H_
+
+#include "application.h"
+#include "spark_wlan.h"
+#include "Timer.h"
+#include "utils.h"
+
+
+#define MDNS_PORT				5353
+#define MDNS_POLL_INTERVAL		50		// Milliseconds between checks for queries
+#define MDNS_MAX_PACKET_SIZE	160		// Our response, and the part of a query we look at
+#define MDNS_MAX_NAME_LENGTH	64
+
+#define MDNS_TYPE_A		1
+#define MDNS_TYPE_PTR	12
+#define MDNS_TYPE_TXT	16
+#define MDNS_TYPE_SRV	33
+#define MDNS_TYPE_ANY	255
+
+#define MDNS_CLASS_IN			0x0001
+#define MDNS_CLASS_CACHE_FLUSH	0x8001	// IN, and the record is unique to us
+
+#define MDNS_HOST_TTL		120		// Seconds. For records that change with our address.
+#define MDNS_SERVICE_TTL	4500	// Seconds. For records that don't.
+
+class MdnsResponder {
+public:
+	/**
+	 * 'hostName' is a single label, such as "garage". 'serviceType' is the DNS-SD service label, such as "_garage".
+	 * Labels are at most 63 bytes, and the whole response must fit in MDNS_MAX_PACKET_SIZE, which leaves room for
+	 * a host name of about 30 characters. Names that don't fit are never announced.
+	 */
+	MdnsResponder(const char* hostName, const char* serviceType, uint16_t servicePort) :
+		hostName(hostName),
+		serviceType(serviceType),
+		servicePort(servicePort),
+		bound(false),
+		disconnectEvents(0),
+		pollTimer(MDNS_POLL_INTERVAL),
+		response {0},
+		responseLength(0),
+		addressOffset(0) {
+
+	}
+
+	/**
+	 * Call this from the main loop
+	 */
+	void loop();
+
+private:
+	const char* hostName;
+	const char* serviceType;
+	uint16_t servicePort;
+
+	UDP udp;
+
+	/**
+	 * true while udp is bound to MDNS_PORT
+	 */
+	bool bound;
+
+	/**
+	 * Value of WLAN_DISCONNECT_EVENTS when udp was bound. Any change means the socket is gone.
+	 */
+	uint32_t disconnectEvents;
+
+	Timer pollTimer;
+
+	/**
+	 * The precomputed response packet. responseLength is 0 until it is built, and -1 if our names don't fit.
+	 */
+	uint8_t response[MDNS_MAX_PACKET_SIZE];
+	int responseLength;
+
+	/**
+	 * Offset of the A record data in 'response'
+	 */
+	int addressOffset;
+
+	/**
+	 * Builds 'response'. Everything but the address is fixed, so this runs once.
+	 */
+	void buildResponse();
+
+	/**
+	 * Copies our current address into the A record of 'response'
+	 */
+	void updateAddress();
+
+	/**
+	 * Sends 'response' to the mDNS multicast group
+	 */
+	void sendResponse();
+
+	/**
+	 * Returns true if 'packet' is a query for any of our records
+	 */
+	bool isQueryForUs(const uint8_t packet[], int length);
+
+	/**
+	 * Decodes the (possibly compressed) name at 'offset' into 'name' as dotted text. Returns the offset just
+	 * past the name, or -1 if it is malformed.
+	 */
+	static int readName(const uint8_t packet[], int length, int offset, char name[]);
+
+	// Packet building helpers. Each returns the offset just past what it wrote, or -1 if it doesn't fit in
+	// 'response'. An offset of -1 is passed on, so only the end result needs checking.
+	//
+	int putLabel(int offset, const char* label);
+	int putByte(int offset, uint8_t value);
+	int putPointer(int offset, int target);
+	int putShort(int offset, uint16_t value);
+	int putRecordHeader(int offset, uint16_t type, uint16_t recordClass, uint32_t ttl, uint16_t dataLength);
+};
+
+
+void MdnsResponder::loop() {
+	bool wifiUp = WiFi.ready() && WLAN_DISCONNECT_EVENTS == disconnectEvents;
+
+	if ( bound && !wifiUp ) {
+		udp.stop();
+		bound = false;
+	}
+
+	if ( !bound && WiFi.ready() ) {
+		disconnectEvents = WLAN_DISCONNECT_EVENTS;
+		bound = udp.begin(MDNS_PORT);
+		if ( bound ) {
+			if ( responseLength == 0 ) {
+				buildResponse();
+			}
+
+			if ( responseLength > 0 ) {
+				updateAddress();
+
+				debug(LOG_STR("Announcing "), 0); debug(hostName, 0); debug(LOG_STR(".local over mDNS"));
+				sendResponse();
+			}
+			pollTimer.start();
+		}
+	}
+
+	if ( bound && pollTimer.isElapsed() ) {
+		pollTimer.start();
+
+		if ( udp.parsePacket() > 0 ) {
+			uint8_t query[MDNS_MAX_PACKET_SIZE];
+			int length = udp.read(query, sizeof(query));
+			udp.flush();
+
+			if ( length > 0 && responseLength > 0 && isQueryForUs(query, length) ) {
+				sendResponse();
+			}
+		}
+	}
+}
+
+void MdnsResponder::sendResponse() {
+	udp.beginPacket(IPAddress(224, 0, 0, 251), MDNS_PORT);
+	udp.write(response, responseLength);
+}
+
+void MdnsResponder::updateAddress() {
+	IPAddress localIP = WiFi.localIP();
+	for ( int i = 0; i < 4; i++ ) {
+		response[addressOffset + i] = localIP[i];
+	}
+}
+
+int MdnsResponder::putLabel(int offset, const char* label) {
+	int length = strlen(label);
+	if ( offset < 0 || length > 63 || offset + 1 + length > MDNS_MAX_PACKET_SIZE ) {
+		return -1;
+	}
+
+	response[offset++] = length;
+	memcpy(response + offset, label, length);
+	return offset + length;
+}
+
+int MdnsResponder::putByte(int offset, uint8_t value) {
+	if ( offset < 0 || offset + 1 > MDNS_MAX_PACKET_SIZE ) {
+		return -1;
+	}
+
+	response[offset++] = value;
+	return offset;
+}
+
+int MdnsResponder::putPointer(int offset, int target) {
+	return putShort(offset, 0xC000 | target);
+}
+
+int MdnsResponder::putShort(int offset, uint16_t value) {
+	if ( offset < 0 || offset + 2 > MDNS_MAX_PACKET_SIZE ) {
+		return -1;
+	}
+
+	response[offset++] = value >> 8;
+	response[offset++] = value & 0xFF;
+	return offset;
+}
+
+int MdnsResponder::putRecordHeader(int offset, uint16_t type, uint16_t recordClass, uint32_t ttl, uint16_t dataLength) {
+	offset = putShort(offset, type);
+	offset = putShort(offset, recordClass);
+	offset = putShort(offset, ttl >> 16);
+	offset = putShort(offset, ttl & 0xFFFF);
+	return putShort(offset, dataLength);
+}
+
+void MdnsResponder::buildResponse() {
+	// Header: ID 0, Flags = Response + Authoritative, no questions, 4 answers
+	//
+	int p = 0;
+	p = putShort(p, 0);
+	p = putShort(p, 0x8400);
+	p = putShort(p, 0);
+	p = putShort(p, 4);
+	p = putShort(p, 0);
+	p = putShort(p, 0);
+
+	// _garage._tcp.local PTR <host>._garage._tcp.local
+	//
+	int serviceName = p;
+	p = putLabel(p, serviceType);
+	p = putLabel(p, "_tcp");
+	int localName = p;
+	p = putLabel(p, "local");
+	p = putByte(p, 0);
+
+	p = putRecordHeader(p, MDNS_TYPE_PTR, MDNS_CLASS_IN, MDNS_SERVICE_TTL, 1 + strlen(hostName) + 2);
+	int instanceName = p;
+	p = putLabel(p, hostName);
+	p = putPointer(p, serviceName);
+
+	// <host>._garage._tcp.local SRV 0 0 <port> <host>.local
+	//
+	p = putPointer(p, instanceName);
+	p = putRecordHeader(p, MDNS_TYPE_SRV, MDNS_CLASS_CACHE_FLUSH, MDNS_HOST_TTL, 6 + 1 + strlen(hostName) + 2);
+	p = putShort(p, 0); // Priority
+	p = putShort(p, 0); // Weight
+	p = putShort(p, servicePort);
+	int hostFullName = p;
+	p = putLabel(p, hostName);
+	p = putPointer(p, localName);
+
+	// <host>._garage._tcp.local TXT "" (DNS-SD requires one, even if empty)
+	//
+	p = putPointer(p, instanceName);
+	p = putRecordHeader(p, MDNS_TYPE_TXT, MDNS_CLASS_CACHE_FLUSH, MDNS_SERVICE_TTL, 1);
+	p = putByte(p, 0);
+
+	// <host>.local A <address>
+	//
+	p = putPointer(p, hostFullName);
+	p = putRecordHeader(p, MDNS_TYPE_A, MDNS_CLASS_CACHE_FLUSH, MDNS_HOST_TTL, 4);
+	addressOffset = p;
+	p = putShort(p, 0); // Filled in by updateAddress()
+	p = putShort(p, 0);
+
+	if ( p < 0 ) {
+		LOG_WARN(LOG_STR("mDNS names don't fit in a response, not announcing "), 0); LOG_WARN(hostName);
+	}
+	responseLength = p;
+}
+
+int MdnsResponder::readName(const uint8_t packet[], int length, int offset, char name[]) {
+	int nameLength = 0;
+	int end = -1;	// Where the name ends in the packet, once we've followed a pointer
+	int jumps = 0;
+
+	while ( offset < length ) {
+		uint8_t labelLength = packet[offset];
+
+		if ( labelLength == 0 ) {
+			name[nameLength] = 0;
+			return end >= 0 ? end : offset + 1;
+		}
+
+		if ( (labelLength & 0xC0) == 0xC0 ) {
+			if ( offset + 1 >= length || ++jumps > 8 ) {
+				return -1;
+			}
+			if ( end < 0 ) {
+				end = offset + 2;
+			}
+			offset = ((labelLength & 0x3F) << 8) | packet[offset + 1];
+			continue;
+		}
+
+		if ( offset + 1 + labelLength > length || nameLength + labelLength + 1 >= MDNS_MAX_NAME_LENGTH ) {
+			return -1;
+		}
+
+		if ( nameLength > 0 ) {
+			name[nameLength++] = '.';
+		}
+		memcpy(name + nameLength, packet + offset + 1, labelLength);
+		nameLength += labelLength;
+		offset += 1 + labelLength;
+	}
+
+	return -1;
+}
+
+bool MdnsResponder::isQueryForUs(const uint8_t packet[], int length) {
+	if ( length < 12 || (packet[2] & 0x80) ) {
+		return false; // Too short, or a response
+	}
+
+	char serviceName[MDNS_MAX_NAME_LENGTH];
+	char instanceName[MDNS_MAX_NAME_LENGTH];
+	char hostFullName[MDNS_MAX_NAME_LENGTH];
+	snprintf(serviceName, sizeof(serviceName), "%s._tcp.local", serviceType);
+	snprintf(instanceName, sizeof(instanceName), "%s.%s._tcp.local", hostName, serviceType);
+	snprintf(hostFullName, sizeof(hostFullName), "%s.local", hostName);
+
+	int questions = packet[4] << 8 | packet[5];
+	int offset = 12;
+
+	for ( int i = 0; i < questions; i++ ) {
+		char name[MDNS_MAX_NAME_LENGTH];
+		offset = readName(packet, length, offset, name);
+		if ( offset < 0 || offset + 4 > length ) {
+			return false;
+		}
+
+		uint16_t type = packet[offset] << 8 | packet[offset + 1];
+		offset += 4; // Type and Class
+
+		bool any = type == MDNS_TYPE_ANY;
+		if ( 	(strcasecmp(name, serviceName) == 0 && (type == MDNS_TYPE_PTR || any)) ||
+				(strcasecmp(name, instanceName) == 0 && (type == MDNS_TYPE_SRV || type == MDNS_TYPE_TXT || any)) ||
+				(strcasecmp(name, hostFullName) == 0 && (type == MDNS_TYPE_A || any)) ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+#endif /* LIBRARIES_GARAGE_MDNSRESPONDER_H_ */
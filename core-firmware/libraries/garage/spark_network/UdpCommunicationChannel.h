@@ -0,0 +1,230 @@
+/**
+ * UDP based CommunicationChannel implementation. Every datagram carries exactly one complete
+ * [Length[2], IV[16], Ciphertext, HMAC[20]] transmission (or its version 1 form), and the response is sent
+ * back to the address and port the request came from. A status check therefore costs one packet each way,
+ * with no TCP accept or handshake in front of it.
+ *
+ * Datagrams whose size doesn't match the length in their Length field are dropped, so a truncated or merged
+ * datagram can never leave a partial transmission behind for the next one.
+ *
+ * Conversations are kept per source address and port (see peer()), so several phones can talk to the garage
+ * at once, and a challenge can only be answered from the socket it was sent to. Clients must therefore keep
+ * the same socket for the whole conversation.
+ *
+ * The socket is polled every UDP_POLL_INTERVAL, since every poll costs a CC3000 select().
+ *
+ * This channel doesn't manage the WiFi connection. It waits for another channel, such as
+ * WiFiCommunicationChannel, to bring WiFi up, and rebinds its socket every time the connection comes back.
+ *
+ * @author Val Blant
+ */
+
+#ifndef LIBRARIES_GARAGE_UDPCOMMUNICATIONCHANNEL_H_
+#define LIBRARIES_GARAGE_UDPCOMMUNICATIONCHANNEL_H_
+
+#include <spark_secure_channel/SparkSecureChannelServer.h>
+#include "spark_wlan.h"
+#include "Timer.h"
+#include "Trace.h"
+#include "utils.h"
+
+#define UDP_POLL_INTERVAL		50		// Milliseconds between checks for datagrams
+
+class UdpCommunicationChannel : public CommunicationChannel {
+public:
+	UdpCommunicationChannel(int listenPort) :
+		listenPort(listenPort),
+		opened(false),
+		bound(false),
+		disconnectEvents(0),
+		datagram {0},
+		datagramLength(0),
+		datagramOffset(0),
+		replyPort(0),
+		pollTimer(UDP_POLL_INTERVAL) {
+
+	}
+
+	/**
+	 * Starts listening as soon as WiFi is available
+	 */
+	void open() { opened = true; }
+
+	/**
+	 * Reads from the current datagram, receiving a new one if it has been used up
+	 */
+	int read(uint8_t *buffer, size_t size);
+
+	/**
+	 * Sends 'buffer' as one datagram to the sender of the current one
+	 */
+	size_t write(const uint8_t *buffer, size_t size);
+
+	/**
+	 * Source address and port of the current datagram
+	 */
+	uint64_t peer();
+
+	/**
+	 * Sends 'buffer' as one datagram to every host on our subnet, at 'port'. Shares our socket, so it
+	 * costs the CC3000 nothing extra. Returns the number of bytes sent, or 0 if WiFi is down.
+	 */
+	size_t broadcast(uint16_t port, const uint8_t *buffer, size_t size);
+
+private:
+	int listenPort;
+
+	UDP udp;
+
+	/**
+	 * true once open() was called
+	 */
+	bool opened;
+
+	/**
+	 * true while udp is bound to listenPort
+	 */
+	bool bound;
+
+	/**
+	 * Value of WLAN_DISCONNECT_EVENTS when udp was bound. Any change means the socket is gone.
+	 */
+	uint32_t disconnectEvents;
+
+	/**
+	 * The transmission currently being read
+	 */
+	uint8_t datagram[MAX_TRANSMISSION_SIZE];
+	int datagramLength;
+	int datagramOffset;
+
+	/**
+	 * Sender of the current datagram. Responses go here, even if broadcast() was used in the meantime.
+	 */
+	IPAddress replyAddress;
+	uint16_t replyPort;
+
+	/**
+	 * Paces the polls of an idle socket. Stopped while datagrams keep coming, so a burst is read without delay.
+	 */
+	Timer pollTimer;
+
+	/**
+	 * Binds or drops the socket to follow the WiFi connection. Returns true when we can talk.
+	 */
+	bool isListening();
+
+	/**
+	 * Receives the next datagram into 'datagram', dropping any that don't hold exactly one transmission.
+	 * Returns true if one is ready to be read.
+	 */
+	bool receiveDatagram();
+};
+
+
+bool UdpCommunicationChannel::isListening() {
+	bool wifiUp = WiFi.ready() && WLAN_DISCONNECT_EVENTS == disconnectEvents;
+
+	if ( bound && !wifiUp ) {
+		debug(LOG_STR("UDP socket lost"));
+		udp.stop();
+		bound = false;
+		datagramLength = datagramOffset = 0;
+	}
+
+	if ( opened && !bound && WiFi.ready() ) {
+		disconnectEvents = WLAN_DISCONNECT_EVENTS;
+		bound = udp.begin(listenPort);
+		if ( bound ) {
+			debug(LOG_STR("Listening for datagrams on "), 0); debug(WiFi.localIP(), 0); debug(LOG_STR(":"), 0); debug(listenPort);
+		}
+	}
+
+	return bound;
+}
+
+bool UdpCommunicationChannel::receiveDatagram() {
+	if ( !pollTimer.isElapsed() ) {
+		return false;
+	}
+
+	if ( udp.parsePacket() <= 0 ) {
+		pollTimer.start();
+		return false;
+	}
+
+	int size = udp.read(datagram, sizeof(datagram));
+	bool truncated = udp.available() > 0;
+	udp.flush();
+
+	uint16_t transmissionLength = 0;
+	if ( size >= 2 ) {
+		memcpy(&transmissionLength, datagram, 2);
+	}
+
+	if ( truncated || size < 2 || FRAME_LENGTH(transmissionLength) != size ) {
+		LOG_WARN(LOG_STR("Dropping malformed datagram of "), 0); LOG_WARN(size);
+		return false;
+	}
+
+	datagramLength = size;
+	datagramOffset = 0;
+	replyAddress = udp.remoteIP();
+	replyPort = udp.remotePort();
+	return true;
+}
+
+int UdpCommunicationChannel::read(uint8_t *buffer, size_t size) {
+	int bytesRead = 0;
+
+	if ( isListening() ) {
+		if ( datagramOffset < datagramLength || receiveDatagram() ) {
+			TRACE_BEGIN(TCP_READ);
+			bytesRead = datagramLength - datagramOffset;
+			if ( bytesRead > (int) size ) {
+				bytesRead = size;
+			}
+			memcpy(buffer, datagram + datagramOffset, bytesRead);
+			datagramOffset += bytesRead;
+			TRACE_END(TCP_READ, bytesRead);
+		}
+	}
+
+	return bytesRead;
+}
+
+size_t UdpCommunicationChannel::write(const uint8_t *buffer, size_t size) {
+	int bytesSent = 0;
+
+	if ( isListening() ) {
+		TRACE_BEGIN(TCP_WRITE);
+		udp.beginPacket(replyAddress, replyPort);
+		bytesSent = udp.write(buffer, size);
+		TRACE_END(TCP_WRITE, bytesSent);
+	}
+
+	return bytesSent > 0 ? bytesSent : 0;
+}
+
+uint64_t UdpCommunicationChannel::peer() {
+	return (uint64_t) replyAddress[0] << 40 | (uint64_t) replyAddress[1] << 32 | (uint32_t) replyAddress[2] << 24 |
+			(uint32_t) replyAddress[3] << 16 | replyPort;
+}
+
+size_t UdpCommunicationChannel::broadcast(uint16_t port, const uint8_t *buffer, size_t size) {
+	int bytesSent = 0;
+
+	if ( isListening() ) {
+		IPAddress localIP = WiFi.localIP();
+		IPAddress subnetMask = WiFi.subnetMask();
+		IPAddress broadcastAddress(	localIP[0] | ~subnetMask[0], localIP[1] | ~subnetMask[1],
+									localIP[2] | ~subnetMask[2], localIP[3] | ~subnetMask[3]);
+
+		udp.beginPacket(broadcastAddress, port);
+		bytesSent = udp.write(buffer, size);
+	}
+
+	return bytesSent > 0 ? bytesSent : 0;
+}
+
+#endif /* LIBRARIES_GARAGE_UDPCOMMUNICATIONCHANNEL_H_ */
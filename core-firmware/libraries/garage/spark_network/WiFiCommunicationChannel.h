@@ -13,32 +13,70 @@
 
 #include <spark_secure_channel/SparkSecureChannelServer.h>
 #include "Timer.h"
+#include "LinkMonitor.h"
+#include "Statistics.h"
+#include "Trace.h"
 #include "utils.h"
 
+
+#define WIFI_RADIO_OFF_TIME	100		// Milliseconds the radio stays off when power cycling it
+#define WIFI_DHCP_TIMEOUT	20000	// Power cycle the radio if we don't get an address within this many milliseconds
+
+#define WIFI_MAX_CLIENTS			2		// Our share of the CC3000 sockets. The listeners and the mDNS responder hold the rest.
+#define WIFI_CLIENT_IDLE_TIMEOUT	30000	// Milliseconds a client may stay silent before we hang up on it
+#define WIFI_ACCEPT_INTERVAL		50		// Milliseconds between checks for new and dead clients, each costs CC3000 calls
+
+/**
+ * A connected client, and when we last heard from it
+ */
+struct ClientSlot {
+	ClientSlot() : id(0), lastActivity(0) {}
+
+	TCPClient client;
+	uint32_t id;				// Unique per connection, 0 when the slot is free
+	system_tick_t lastActivity;	// millis() of the last successful read or write
+};
+
 class WiFiCommunicationChannel : public CommunicationChannel {
 public:
 	WiFiCommunicationChannel(int listenPort, int pingInterval, IPAddress pingTarget) :
 		listenPort(listenPort),
 		server(listenPort),
-//		socketConnectionTimer(5000),
-		pingTimer(pingInterval),
-		pingTarget(pingTarget),
-		clientConnected(false) {
+		linkMonitor(pingInterval, pingTarget),
+		currentSlot(0),
+		transmissionInProgress(false),
+		connectionCount(0),
+		wifiState(WIFI_IDLE),
+		radioOffTimer(WIFI_RADIO_OFF_TIME),
+		dhcpTimer(WIFI_DHCP_TIMEOUT),
+		acceptTimer(WIFI_ACCEPT_INTERVAL) {
 
 	}
 
 	/**
-	 * Reads from client
+	 * Reads from the current client. Moves on to another client with pending data once SecureChannelServer
+	 * is done with the current transmission.
 	 */
 	int read(uint8_t *buffer, size_t size);
 
 	/**
-	 * Writes to server
+	 * Writes to the current client. Each call is sent right away as one submission.
 	 */
 	size_t write(const uint8_t *buffer, size_t size);
 
 	/**
-	 * Blocks trying to get a WiFi connection. Times out if unsuccessful.
+	 * Identifies the connection of the current client
+	 */
+	uint64_t peer() { return clients[currentSlot].id; }
+
+	/**
+	 * Lets read() move on to other clients
+	 */
+	void transmissionDone() { transmissionInProgress = false; }
+
+	/**
+	 * Starts bringing up the WiFi connection. Returns right away; the connection is advanced
+	 * one step at a time by every following read() or write().
 	 */
 	void open();
 
@@ -54,144 +92,295 @@ private:
 	TCPServer server;
 
 	/**
-	 * Currently connected client
+	 * Connected clients. A client that goes quiet for WIFI_CLIENT_IDLE_TIMEOUT is hung up on, and when all slots
+	 * are taken, a new client replaces the least recently active one. So a phone that walked out of range
+	 * never locks the next one out.
 	 */
-	TCPClient client;
+	ClientSlot clients[WIFI_MAX_CLIENTS];
+
+	/**
+	 * The client being read from and answered
+	 */
+	int currentSlot;
+
+	/**
+	 * true from the first byte read of a transmission until SecureChannelServer is done with it. currentSlot
+	 * stays put meanwhile, so a transmission is never pieced together from several clients.
+	 */
+	bool transmissionInProgress;
+
+	/**
+	 * Number of connections accepted so far. Used to give every connection a unique id.
+	 */
+	uint32_t connectionCount;
 
 	/**
-	 * Used to disconnect clients that are connected for too long
+	 * Detects dead connections. pingTarget is only pinged if there was no traffic for pingInterval milliseconds.
 	 */
-//	Timer socketConnectionTimer;
+	LinkMonitor linkMonitor;
 
 	/**
-	 * Used for pinging the pingTarget every pingInterval seconds in order to detect disconnects
+	 * Steps of bringing the WiFi connection up. Each step only starts an operation or checks on it,
+	 * so the main loop keeps running while we are offline.
 	 */
-	Timer pingTimer;
-	IPAddress pingTarget;
+	enum WiFiState {
+		WIFI_IDLE,				// open() has not been called yet
+		WIFI_RADIO_OFF,			// Radio was turned off. Waiting for radioOffTimer before turning it back on.
+		WIFI_WAITING_FOR_DHCP,	// Associating and acquiring an address. Power cycle if dhcpTimer runs out.
+		WIFI_LISTENING			// Connected, and the server is accepting clients
+	};
+	WiFiState wifiState;
+
+	Timer radioOffTimer;
+	Timer dhcpTimer;
+
+	/**
+	 * Spaces out reaping and accepting clients, like linkMonitor spaces out its pings
+	 */
+	Timer acceptTimer;
+
+	/**
+	 * Advances the WiFi connection by at most one step. Returns true when it is up and listening.
+	 */
+	bool advanceWiFiState();
 
 	/**
-	 * true when there is a client connected
+	 * Drops any client and turns the radio off, which restarts the connection sequence
 	 */
-	bool clientConnected;
+	void restartWiFi();
 
 	/**
 	 * Manages the WiFi connection and client state.
 	 *
 	 * This method is called every time before we try to read or write anything to/from the network.
-	 * It ensures that WiFi connectivity is present and functioning. This is accomplished by
-	 * pinging pingTarget every pingInterval seconds.
+	 * It ensures that WiFi connectivity is present and functioning, with the help of linkMonitor.
 	 *
-	 * It also manages clientConnected state.
+	 * Every WIFI_ACCEPT_INTERVAL, it also reaps dead and idle clients, and accepts new ones. Returns true if
+	 * any client is connected.
 	 */
 	bool isClientConnected();
 
-};
+	/**
+	 * Hangs up on the client in 'slot' and frees it
+	 */
+	void closeClient(int slot);
 
-void WiFiCommunicationChannel::open() {
-	// WiFi setup
-	//
-	debug("WiFi OFF...");
-	WiFi.off();
-	delay(1000);
+	/**
+	 * Frees the slots of clients that disconnected or have been idle for too long
+	 */
+	void reapClients();
 
-	debug("Connecting to WiFi... ", 0);
-	WiFi.on();
-	WiFi.connect();
-	debug("Connected.");
+	/**
+	 * Takes a pending connection, if there is one, evicting the least recently active client if needed
+	 */
+	void acceptClient();
 
-	debug("Acquiring DHCP info... ", 0);
+	/**
+	 * Makes sure currentSlot holds a client with data to read, if any client has some. Returns false if none do.
+	 * Only looks at the current client while a transmission is in progress.
+	 */
+	bool selectClientWithData();
 
-	Timer wifiConnectTimer(20000); // Restart connection attempts every 20 seconds
-	wifiConnectTimer.start();
-	while (!WiFi.ready()) {
-		SPARK_WLAN_Loop();
+};
 
-		if ( wifiConnectTimer.isRunning() && wifiConnectTimer.isElapsed() ) {
-			// Couldn't connect for 20 seconds. Retry.
-			return;
-		}
+void WiFiCommunicationChannel::open() {
+	if ( wifiState == WIFI_IDLE ) {
+		restartWiFi();
 	}
+}
+
+void WiFiCommunicationChannel::restartWiFi() {
+	debug(LOG_STR("WiFi OFF..."));
 
-	delay(1000);
+	for ( int slot = 0; slot < WIFI_MAX_CLIENTS; slot++ ) {
+		closeClient(slot);
+	}
 
-	debug("Done");
-	debug("SSID: ", false);	debug(WiFi.SSID());
-	debug("IP: ", false);	debug(WiFi.localIP());
-	debug("Gateway: ", false);	debug(WiFi.gatewayIP());
-	debug("Listening on ", 0); debug(WiFi.localIP(), 0); debug(":", 0); debug(listenPort);
+	WiFi.off();
 
-	pingTimer.start();
+	radioOffTimer.start();
+	wifiState = WIFI_RADIO_OFF;
 }
 
-bool WiFiCommunicationChannel::isClientConnected() {
-	if ( WiFi.ready() ) {
-
-//		if ( socketConnectionTimer.isRunning() && socketConnectionTimer.isElapsed() ) {
-//			debug("Disconnecting lingering client...");
-//			client.stop();
-//		}
-
-		// Ping pingTarget to make sure our connection is live
-		//
-		if ( pingTimer.isRunning() && pingTimer.isElapsed() ) {
-			debug("Pinging test server...", 0);
-			int numberOfReceivedPackets = WiFi.ping(pingTarget, 3);
-			if ( numberOfReceivedPackets > 0 ) {
-				debug(" OK");
-				pingTimer.start();
+bool WiFiCommunicationChannel::advanceWiFiState() {
+	switch ( wifiState ) {
+		case WIFI_IDLE:
+			return false;
+
+		case WIFI_RADIO_OFF:
+			if ( radioOffTimer.isElapsed() ) {
+				debug(LOG_STR("Connecting to WiFi... "));
+				WiFi.on();
+				WiFi.connect();
+
+				debug(LOG_STR("Acquiring DHCP info... "));
+				dhcpTimer.start();
+				wifiState = WIFI_WAITING_FOR_DHCP;
+			}
+			return false;
+
+		case WIFI_WAITING_FOR_DHCP:
+			// SPARK_WLAN_Loop() runs between passes of the main loop and completes the connection for us
+			//
+			if ( WiFi.ready() ) {
+				debug(LOG_STR("Done"));
+				debug(LOG_STR("SSID: "), false);	debug(WiFi.SSID());
+				debug(LOG_STR("IP: "), false);	debug(WiFi.localIP());
+				debug(LOG_STR("Gateway: "), false);	debug(WiFi.gatewayIP());
+
+				server.begin();
+				debug(LOG_STR("Listening on "), 0); debug(WiFi.localIP(), 0); debug(LOG_STR(":"), 0); debug(listenPort);
+
+				linkMonitor.start();
+				wifiState = WIFI_LISTENING;
+				return true;
+			}
+			else if ( dhcpTimer.isElapsed() ) {
+				// Couldn't connect in time. Power cycle the radio and retry.
+				//
+				LOG_WARN(LOG_STR("Timed out acquiring DHCP info. Retrying..."));
+				restartWiFi();
 			}
-			else {
-				debug("Oh-oh. We can't ping pingTarget. Re-initializing WiFi...");
-				WiFi.disconnect(); WiFi.off();
+			return false;
+
+		case WIFI_LISTENING:
+			switch ( linkMonitor.check() ) {
+				case LinkMonitor::LINK_ALIVE:
+					return true;
+
+				case LinkMonitor::LINK_LOST:
+					LOG_INFO(LOG_STR("Reconnecting to WiFi..."));
+					Statistics::getInstance().count(Statistics::WIFI_RECONNECTS);
+					restartWiFi();
+					return false;
+
+				case LinkMonitor::LINK_UNRESPONSIVE:
+					LOG_WARN(LOG_STR("Oh-oh. We can't ping pingTarget. Re-initializing WiFi..."));
+					Statistics::getInstance().count(Statistics::PING_FAILURES);
+					WiFi.disconnect();
+					restartWiFi();
+					return false;
 			}
+			return false;
+	}
+
+	return false;
+}
+
+void WiFiCommunicationChannel::closeClient(int slot) {
+	if ( clients[slot].id != 0 ) {
+		clients[slot].client.stop();
+		clients[slot].id = 0;
+	}
+}
+
+void WiFiCommunicationChannel::reapClients() {
+	for ( int slot = 0; slot < WIFI_MAX_CLIENTS; slot++ ) {
+		ClientSlot& c = clients[slot];
+		if ( c.id == 0 ) {
+			continue;
 		}
 
-		if (client.connected()) { // There is a connected client
-			if ( !clientConnected ) {
-				debug("Client connected!");
-				clientConnected = true;
-//				socketConnectionTimer.start();
-			}
+		if ( !c.client.connected() ) {
+			debug(LOG_STR("Client disconnected: "), 0); debug((int) c.id);
+			closeClient(slot);
+		}
+		else if ( millis() - c.lastActivity >= WIFI_CLIENT_IDLE_TIMEOUT ) {
+			LOG_INFO(LOG_STR("Disconnecting idle client: "), 0); LOG_INFO((int) c.id);
+			Statistics::getInstance().count(Statistics::IDLE_CLIENTS_REAPED);
+			closeClient(slot);
+		}
+	}
+}
 
-		} else {
-			// If no client is connected, check for a new connection
-			//
-			if ( clientConnected ) {
-				debug("Client disconnected. Waiting for another connection...\n\n");
-				clientConnected = false;
-//				socketConnectionTimer.stop();
+void WiFiCommunicationChannel::acceptClient() {
+	TCPClient newClient = server.available();
+	if ( !newClient.connected() ) {
+		return;
+	}
+
+	// Use a free slot, or else the one that has been quiet the longest
+	//
+	int slot = -1;
+	for ( int i = 0; i < WIFI_MAX_CLIENTS && slot < 0; i++ ) {
+		if ( clients[i].id == 0 ) {
+			slot = i;
+		}
+	}
+
+	if ( slot < 0 ) {
+		slot = 0;
+		for ( int i = 1; i < WIFI_MAX_CLIENTS; i++ ) {
+			if ( clients[i].lastActivity - clients[slot].lastActivity > 0x80000000 ) { // Older, allowing for millis() rollover
+				slot = i;
 			}
-			client = server.available();
 		}
+
+		LOG_INFO(LOG_STR("Out of client slots. Evicting client "), 0); LOG_INFO((int) clients[slot].id);
+		Statistics::getInstance().count(Statistics::CLIENTS_EVICTED);
+		closeClient(slot);
 	}
-	else { // If there is no WiFi connection
-		debug("Reconnecting to WiFi...");
 
-		client.stop();
+	clients[slot].client = newClient;
+	clients[slot].id = ++connectionCount;
+	clients[slot].lastActivity = millis();
+
+	debug(LOG_STR("Client connected: "), 0); debug((int) clients[slot].id);
+}
+
+bool WiFiCommunicationChannel::isClientConnected() {
+	bool connected = false;
 
-		clientConnected = false;
+	if ( advanceWiFiState() ) {
+		if ( acceptTimer.isElapsed() ) {
+			reapClients();
+			acceptClient();
+			acceptTimer.start();
+		}
+
+		for ( int slot = 0; slot < WIFI_MAX_CLIENTS; slot++ ) {
+			connected |= clients[slot].id != 0;
+		}
+	}
 
-		open(); // Blocks trying to get a WiFi connection. Times out if unsuccessful.
+	return connected;
+}
 
-		// Start listening for clients
-		//
-		if ( WiFi.ready() ) {
-			server.begin();
-			debug("Listening on ", 0); debug(WiFi.localIP(), 0); debug(":", 0); debug(listenPort);
+bool WiFiCommunicationChannel::selectClientWithData() {
+	// Stay with the current client until its transmission is done, even if the rest of it is late. If the
+	// client went away, SecureChannelServer times the transmission out.
+	//
+	if ( transmissionInProgress ) {
+		return clients[currentSlot].id != 0 && clients[currentSlot].client.available();
+	}
 
-			pingTimer.start();
+	for ( int i = 0; i < WIFI_MAX_CLIENTS; i++ ) {
+		int slot = (currentSlot + i) % WIFI_MAX_CLIENTS;
+		if ( clients[slot].id != 0 && clients[slot].client.available() ) {
+			currentSlot = slot;
+			return true;
 		}
 	}
 
-	return clientConnected;
+	return false;
 }
 
 int WiFiCommunicationChannel::read(uint8_t *buffer, size_t size) {
 	int bytesRead = 0;
 
 	if ( isClientConnected() ) {
-		if ( client.available() ) {
-			bytesRead = client.read(buffer, size);
+		if ( selectClientWithData() ) {
+			ClientSlot& c = clients[currentSlot];
+
+			TRACE_BEGIN(TCP_READ);
+			bytesRead = c.client.read(buffer, size);
+			TRACE_END(TCP_READ, bytesRead);
+
+			if ( bytesRead > 0 ) {
+				c.lastActivity = millis();
+				linkMonitor.recordActivity();
+				transmissionInProgress = true;
+			}
 		}
 	}
 
@@ -201,11 +390,25 @@ int WiFiCommunicationChannel::read(uint8_t *buffer, size_t size) {
 size_t WiFiCommunicationChannel::write(const uint8_t *buffer, size_t size) {
 	int bytesSent = 0;
 
-	if ( isClientConnected() ) {
-		bytesSent = server.write(buffer, size);
+	if ( isClientConnected() && clients[currentSlot].id != 0 ) {
+		ClientSlot& c = clients[currentSlot];
+
+		TRACE_BEGIN(TCP_WRITE);
+		bytesSent = c.client.write(buffer, size);
+		// SecureChannelServer always writes whole transmissions, so don't wait for more. Until this send
+		// succeeds, nothing has actually gone out.
+		if ( bytesSent > 0 && !c.client.sendQueued() ) {
+			bytesSent = 0;
+		}
+		TRACE_END(TCP_WRITE, bytesSent);
+
+		if ( bytesSent > 0 ) {
+			c.lastActivity = millis();
+			linkMonitor.recordActivity();
+		}
 	}
 
-	return bytesSent;
+	return bytesSent > 0 ? bytesSent : 0;
 }
 
 #endif /* LIBRARIES_GARAGE_WIFICOMMUNICATIONCHANNEL_H_ */
@@ -59,6 +59,15 @@ public:
 	 */
 	void generateRandomChallengeNonce(uint32_t challengeNonce[]);
 
+	/**
+	 * Index of the seed used since this boot. With ROTATE_SEED it grows by one on every boot, which makes it
+	 * usable as a boot counter.
+	 */
+	uint16_t getSeedIndex() {
+		initializeRandomness();
+		return current_seed_index;
+	}
+
 
 private:
 	SparkRandomNumberGenerator() :
@@ -102,7 +111,7 @@ void SparkRandomNumberGenerator::readRandomSeedIndexFromFlash() {
 			CURRENT_SEED_INDEX_ADDRESS, sizeof(current_seed_index));
 
 #ifdef DEBUG_PRINT_SEED
-	debug("Reading seed index from flash: ", false);
+	debug(LOG_STR("Reading seed index from flash: "), false);
 	debug(current_seed_index);
 #endif
 }
@@ -116,7 +125,7 @@ void SparkRandomNumberGenerator::rotateRandomSeed() {
 #ifdef ROTATE_SEED
 	current_seed_index++;
 
-	debug("Persisting new seed index: ", false); debug(current_seed_index);
+	debug(LOG_STR("Persisting new seed index: "), false); debug(current_seed_index);
 
 	sFLASH_EraseSector(CURRENT_SEED_INDEX_ADDRESS);
 	sFLASH_WriteBuffer((uint8_t*)&current_seed_index, CURRENT_SEED_INDEX_ADDRESS, sizeof(current_seed_index));
@@ -134,11 +143,11 @@ void SparkRandomNumberGenerator::readRandomSeedFromFlash() {
 			SEEDS_SIZE);
 
 #ifdef DEBUG_PRINT_SEED
-	debug("--- SEED ---");
+	debug(LOG_STR("--- SEED ---"));
 	debug(seed_vector[0]);
 	debug(seed_vector[1]);
 	debug(seed_vector[2]);
-	debug("------------");
+	debug(LOG_STR("------------"));
 #endif
 }
 
@@ -169,12 +178,12 @@ void SparkRandomNumberGenerator::generateRandomChallengeNonce(uint32_t challenge
 	challengeNonce[3] = mrand48() ^ entropyFromTimer[3] ^ networkEntropy[3];
 
 #ifdef DEBUG_PRINT_NONCE
-	debug("--- NONCE ---");
+	debug(LOG_STR("--- NONCE ---"));
 	Serial.print(challengeNonce[0], HEX);
 	Serial.print(challengeNonce[1], HEX);
 	Serial.print(challengeNonce[2], HEX);
 	Serial.println(challengeNonce[3], HEX);
-	debug("------------");
+	debug(LOG_STR("------------"));
 #endif
 }
 
@@ -195,13 +204,13 @@ void SparkRandomNumberGenerator::getEntropyFromTimer(uint32_t timerEntropy[4]) {
 	memcpy(timerEntropy, hmac, 16);
 
 #ifdef DEBUG_PRINT_TIMER_ENTROPY
-	debug("--- TIMER ---");
+	debug(LOG_STR("--- TIMER ---"));
 	debug(mils);
 	Serial.print(timerEntropy[0], HEX);
 	Serial.print(timerEntropy[1], HEX);
 	Serial.print(timerEntropy[2], HEX);
 	Serial.println(timerEntropy[3], HEX);
-	debug("------------");
+	debug(LOG_STR("------------"));
 #endif
 }
 
@@ -218,7 +227,7 @@ void SparkRandomNumberGenerator::initEntropyFromNetwork() {
 
 	for ( int i = 0; i < 5; i++ ) {
 #ifdef PING_TEST_SERVER
-		debug("Gathering entropy from network...");
+		debug(LOG_STR("Gathering entropy from network..."));
 		pingSum = this->pingTestServer().avg_round_time;
 #else
 		pingSum = 43;
@@ -234,12 +243,12 @@ void SparkRandomNumberGenerator::initEntropyFromNetwork() {
 	memcpy(networkEntropy, hmac, 16);
 
 #ifdef DEBUG_PRINT_PING_ENTROPY
-	debug("--- PING ---");
+	debug(LOG_STR("--- PING ---"));
 	Serial.print(networkEntropy[0], HEX);
 	Serial.print(networkEntropy[1], HEX);
 	Serial.print(networkEntropy[2], HEX);
 	Serial.println(networkEntropy[3], HEX);
-	debug("------------");
+	debug(LOG_STR("------------"));
 #endif
 }
 
@@ -17,6 +17,18 @@
  * 	Spark 1a) If conversation is valid, delegate COMMAND to SecureMessageConsumer
  * 	Spark 2a) If not, encryptAndSend("SESSION_EXPIRED")
  *
+ * A valid conversation may also send "GET_STATS" or "GET_TRACE", which are answered by this server directly
+ * with the binary reports described in Statistics.h and Trace.h
+ *
+ *
+ * Transmissions come in two frame versions, told apart by the top 4 bits of the Length field, and every
+ * request is answered in the version it came in:
+ * 	Version 0) [Length[2], IV[16], AES_CBC(Key, IV, PKCS7(PAYLOAD)), <==== HMAC(Master_Key)
+ * 	Version 1) [Length[2] | 1 << 12, Nonce[12], AES_CTR(Key, Nonce || Counter[4], PAYLOAD), <==== HMAC(Master_Key)
+ *
+ * Version 0 clients never set those bits, since transmissions are shorter than 4 KB. Version 1 needs no padding
+ * and no AES decryption, and its HMAC is computed in the same pass over the bytes as the cipher.
+ *
  *
  * The specifics of sending and receiving data are abstracted into CommunicationChannel.
  *
@@ -37,6 +49,8 @@
 #include <string.h>
 #include <utils.h>
 #include <Timer.h>
+#include <Statistics.h>
+#include <Trace.h>
 
 /**
  * Interface to be implemented by the message consumer.
@@ -49,6 +63,13 @@ public:
 	 * Decrypted messages will be provided to this method
 	 */
 	virtual String processMessage(String message) = 0;
+
+	/**
+	 * Decrypted messages are offered here first, for commands that answer with binary data. Write up to
+	 * 'maxResponseLength' bytes into 'response' and return how many were written, or return -1 to have
+	 * the message passed on to processMessage()
+	 */
+	virtual int processBinaryMessage(String message, uint8_t response[], int maxResponseLength) { return -1; }
 };
 
 /**
@@ -73,20 +94,61 @@ public:
 	 * Write 'size' bytes from the provided 'buffer'
 	 */
 	virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+
+	/**
+	 * Identifies the sender of the data last read, so conversations with different peers can be kept apart.
+	 * Channels that only ever talk to one client at a time can leave this alone.
+	 */
+	virtual uint64_t peer() { return 0; }
+
+	/**
+	 * Called once the transmission being read has been handled, dropped or timed out. Channels with several
+	 * clients must keep reading from the same one until then, since a transmission can arrive over several reads.
+	 */
+	virtual void transmissionDone() {}
 };
 
 #define MAX_TRANSMISSION_SIZE 256	// 256 - Length[2] - IV[16] - HMAC[20] - CONV_TOKEN[20] = max 198 byte messages and responses
+#define MAX_RESPONSE_PAYLOAD_SIZE (MAX_TRANSMISSION_SIZE - 2 - 16 - 20 - 20)
+#define MAX_CONVERSATIONS 4			// Number of peers that can hold a Conversation Token at the same time
+#define TRANSMISSION_TIMEOUT 2000	// Milliseconds the rest of a transmission may take to arrive once it has started
+
+#define CTR_FRAMES	// Comment this out to only accept version 0 (AES-CBC) transmissions
+
+#define FRAME_VERSION_CBC		0
+#define FRAME_VERSION_CTR		1
+#define FRAME_VERSION(lengthField)	((lengthField) >> 12)
+#define FRAME_LENGTH(lengthField)	((lengthField) & 0x0FFF)
+
+#define CTR_NONCE_SIZE	12
+#define CTR_CHUNK_SIZE	64	// Bytes run through AES-CTR and the HMAC at a time, one SHA-1 block
+
+/**
+ * Conversation state of one peer
+ */
+struct Conversation {
+	Conversation() : peer(0), token {0}, valid(false), timer(0) {}
+
+	uint64_t peer;				// CommunicationChannel::peer() of the client that asked for the challenge
+	unsigned char token[20];	// Locally computed Conversation Token ( HMAC(Master_Key, Challenge[16]) )
+	bool valid;
+	Timer timer;				// Expires the Conversation Token
+};
 
 class SecureChannelServer {
 public:
 	SecureChannelServer(CommunicationChannel* cc, SecureMessageConsumer* mc, int conversationDuration) :
-			transmissionLength(0), receive_buffer {0}, send_buffer {0},
-			conversationToken {0}, conversationTokenValid(false), conversationTimer(conversationDuration),
-			msgState(NEED_TRANSMISSION_LENGTH)
+			transmissionLength(0), receivedLength(0), transmissionStartCycles(0), transmissionTimer(TRANSMISSION_TIMEOUT),
+			receive_buffer {0}, send_buffer {0},
+			nextConversationSlot(0), msgState(NEED_TRANSMISSION_LENGTH)
 	{
 		commChannel = cc;
 		msgConsumer = mc;
 
+		for ( int i = 0; i < MAX_CONVERSATIONS; i++ ) {
+			conversations[i].timer = Timer(conversationDuration);
+		}
+
 		reset_transmission_state();
 	}
 
@@ -98,6 +160,21 @@ public:
 	 */
 	void loop();
 
+	/**
+	 * Encrypts and encodes the response payload into the following transmission form:
+	 *
+	 * 	[Message_Length[2], IV_Response[16], AES_CBC(Key, IV_Response, PAYLOAD), <==== HMAC(Master_Key)
+	 *
+	 * or into the version 1 form when 'frameVersion' is FRAME_VERSION_CTR.
+	 *
+	 * Needs no conversation, so anything else sending authenticated data, like StatusBeacon, uses it too. Such
+	 * senders must pass their own 'key', so their transmissions can never pass for responses or the other way
+	 * around. The first 16 bytes of 'key' are the AES key, and all 'keyLength' bytes are the HMAC key.
+	 */
+	static int encryptResponsePayload(unsigned char* responseMessage, int payload_length, uint8_t encrypted_response_transmission[],
+			int frameVersion = FRAME_VERSION_CBC,
+			const uint8_t* key = (const uint8_t*) MASTER_KEY, int keyLength = sizeof(MASTER_KEY));
+
 private:
 	CommunicationChannel* commChannel;
 	SecureMessageConsumer* msgConsumer;
@@ -108,6 +185,21 @@ private:
 	 */
 	int transmissionLength;
 
+	/**
+	 * Bytes of the current transmission received so far, Length field included
+	 */
+	int receivedLength;
+
+	/**
+	 * Statistics::cycles() when the first bytes of the current transmission were received
+	 */
+	uint32_t transmissionStartCycles;
+
+	/**
+	 * Drops the current transmission if it isn't complete within TRANSMISSION_TIMEOUT
+	 */
+	Timer transmissionTimer;
+
 	/**
 	 * Reserved memory space for holding incoming transmissions
 	 */
@@ -119,15 +211,14 @@ private:
 	uint8_t send_buffer[MAX_TRANSMISSION_SIZE];
 
 	/**
-	 * Locally computed Conversation Token ( HMAC(Master_Key, Challenge[16]) )
+	 * Conversations of the most recent peers. Channels with a single client only ever use one of these.
 	 */
-	unsigned char conversationToken[20];
-	bool conversationTokenValid;
+	Conversation conversations[MAX_CONVERSATIONS];
 
 	/**
-	 * This timer expires the Conversation token after a specified amount of time
+	 * Slot taken over by the next new peer when all of them are in use
 	 */
-	Timer conversationTimer;
+	int nextConversationSlot;
 
 
 	/**
@@ -142,14 +233,24 @@ private:
 	void reset_transmission_state();
 
 	/**
-	 * Returns true if conversationTimer has not expired and 'received_conv_token' equals
-	 * our local 'conversationToken'
+	 * Returns the conversation of 'peer', or NULL if it doesn't have one
+	 */
+	Conversation* findConversation(uint64_t peer);
+
+	/**
+	 * Returns the conversation of 'peer', taking over a free or the least recently started one if needed
+	 */
+	Conversation* allocateConversation(uint64_t peer);
+
+	/**
+	 * Returns true if the conversation of the current peer has not expired and 'received_conv_token' equals
+	 * its Conversation Token
 	 */
 	bool isConversationValid(uint8_t received_conv_token[]);
 
 	/**
-	 * This will be executed in the main loop to make sure that the conversation
-	 * is invalidated after conversationDuration milliseconds
+	 * This will be executed in the main loop to make sure that conversations
+	 * are invalidated after conversationDuration milliseconds
 	 */
 	void invalidateConversationTokenIfExpired();
 
@@ -171,21 +272,38 @@ private:
 	 *
 	 * 	[Message_Length[2], IV_Send[16], AES_CBC(Key, IV_Send, PAYLOAD), <==== HMAC(Master_Key)
 	 *
+	 * Version 1 transmissions are handed to decryptCtrTransmission().
 	 */
 	int decryptTransmission(uint8_t received_data[], uint8_t decrypted_payload[]);
 
 	/**
-	 * Encrypts and encodes the response payload into the following transmission form:
+	 * Extracts and decrypts the payload from a version 1 transmission:
 	 *
-	 * 	[Message_Length[2], IV_Response[16], AES_CBC(Key, IV_Response, PAYLOAD), <==== HMAC(Master_Key)
+	 * 	[Message_Length[2] | 1 << 12, Nonce_Send[12], AES_CTR(Key, Nonce_Send || Counter[4], PAYLOAD), <==== HMAC(Master_Key)
 	 *
+	 * The ciphertext is hashed and decrypted CTR_CHUNK_SIZE bytes at a time. The plaintext is wiped if the HMAC
+	 * turns out not to match.
 	 */
-	int encryptResponsePayload(unsigned char* responseMessage, int payload_length, uint8_t encrypted_response_transmission[]);
+	int decryptCtrTransmission(uint8_t received_data[], uint8_t decrypted_payload[]);
+
+	/**
+	 * Version 1 counterpart of encryptResponsePayload()
+	 */
+	static int encryptCtrResponsePayload(unsigned char* response_payload, int payload_length, uint8_t encrypted_response_transmission[],
+			const uint8_t* key, int keyLength);
+
 };
 
 
 
 int SecureChannelServer::decryptTransmission(uint8_t received_data[], uint8_t decrypted_payload[]) {
+#ifdef CTR_FRAMES
+	if ( FRAME_VERSION(received_data[1] << 8) == FRAME_VERSION_CTR ) {
+		return decryptCtrTransmission(received_data, decrypted_payload);
+	}
+#endif
+
+	TRACE_BEGIN(DECRYPT);
 
 	// Get the length of this data
 	//
@@ -194,51 +312,127 @@ int SecureChannelServer::decryptTransmission(uint8_t received_data[], uint8_t de
 
 	// Calculate our own HMAC of received data
 	//
+	uint32_t startCycles = Statistics::cycles();
 	int hmac_data_length = data_length - 20;
 	unsigned char local_hmac[20];
+	TRACE_BEGIN(SHA1_HMAC);
 	sha1_hmac(	(uint8_t*) MASTER_KEY, sizeof(MASTER_KEY),
 				received_data, hmac_data_length,
 				local_hmac);
+	TRACE_END(SHA1_HMAC, hmac_data_length);
 
 	// Compare our HMAC to received HMAC
 	//
-	if ( memcmp(local_hmac, received_data + hmac_data_length, 20) != 0 ) {
-		debug("BAD HMAC received!\n");
+	bool hmacMatched = memcmp(local_hmac, received_data + hmac_data_length, 20) == 0;
+	Statistics::getInstance().recordLatency(Statistics::HMAC_VERIFY, Statistics::cycles() - startCycles);
+
+	if ( !hmacMatched ) {
+		LOG_WARN(LOG_STR("BAD HMAC received!\n"));
+		Statistics::getInstance().count(Statistics::BAD_HMAC);
+		TRACE_END(DECRYPT, 0);
 		return -1;
 	}
 
-	// Grab the IV that was used to encrypt this data
+	// The IV that was used to encrypt this data. Decryption leaves the next IV in its place, which
+	// nobody needs, since the transmission is done with once it has been decrypted.
 	//
-	uint32_t iv_send[4];
-	uint8_t* iv_send_start = received_data + 2;
-	memcpy(iv_send, iv_send_start, sizeof(iv_send));
+	uint8_t* iv_send = received_data + 2;
+	uint8_t* ciphertext_start = iv_send + 16;
 
-	uint8_t* ciphertext_start = iv_send_start + 16;
-
-	// Decrypt the message
+	// Decrypt the message where it is, instead of through copies of the ciphertext and plaintext
 	//
+	startCycles = Statistics::cycles();
 	aes_context aes;
 	int aes_buffer_length = hmac_data_length - (ciphertext_start - received_data);
 
-	uint8_t ciphertext[aes_buffer_length];
-	uint8_t plaintext[aes_buffer_length];
-	memcpy(ciphertext, ciphertext_start, aes_buffer_length);
-
 	aes_setkey_dec(&aes, (uint8_t*) MASTER_KEY, 128);
-	aes_crypt_cbc(&aes, AES_DECRYPT, aes_buffer_length, (uint8_t*)iv_send, ciphertext, plaintext);
+	TRACE_BEGIN(AES_CBC);
+	aes_crypt_cbc(&aes, AES_DECRYPT, aes_buffer_length, iv_send, ciphertext_start, ciphertext_start);
+	TRACE_END(AES_CBC, aes_buffer_length);
+
+	// Drop the PKCS #7 padding
+	//
+	int message_size = aes_buffer_length - ciphertext_start[aes_buffer_length - 1];
+
+	memcpy(decrypted_payload, ciphertext_start, message_size);
+
+	Statistics::getInstance().recordLatency(Statistics::DECRYPT, Statistics::cycles() - startCycles);
+
+	TRACE_END(DECRYPT, message_size);
+	return message_size;
+}
+
+
+int SecureChannelServer::decryptCtrTransmission(uint8_t received_data[], uint8_t decrypted_payload[]) {
+	TRACE_BEGIN(DECRYPT);
+
+	int length_field = 0;
+	memcpy(&length_field, received_data, 2);
+	int hmac_data_length = FRAME_LENGTH(length_field) - 20;
+
+	uint8_t* nonce_send = received_data + 2;
+	uint8_t* ciphertext_start = nonce_send + CTR_NONCE_SIZE;
+	int message_size = hmac_data_length - (ciphertext_start - received_data);
+	if ( message_size < 0 ) {
+		TRACE_END(DECRYPT, 0);
+		return -1;
+	}
+
+	uint8_t counter[16] = {0};
+	memcpy(counter, nonce_send, CTR_NONCE_SIZE);
+	uint8_t stream_block[16];
+	int stream_offset = 0;
+
+	// HMAC and decrypt the ciphertext in one pass, while each chunk is still at hand. The DECRYPT latency
+	// covers both, there is no separate HMAC_VERIFY stage for these frames.
+	//
+	uint32_t startCycles = Statistics::cycles();
+	aes_context aes;
+	aes_setkey_enc(&aes, (uint8_t*) MASTER_KEY, 128);
+
+	sha1_context hmac_context;
+	sha1_hmac_starts(&hmac_context, (uint8_t*) MASTER_KEY, sizeof(MASTER_KEY));
+	sha1_hmac_update(&hmac_context, received_data, ciphertext_start - received_data);
+
+	TRACE_BEGIN(AES_CTR);
+	for ( int offset = 0; offset < message_size; offset += CTR_CHUNK_SIZE ) {
+		int chunk = message_size - offset < CTR_CHUNK_SIZE ? message_size - offset : CTR_CHUNK_SIZE;
+		sha1_hmac_update(&hmac_context, ciphertext_start + offset, chunk);
+		aes_crypt_ctr(&aes, chunk, &stream_offset, counter, stream_block, ciphertext_start + offset, decrypted_payload + offset);
+	}
+	TRACE_END(AES_CTR, message_size);
 
-	// Remove PKCS #7 padding from our message by padding with zeroes
+	unsigned char local_hmac[20];
+	sha1_hmac_finish(&hmac_context, local_hmac);
+
+	// Compare our HMAC to received HMAC
 	//
-	int message_size = aes_buffer_length - plaintext[aes_buffer_length - 1];
-	memset(plaintext + message_size, 0, aes_buffer_length - message_size);
+	bool hmacMatched = memcmp(local_hmac, received_data + hmac_data_length, 20) == 0;
+	Statistics::getInstance().recordLatency(Statistics::DECRYPT, Statistics::cycles() - startCycles);
 
-	memcpy(decrypted_payload, plaintext, message_size);
+	if ( !hmacMatched ) {
+		memset(decrypted_payload, 0, message_size);
 
+		LOG_WARN(LOG_STR("BAD HMAC received!\n"));
+		Statistics::getInstance().count(Statistics::BAD_HMAC);
+		TRACE_END(DECRYPT, 0);
+		return -1;
+	}
+
+	TRACE_END(DECRYPT, message_size);
 	return message_size;
 }
 
 
-int SecureChannelServer::encryptResponsePayload(unsigned char* response_payload, int payload_length, uint8_t encrypted_response_transmission[]) {
+int SecureChannelServer::encryptResponsePayload(unsigned char* response_payload, int payload_length, uint8_t encrypted_response_transmission[],
+		int frameVersion, const uint8_t* key, int keyLength) {
+#ifdef CTR_FRAMES
+	if ( frameVersion == FRAME_VERSION_CTR ) {
+		return encryptCtrResponsePayload(response_payload, payload_length, encrypted_response_transmission, key, keyLength);
+	}
+#endif
+
+	TRACE_BEGIN(ENCRYPT);
 	uint32_t iv_response[4]; SparkRandomNumberGenerator::getInstance().generateRandomChallengeNonce(iv_response);
 
 	uint8_t* iv_response_start = encrypted_response_transmission + 2;
@@ -259,8 +453,10 @@ int SecureChannelServer::encryptResponsePayload(unsigned char* response_payload,
 	//
 	aes_context aes;
 	uint8_t aes_buffer_encrypted[aes_buffer_length];
-	aes_setkey_enc(&aes, (uint8_t*) MASTER_KEY, 128);
+	aes_setkey_enc(&aes, (uint8_t*) key, 128);
+	TRACE_BEGIN(AES_CBC);
 	aes_crypt_cbc(&aes, AES_ENCRYPT, aes_buffer_length, (uint8_t*)iv_response, aes_buffer, aes_buffer_encrypted);
+	TRACE_END(AES_CBC, aes_buffer_length);
 
 	// Add encrypted buffer
 	//
@@ -276,9 +472,11 @@ int SecureChannelServer::encryptResponsePayload(unsigned char* response_payload,
 
 	// Calculate HMAC(Key) of all data in send_data so far
 	//
-	sha1_hmac(	(uint8_t*) MASTER_KEY, sizeof(MASTER_KEY),
+	TRACE_BEGIN(SHA1_HMAC);
+	sha1_hmac(	(uint8_t*) key, keyLength,
 				encrypted_response_transmission, hmac_start - encrypted_response_transmission,
 				hmac);
+	TRACE_END(SHA1_HMAC, hmac_start - encrypted_response_transmission);
 
 	// Append the HMAC to send_data
 	//
@@ -287,6 +485,51 @@ int SecureChannelServer::encryptResponsePayload(unsigned char* response_payload,
 	// Return the length of prepared send_data
 	//
 	uint8_t* end_of_data = hmac_start + sizeof(hmac);
+	TRACE_END(ENCRYPT, end_of_data - encrypted_response_transmission);
+	return end_of_data - encrypted_response_transmission;
+}
+
+int SecureChannelServer::encryptCtrResponsePayload(unsigned char* response_payload, int payload_length, uint8_t encrypted_response_transmission[],
+		const uint8_t* key, int keyLength) {
+	TRACE_BEGIN(ENCRYPT);
+	uint32_t nonce_response[4]; SparkRandomNumberGenerator::getInstance().generateRandomChallengeNonce(nonce_response);
+
+	uint8_t* nonce_response_start = encrypted_response_transmission + 2;
+	memcpy(nonce_response_start, nonce_response, CTR_NONCE_SIZE); // Add Nonce_Response[12]
+
+	uint8_t counter[16] = {0};
+	memcpy(counter, nonce_response, CTR_NONCE_SIZE);
+	uint8_t stream_block[16];
+	int stream_offset = 0;
+
+	// The length field is part of the HMAC, so it goes in first
+	//
+	uint8_t* ciphertext_start = nonce_response_start + CTR_NONCE_SIZE;
+	uint8_t* hmac_start = ciphertext_start + payload_length;
+	uint16_t lengthField = (hmac_start + 20 - encrypted_response_transmission) | (FRAME_VERSION_CTR << 12);
+	memcpy(encrypted_response_transmission, &lengthField, 2);
+
+	// Encrypt straight into the transmission, and HMAC each chunk of ciphertext as soon as it is written
+	//
+	aes_context aes;
+	aes_setkey_enc(&aes, (uint8_t*) key, 128);
+
+	sha1_context hmac_context;
+	sha1_hmac_starts(&hmac_context, (uint8_t*) key, keyLength);
+	sha1_hmac_update(&hmac_context, encrypted_response_transmission, ciphertext_start - encrypted_response_transmission);
+
+	TRACE_BEGIN(AES_CTR);
+	for ( int offset = 0; offset < payload_length; offset += CTR_CHUNK_SIZE ) {
+		int chunk = payload_length - offset < CTR_CHUNK_SIZE ? payload_length - offset : CTR_CHUNK_SIZE;
+		aes_crypt_ctr(&aes, chunk, &stream_offset, counter, stream_block, response_payload + offset, ciphertext_start + offset);
+		sha1_hmac_update(&hmac_context, ciphertext_start + offset, chunk);
+	}
+	TRACE_END(AES_CTR, payload_length);
+
+	sha1_hmac_finish(&hmac_context, hmac_start);
+
+	uint8_t* end_of_data = hmac_start + 20;
+	TRACE_END(ENCRYPT, end_of_data - encrypted_response_transmission);
 	return end_of_data - encrypted_response_transmission;
 }
 
@@ -296,22 +539,60 @@ void SecureChannelServer::reset_transmission_state() {
 	memset(receive_buffer, 0, MAX_TRANSMISSION_SIZE);
 	memset(send_buffer, 0, MAX_TRANSMISSION_SIZE);
 	transmissionLength = 0;
+	receivedLength = 0;
+	transmissionTimer.stop();
 	msgState = NEED_TRANSMISSION_LENGTH;
+
+	commChannel->transmissionDone();
 }
 
 void SecureChannelServer::invalidateConversationTokenIfExpired() {
-	if ( conversationTimer.isRunning() && conversationTimer.isElapsed() ) {
-//		debug("Invalidating Conversation.\n");
-		memset(conversationToken, 0, 20);
-		conversationTokenValid = false;
+	for ( int i = 0; i < MAX_CONVERSATIONS; i++ ) {
+		Conversation& conversation = conversations[i];
+		if ( conversation.timer.isRunning() && conversation.timer.isElapsed() ) {
+//			debug("Invalidating Conversation.\n");
+			memset(conversation.token, 0, 20);
+			conversation.valid = false;
+		}
 	}
 }
 
+Conversation* SecureChannelServer::findConversation(uint64_t peer) {
+	for ( int i = 0; i < MAX_CONVERSATIONS; i++ ) {
+		if ( conversations[i].valid && conversations[i].peer == peer ) {
+			return &conversations[i];
+		}
+	}
+
+	return NULL;
+}
+
+Conversation* SecureChannelServer::allocateConversation(uint64_t peer) {
+	Conversation* conversation = findConversation(peer);
+
+	for ( int i = 0; conversation == NULL && i < MAX_CONVERSATIONS; i++ ) {
+		if ( !conversations[i].valid ) {
+			conversation = &conversations[i];
+		}
+	}
+
+	if ( conversation == NULL ) {
+		// Everyone is busy. Conversations are started in turn, so the next slot holds the oldest one.
+		//
+		conversation = &conversations[nextConversationSlot];
+		nextConversationSlot = (nextConversationSlot + 1) % MAX_CONVERSATIONS;
+	}
+
+	conversation->peer = peer;
+	return conversation;
+}
+
 bool SecureChannelServer::isConversationValid(uint8_t received_conv_token[]) {
 	bool valid = false;
 
-	if ( conversationTokenValid && conversationTimer.isRunning() && !conversationTimer.isElapsed() ) {
-		if ( memcmp(conversationToken, received_conv_token, 20) == 0 ) {
+	Conversation* conversation = findConversation(commChannel->peer());
+	if ( conversation != NULL && conversation->timer.isRunning() && !conversation->timer.isElapsed() ) {
+		if ( memcmp(conversation->token, received_conv_token, 20) == 0 ) {
 			valid = true;
 		}
 	}
@@ -320,12 +601,17 @@ bool SecureChannelServer::isConversationValid(uint8_t received_conv_token[]) {
 }
 
 int SecureChannelServer::processReceivedTransmission(uint8_t received_data[], uint8_t response_data[]) {
+	TRACE_BEGIN(REQUEST);
+
 	uint8_t decrypted_payload[MAX_TRANSMISSION_SIZE] = {0};
+	int frameVersion = FRAME_VERSION(received_data[1] << 8);
 	int decryptedPayloadLength = decryptTransmission(received_data, decrypted_payload);
 
 	unsigned char* responsePayloadBytes;
 	int responsePayloadLength = 0; // The length of the response payload
 	String messageConsumerResponse; // Used to hold the response payload memory from SecureMessageConsumer
+	uint8_t binaryResponse[MAX_RESPONSE_PAYLOAD_SIZE]; // Used to hold binary responses from SecureMessageConsumer
+	uint32_t challenge[4]; // Used to hold the challenge nonce until it is sent
 
 	int responseTransmissionLength = 0; // Total encoded response transmission length
 
@@ -336,24 +622,26 @@ int SecureChannelServer::processReceivedTransmission(uint8_t received_data[], ui
 		if ( memcmp(decrypted_payload, "NEED_CHALLENGE", decryptedPayloadLength) == 0 ) {
 			// Generate a challenge nonce
 			//
-			debug("Generating Conversation Token...");
-			uint32_t challenge[4];
+			debug(LOG_STR("Generating Conversation Token..."));
 			SparkRandomNumberGenerator::getInstance().generateRandomChallengeNonce(challenge);
 			responsePayloadBytes = (unsigned char*) challenge;
 			responsePayloadLength = 16;
 
 			// Calculate Conversation Token based on generated challenge
 			//
+			Conversation* conversation = allocateConversation(commChannel->peer());
+			TRACE_BEGIN(SHA1_HMAC);
 			sha1_hmac(	(uint8_t*) MASTER_KEY, sizeof(MASTER_KEY),
 						responsePayloadBytes, responsePayloadLength,
-						conversationToken);
+						conversation->token);
+			TRACE_END(SHA1_HMAC, responsePayloadLength);
 
 			// Start Conversation Timer
 			//
-			conversationTimer.start();
-			conversationTokenValid = true;
+			conversation->timer.start();
+			conversation->valid = true;
 
-	//		debug(conversationToken, 20);
+	//		debug(conversation->token, 20);
 		}
 		else {
 			// Any other message must contain a Conversation Token prepended to the message in the payload
@@ -366,13 +654,36 @@ int SecureChannelServer::processReceivedTransmission(uint8_t received_data[], ui
 			if ( isConversationValid(decrypted_payload) ) {
 //				debug(" OK");
 
-				// Pass the message to the consumer
+				// GET_STATS and GET_TRACE are answered here. Anything else goes to the consumer, and binary responses take precedence.
 				//
-				messageConsumerResponse = msgConsumer->processMessage((const char*)(decrypted_payload+20));
-				debug("Consumer answered: ", 0); debug(messageConsumerResponse);
-
-				responsePayloadBytes = (unsigned char*)messageConsumerResponse.c_str();
-				responsePayloadLength = messageConsumerResponse.length();
+				uint32_t startCycles = Statistics::cycles();
+				String message((const char*)(decrypted_payload+20));
+				int binaryResponseLength;
+				if ( message == "GET_STATS" ) {
+					binaryResponseLength = Statistics::getInstance().serialize(binaryResponse, MAX_RESPONSE_PAYLOAD_SIZE);
+				}
+				else if ( message == "GET_TRACE" ) {
+					binaryResponseLength = Trace::getInstance().drain(binaryResponse, MAX_RESPONSE_PAYLOAD_SIZE);
+				}
+				else {
+					binaryResponseLength = msgConsumer->processBinaryMessage(message, binaryResponse, MAX_RESPONSE_PAYLOAD_SIZE);
+				}
+
+				if ( binaryResponseLength >= 0 ) {
+					debug(LOG_STR("Consumer answered with "), 0); debug(binaryResponseLength, 0); debug(LOG_STR(" bytes"));
+
+					responsePayloadBytes = binaryResponse;
+					responsePayloadLength = binaryResponseLength;
+				}
+				else {
+					messageConsumerResponse = msgConsumer->processMessage(message);
+					debug(LOG_STR("Consumer answered: "), 0); debug(messageConsumerResponse);
+
+					responsePayloadBytes = (unsigned char*)messageConsumerResponse.c_str();
+					responsePayloadLength = messageConsumerResponse.length();
+				}
+
+				Statistics::getInstance().recordLatency(Statistics::CONSUMER, Statistics::cycles() - startCycles);
 			}
 			else {
 //			debug(" FAILED");
@@ -381,16 +692,21 @@ int SecureChannelServer::processReceivedTransmission(uint8_t received_data[], ui
 				//
 				responsePayloadBytes = (unsigned char*) "SESSION_EXPIRED";
 				responsePayloadLength = strlen((const char*)responsePayloadBytes);
-				debug("Answering: ", 0); debug((const char*)responsePayloadBytes);
+				debug(LOG_STR("Answering: "), 0); debug((const char*)responsePayloadBytes);
+
+				Statistics::getInstance().count(Statistics::SESSION_EXPIRED);
 			}
 		}
 
 
 		if ( responsePayloadLength > 2 ) {
-			responseTransmissionLength = encryptResponsePayload(responsePayloadBytes, responsePayloadLength, response_data);
+			uint32_t startCycles = Statistics::cycles();
+			responseTransmissionLength = encryptResponsePayload(responsePayloadBytes, responsePayloadLength, response_data, frameVersion);
+			Statistics::getInstance().recordLatency(Statistics::ENCRYPT, Statistics::cycles() - startCycles);
 		}
 	}
 
+	TRACE_END(REQUEST, responseTransmissionLength);
 	return responseTransmissionLength;
 
 }
@@ -398,15 +714,37 @@ int SecureChannelServer::processReceivedTransmission(uint8_t received_data[], ui
 void SecureChannelServer::loop() {
 	invalidateConversationTokenIfExpired();
 
+	// A transmission may arrive over several reads, but not slower than TRANSMISSION_TIMEOUT
+	//
+	if ( receivedLength > 0 && transmissionTimer.isElapsed() ) {
+		LOG_WARN(LOG_STR("Timed out receiving transmission"));
+		Statistics::getInstance().count(Statistics::FRAMES_TIMED_OUT);
+		reset_transmission_state();
+	}
+
 	if ( msgState == NEED_TRANSMISSION_LENGTH ) {
-		uint8_t transmissionLengthBuffer[2] = {0};
-		int bytesRead = commChannel->read(transmissionLengthBuffer, 2);
+		int bytesRead = commChannel->read(receive_buffer + receivedLength, 2 - receivedLength);
 
+		if ( bytesRead > 0 && receivedLength == 0 ) {
+			transmissionStartCycles = Statistics::cycles();
+			transmissionTimer.start();
+		}
 		if ( bytesRead > 0 ) {
-			memcpy(&transmissionLength, transmissionLengthBuffer, 2);
+			receivedLength += bytesRead;
+		}
+
+		if ( receivedLength == 2 ) {
+			memcpy(&transmissionLength, receive_buffer, 2);
 
-			if ( transmissionLength > 0 && transmissionLength < MAX_TRANSMISSION_SIZE ) {
-				memcpy(receive_buffer, transmissionLengthBuffer, 2);
+			// Keep only the length, the version is read back from receive_buffer
+			//
+#ifdef CTR_FRAMES
+			if ( FRAME_VERSION(transmissionLength) == FRAME_VERSION_CTR ) {
+				transmissionLength = FRAME_LENGTH(transmissionLength);
+			}
+#endif
+
+			if ( transmissionLength > 2 && transmissionLength < MAX_TRANSMISSION_SIZE ) {
 				msgState = RECEIVING_TRANSMISSION;
 			}
 			else {
@@ -418,17 +756,26 @@ void SecureChannelServer::loop() {
 
 	}
 	else if (msgState == RECEIVING_TRANSMISSION) {
-		int bytesRead = commChannel->read(receive_buffer + 2, transmissionLength - 2);
-		if ( bytesRead == (transmissionLength - 2) ) {
+		int bytesRead = commChannel->read(receive_buffer + receivedLength, transmissionLength - receivedLength);
+		if ( bytesRead > 0 ) {
+			receivedLength += bytesRead;
+		}
+
+		if ( receivedLength == transmissionLength ) {
+			Statistics::getInstance().recordLatency(Statistics::FRAME_RECEIVE, Statistics::cycles() - transmissionStartCycles);
+			Statistics::getInstance().count(Statistics::FRAMES_RECEIVED);
+
 			int response_length = processReceivedTransmission(receive_buffer, send_buffer);
 
 			if ( response_length > 0 ) {
 //				debug("Sending ", 0); debug(response_length, 0); debug(" bytes to client...\n");
+				uint32_t startCycles = Statistics::cycles();
 				commChannel->write(send_buffer, response_length);
+				Statistics::getInstance().recordLatency(Statistics::WRITE, Statistics::cycles() - startCycles);
 			}
-		}
 
-		reset_transmission_state();
+			reset_transmission_state();
+		}
 	}
 }
 
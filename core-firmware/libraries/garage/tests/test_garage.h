@@ -9,8 +9,8 @@
 #define LIBRARIES_GARAGE_TESTS_TEST_GARAGE_H_
 
 
-#include <SparkRandomNumberGenerator.h>
-#include <SparkSecureChannelServer.h>
+#include <spark_secure_channel/SparkRandomNumberGenerator.h>
+#include <spark_secure_channel/SparkSecureChannelServer.h>
 #include "utils.h"
 #include "master_key.h"
 #include "Garage.h"
@@ -77,6 +77,45 @@ int android_request(char* command, uint8_t send_data[]) {
 	return end_of_data - send_data;
 }
 
+/**
+ * Puts together a version 1 transmission:
+ *
+ * 		<Message_Length[2] | 1 << 12, Nonce_Send[12], AES_CTR(Key, Nonce_Send || Counter[4], COMMAND), <==== HMAC(Key)[20]>
+ */
+int android_ctr_request(char* command, uint8_t send_data[]) {
+	uint32_t nonce_send[4]; SparkRandomNumberGenerator::getInstance().generateRandomChallengeNonce(nonce_send);
+
+	debug("Sending: ", false); debug(command);
+
+	uint8_t* nonce_send_start = send_data + 2;
+	memcpy(nonce_send_start, nonce_send, CTR_NONCE_SIZE); // Add Nonce_Send[12]
+
+	// No padding, the ciphertext is as long as the command
+	//
+	int msg_length = strlen(command);
+	uint8_t* ciphertext_start = nonce_send_start + CTR_NONCE_SIZE;
+	uint8_t* hmac_start = ciphertext_start + msg_length;
+	uint16_t lengthField = (hmac_start + 20 - send_data) | (FRAME_VERSION_CTR << 12);
+	memcpy(send_data, &lengthField, 2);
+
+	uint8_t counter[16] = {0};
+	memcpy(counter, nonce_send, CTR_NONCE_SIZE);
+	uint8_t stream_block[16];
+	int stream_offset = 0;
+
+	aes_context aes;
+	aes_setkey_enc(&aes, (uint8_t*) MASTER_KEY, 128);
+	aes_crypt_ctr(&aes, msg_length, &stream_offset, counter, stream_block, (uint8_t*) command, ciphertext_start);
+
+	// Calculate HMAC(Key) of all data in send_data so far, and append it
+	//
+	sha1_hmac(	(uint8_t*) MASTER_KEY, sizeof(MASTER_KEY),
+				send_data, hmac_start - send_data,
+				hmac_start);
+
+	return hmac_start + 20 - send_data;
+}
+
 String decrypt_spark_data(uint8_t received_data[]) {
 
 	// Get the length of this data
@@ -134,6 +173,7 @@ class TestCommunicationChannel : public CommunicationChannel {
 public:
 	TestCommunicationChannel(uint8_t* data) {
 		test_data = data;
+		bytes_written = 0;
 	}
 
 	void open() {}
@@ -148,9 +188,12 @@ public:
 	size_t write(const uint8_t *buffer, size_t size) {
 		debug("Sending to Android: ", 0);
 		debug(buffer, size);
+		bytes_written += size;
 		return size;
 	}
 
+	size_t bytes_written;
+
 private:
 	uint8_t* test_data;
 };
@@ -166,7 +209,10 @@ public:
 };
 
 
-void test_android_to_spark(String commandFromAndroid) {
+/**
+ * @return true if the Spark answered
+ */
+bool test_android_to_spark(String commandFromAndroid) {
 	uint8_t send_data[180];
 	TestCommunicationChannel fakeCommChannel(send_data);
 	TestMessageConsumer fakeConsumer;
@@ -178,6 +224,58 @@ void test_android_to_spark(String commandFromAndroid) {
 	secureChannel.loop();
 	secureChannel.loop();
 
+	return fakeCommChannel.bytes_written > 0;
+}
+
+/**
+ * @return true if the Spark answered
+ */
+bool test_android_to_spark_ctr(String commandFromAndroid) {
+	uint8_t send_data[180];
+	TestCommunicationChannel fakeCommChannel(send_data);
+	TestMessageConsumer fakeConsumer;
+	SecureChannelServer secureChannel(&fakeCommChannel, &fakeConsumer, 5000);
+
+	int data_length = android_ctr_request((char*)commandFromAndroid.c_str(), send_data);
+	debug("Sent bytes: ", false); debug(data_length);
+
+	secureChannel.loop();
+	secureChannel.loop();
+
+	return fakeCommChannel.bytes_written > 0;
+}
+
+/**
+ * Flips one bit of the ciphertext in a version 1 request, which must then fail the HMAC check
+ *
+ * @return true if the Spark ignored the request
+ */
+bool test_android_to_spark_ctr_tampered(String commandFromAndroid) {
+	uint8_t send_data[180];
+	TestCommunicationChannel fakeCommChannel(send_data);
+	TestMessageConsumer fakeConsumer;
+	SecureChannelServer secureChannel(&fakeCommChannel, &fakeConsumer, 5000);
+
+	android_ctr_request((char*)commandFromAndroid.c_str(), send_data);
+	send_data[2 + CTR_NONCE_SIZE] ^= 1;
+
+	secureChannel.loop();
+	secureChannel.loop();
+
+	return fakeCommChannel.bytes_written == 0;
+}
+
+void report_test_result(const char* testName, bool passed) {
+	debug(passed ? "PASS: " : "FAIL: ", false); debug(testName);
+}
+
+/**
+ * Runs all of the above. Called from setup() when GARAGE_TESTS is defined in application.cpp
+ */
+void run_garage_tests() {
+	report_test_result("v0 challenge request is answered", test_android_to_spark("NEED_CHALLENGE"));
+	report_test_result("v1 challenge request is answered", test_android_to_spark_ctr("NEED_CHALLENGE"));
+	report_test_result("v1 request with a tampered ciphertext is ignored", test_android_to_spark_ctr_tampered("NEED_CHALLENGE"));
 }
 
 void test_spark_to_android(String responseFromSpark) {
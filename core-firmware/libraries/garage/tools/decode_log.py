@@ -0,0 +1,126 @@
+#!/usr/bin/env python
+"""
+Decodes the binary log stream written over USB Serial by firmware built with LOG_TOKENIZED=y.
+
+The string table is read from the .log_tokens section of the firmware ELF, so the ELF must come
+from the same build that is running on the core.
+
+Usage:
+    decode_log.py core-firmware.elf --table          Print the generated string table
+    decode_log.py core-firmware.elf capture.bin      Decode a raw capture of the serial port
+    decode_log.py core-firmware.elf /dev/ttyACM0     Decode live
+
+@author Val Blant
+"""
+
+import struct
+import sys
+
+# Must match Log::RecordType and the binary record header in Log.h
+RECORD_MARKER = 0xA0
+NEW_LINE_FLAG = 0x08
+INTEGER, TEXT, BYTES, TOKEN, DROPPED = 1, 2, 3, 4, 5
+
+
+def read_token_section(elf_path):
+    with open(elf_path, "rb") as f:
+        elf = f.read()
+
+    if elf[:4] != b"\x7fELF":
+        raise ValueError("%s is not an ELF file" % elf_path)
+
+    is64 = elf[4] == 2 if isinstance(elf[4], int) else ord(elf[4]) == 2
+    endian = "<" if (elf[5] if isinstance(elf[5], int) else ord(elf[5])) == 1 else ">"
+
+    if is64:
+        shoff, = struct.unpack_from(endian + "Q", elf, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", elf, 0x3A)
+        header = endian + "IIQQQQIIQQ"
+    else:
+        shoff, = struct.unpack_from(endian + "I", elf, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", elf, 0x2E)
+        header = endian + "IIIIIIIIII"
+
+    sections = [struct.unpack_from(header, elf, shoff + i * shentsize) for i in range(shnum)]
+    names_offset = sections[shstrndx][4]
+
+    for name, _, _, _, offset, size, _, _, _, _ in sections:
+        end = elf.index(b"\0", names_offset + name)
+        if elf[names_offset + name:end] == b".log_tokens":
+            return elf[offset:offset + size]
+
+    raise ValueError("%s has no .log_tokens section. Was it built with LOG_TOKENIZED=y?" % elf_path)
+
+
+def lookup(table, token):
+    end = table.find(b"\0", token)
+    return table[token:end].decode("ascii", "replace") if end >= 0 else "<bad token %d>" % token
+
+
+def string_table(table):
+    token = 0
+    while token < len(table):
+        text = lookup(table, token)
+        yield token, text
+        token += len(text) + 1
+
+
+def read_varint(stream):
+    shift, value = 0, 0
+    while True:
+        byte = ord(stream.read(1))
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if byte < 0x80:
+            return (value >> 1) ^ -(value & 1)  # Undo zigzag
+
+
+def decode(table, stream, out):
+    while True:
+        header = stream.read(1)
+        if not header:
+            return
+
+        header = ord(header)
+        if header & 0xF0 != RECORD_MARKER:
+            continue  # Resynchronize on the next record marker
+
+        record_type = header & 0x07
+        if record_type == TOKEN:
+            token, = struct.unpack("<H", stream.read(2))
+            out.write(lookup(table, token))
+        elif record_type == INTEGER:
+            out.write(str(read_varint(stream)))
+        elif record_type == TEXT:
+            length = ord(stream.read(1))
+            out.write(stream.read(length).decode("ascii", "replace"))
+        elif record_type == BYTES:
+            length = ord(stream.read(1))
+            data = struct.unpack("%db" % length, stream.read(length))
+            out.write("{" + ", ".join(str(b) for b in data) + "}")
+        elif record_type == DROPPED:
+            out.write("[Log dropped %d records]" % read_varint(stream))
+
+        if header & NEW_LINE_FLAG:
+            out.write("\n")
+        out.flush()
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write(__doc__)
+        return 1
+
+    table = read_token_section(argv[1])
+
+    if argv[2] == "--table":
+        for token, text in string_table(table):
+            print("%5d  %r" % (token, text))
+    else:
+        with open(argv[2], "rb") as stream:
+            decode(table, stream, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
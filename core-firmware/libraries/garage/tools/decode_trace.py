@@ -0,0 +1,96 @@
+#!/usr/bin/env python
+"""
+Decodes Garage Opener trace points into per-stage timings.
+
+Accepts either the text dump printed over USB Serial (lines of "TRACE,<cycles>,<event>,<arg>"),
+or the raw payloads of one or more GET_TRACE responses concatenated into a binary file.
+
+Usage:
+    decode_trace.py serial_log.txt
+    decode_trace.py --binary get_trace_responses.bin
+
+@author Val Blant
+"""
+
+import struct
+import sys
+
+# Must match TraceStage in Trace.h
+STAGES = ["REQUEST", "DECRYPT", "ENCRYPT", "SHA1_HMAC", "AES_CBC", "TCP_READ", "TCP_WRITE", "AES_CTR"]
+
+DEFAULT_CORE_MHZ = 72
+
+
+def read_text(path):
+    entries, lost = [], 0
+    with open(path) as f:
+        for line in f:
+            fields = line.strip().split(",")
+            if fields[0] == "TRACE" and len(fields) == 4:
+                entries.append((int(fields[1]), int(fields[2]), int(fields[3])))
+            elif fields[0] == "TRACE_LOST" and len(fields) == 2:
+                lost += int(fields[1])
+    return entries, lost, DEFAULT_CORE_MHZ
+
+
+def read_binary(path):
+    entries, lost, mhz = [], 0, DEFAULT_CORE_MHZ
+    with open(path, "rb") as f:
+        data = f.read()
+
+    # [Count[1], Lost[1], CoreMHz[1], Reserved[1], TraceEntry[Count]]
+    offset = 0
+    while offset + 4 <= len(data):
+        count, chunk_lost, mhz = struct.unpack_from("<BBB", data, offset)
+        lost += chunk_lost
+        offset += 4
+        for _ in range(count):
+            entries.append(struct.unpack_from("<IHH", data, offset))
+            offset += 8
+    return entries, lost, mhz
+
+
+def decode(entries, mhz):
+    open_stages = {}
+    timings = dict((name, []) for name in STAGES)
+
+    for cycles, event, arg in entries:
+        stage, is_end = event >> 1, event & 1
+        name = STAGES[stage] if stage < len(STAGES) else "STAGE_%d" % stage
+
+        if not is_end:
+            open_stages.setdefault(name, []).append(cycles)
+        elif open_stages.get(name):
+            start = open_stages[name].pop()
+            elapsed = (cycles - start) & 0xFFFFFFFF  # DWT_CYCCNT wraps every ~60s
+            timings.setdefault(name, []).append((elapsed / float(mhz), arg))
+            print("%-10s %10.1f us  arg=%d" % (name, elapsed / float(mhz), arg))
+
+    return timings
+
+
+def main(argv):
+    if len(argv) == 3 and argv[1] == "--binary":
+        entries, lost, mhz = read_binary(argv[2])
+    elif len(argv) == 2:
+        entries, lost, mhz = read_text(argv[1])
+    else:
+        sys.stderr.write(__doc__)
+        return 1
+
+    timings = decode(entries, mhz)
+
+    print("")
+    print("%-10s %6s %10s %10s %10s" % ("STAGE", "COUNT", "MIN us", "AVG us", "MAX us"))
+    for name in STAGES:
+        samples = [t for t, _ in timings[name]]
+        if samples:
+            print("%-10s %6d %10.1f %10.1f %10.1f" % (name, len(samples), min(samples),
+                                                     sum(samples) / len(samples), max(samples)))
+    if lost:
+        print("\n%d entries were overwritten before they could be read" % lost)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
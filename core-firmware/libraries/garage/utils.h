@@ -7,50 +7,65 @@
 #ifndef LIBRARIES_GARAGE_UTILS_H_
 #define LIBRARIES_GARAGE_UTILS_H_
 
-void debug(const uint8_t *buffer, size_t size) {
-	Serial.print("{");
-	for ( int i = 0; i < size - 1; i++ ) {
-		Serial.print((signed char) buffer[i]); Serial.print(", ");
-	}
+#include "Log.h"
+
+/**
+ * Log levels. Calls above LOG_LEVEL (see Log.h) compile to nothing.
+ *
+ * All of these only queue the message. It is printed later, when the main loop calls drain_log().
+ */
+#define LOG_ERROR(...)	do { if ( LOG_LEVEL >= LOG_LEVEL_ERROR ) log_write(__VA_ARGS__); } while (0)
+#define LOG_WARN(...)	do { if ( LOG_LEVEL >= LOG_LEVEL_WARN ) log_write(__VA_ARGS__); } while (0)
+#define LOG_INFO(...)	do { if ( LOG_LEVEL >= LOG_LEVEL_INFO ) log_write(__VA_ARGS__); } while (0)
+
+void log_write(const uint8_t *buffer, size_t size) {
+	Log::getInstance().appendBytes(buffer, size);
+}
+
+void log_write(const char c[], bool new_line = true) {
+	Log::getInstance().appendText(c, new_line);
+}
+
+void log_write(const Printable& x, bool new_line = true) {
+	Log::getInstance().appendPrintable(x, new_line);
+}
 
-	Serial.print((signed char) buffer[size - 1]);
-	Serial.println("}");
+void log_write(const int num, bool new_line = true) {
+	Log::getInstance().appendInt(num, new_line);
+}
+
+void log_write(const String &s, bool new_line = true) {
+	Log::getInstance().appendText(s.c_str(), s.length(), new_line);
+}
+
+/**
+ * Debug level logging
+ */
+void debug(const uint8_t *buffer, size_t size) {
+	if ( LOG_LEVEL >= LOG_LEVEL_DEBUG ) log_write(buffer, size);
 }
 
 void debug(const char c[], bool new_line = true) {
-	if ( new_line ) {
-		Serial.println(c);
-	}
-	else {
-		Serial.print(c);
-	}
+	if ( LOG_LEVEL >= LOG_LEVEL_DEBUG ) log_write(c, new_line);
 }
 
 void debug(const Printable& x, bool new_line = true) {
-	if ( new_line ) {
-		Serial.println(x);
-	}
-	else {
-		Serial.print(x);
-	}
+	if ( LOG_LEVEL >= LOG_LEVEL_DEBUG ) log_write(x, new_line);
 }
 
 void debug(const int num, bool new_line = true) {
-	if ( new_line ) {
-		Serial.println(num);
-	}
-	else {
-		Serial.print(num);
-	}
+	if ( LOG_LEVEL >= LOG_LEVEL_DEBUG ) log_write(num, new_line);
 }
 
 void debug(const String &s, bool new_line = true) {
-	if ( new_line ) {
-		Serial.println(s);
-	}
-	else {
-		Serial.print(s);
-	}
+	if ( LOG_LEVEL >= LOG_LEVEL_DEBUG ) log_write(s, new_line);
+}
+
+/**
+ * Prints some of the queued log messages to Serial. Call this whenever there is nothing better to do.
+ */
+void drain_log() {
+	Log::getInstance().drain(Serial);
 }
 
 void init_serial_over_usb() {
@@ -65,7 +80,7 @@ void init_serial_over_usb() {
 //	while (!Serial.available())
 //		SPARK_WLAN_Loop();
 
-	debug("Serial over USB ready to go.");
+	debug(LOG_STR("Serial over USB ready to go."));
 }
 
 
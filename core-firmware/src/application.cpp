@@ -8,9 +8,20 @@
 
 #include "utils.h"
 #include "Garage.h"
+#include "DoorHistory.h"
+#include "StatusBeacon.h"
+#include "Trace.h"
 
 #include <spark_secure_channel/SparkSecureChannelServer.h>
 #include <spark_network/WiFiCommunicationChannel.h>
+#include <spark_network/UdpCommunicationChannel.h>
+#include <spark_network/MdnsResponder.h>
+
+//#define GARAGE_TESTS	// Uncomment to run the secure channel tests in tests/test_garage.h from setup()
+
+#ifdef GARAGE_TESTS
+#include "tests/test_garage.h"
+#endif
 
 
 // Do not connect to Spark Cloud
@@ -18,20 +29,41 @@ SYSTEM_MODE(MANUAL);
 
 
 /**
- * The channel will listen on port 6666, and ping gatekeeper every 60 seconds in order to detect disconnects
+ * The channel will listen on port 6666, and ping gatekeeper if it sees no traffic for 60 seconds in order to detect disconnects
  */
 IPAddress gatekeeper(192, 168, 0, 10);
 WiFiCommunicationChannel wifiCommChannel(6666, 60000, gatekeeper);
 
+/**
+ * The same transmissions are also accepted as single UDP datagrams on port 6666, once wifiCommChannel has WiFi up
+ */
+UdpCommunicationChannel udpCommChannel(6666);
+
+/**
+ * Lets clients find us as garage.local, or by browsing for _garage._tcp services, whatever our DHCP address is
+ */
+MdnsResponder mdnsResponder("garage", "_garage", 6666);
+
+/**
+ * Persistent log of door events, stored in External Flash
+ */
+DoorHistory doorHistory;
+
 /**
  * Garage hardware controller. This is the Message Consumer for the secure channel
  */
-Garage garage;
+Garage garage(&doorHistory);
 
 /**
  * Manages the encryption of all data going in and out.
  */
 SecureChannelServer secureChannel(&wifiCommChannel, &garage, 5000); // Conversations are valid for 5 seconds.
+SecureChannelServer udpSecureChannel(&udpCommChannel, &garage, 5000);
+
+/**
+ * Broadcasts the door state to port 6667 on every change, and every 30 seconds otherwise
+ */
+StatusBeacon statusBeacon(&udpCommChannel, &garage, 6667, 30000);
 
 
 
@@ -39,7 +71,15 @@ SecureChannelServer secureChannel(&wifiCommChannel, &garage, 5000); // Conversat
 void setup() {
 	init_serial_over_usb();
 
-	wifiCommChannel.open(); // Blocks trying to get a WiFi connection. Times out if unsuccessful.
+#ifdef GARAGE_TESTS
+	run_garage_tests();
+#endif
+
+	doorHistory.begin();
+	doorHistory.log(DoorEvent::BOOT, DoorEvent::SOURCE_DEVICE);
+
+	wifiCommChannel.open(); // Starts connecting to WiFi. The connection is brought up from loop().
+	udpCommChannel.open();
 }
 
 
@@ -48,4 +88,18 @@ void setup() {
  */
 void loop() {
 	secureChannel.loop();
+	udpSecureChannel.loop();
+	mdnsResponder.loop();
+
+	garage.loop();
+	statusBeacon.loop();
+	doorHistory.loop(); // Flash writes happen here, between requests
+
+	drain_log(); // Log messages are printed here, so Serial never slows down a request
+
+	// Press 't' in the serial console to dump the trace buffer
+	//
+	if ( Serial.available() && Serial.read() == 't' ) {
+		Trace::getInstance().dump(Serial);
+	}
 }
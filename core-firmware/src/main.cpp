@@ -30,6 +30,8 @@
 #include "main.h"
 #include "debug.h"
 #include "spark_utilities.h"
+#include "ring_buffer.h"
+#include "spark_wiring_tcpclient.h"
 extern "C" {
 #include "usb_conf.h"
 #include "usb_lib.h"
@@ -54,8 +56,7 @@ uint32_t USART_Rx_ptr_out = 0;
 uint32_t USART_Rx_length  = 0;
 
 uint8_t USB_Rx_Buffer[VIRTUAL_COM_PORT_DATA_SIZE];
-uint16_t USB_Rx_length = 0;
-uint16_t USB_Rx_ptr = 0;
+RingBuffer<USB_RX_RING_SIZE> USB_Rx_Ring;
 
 uint8_t  USB_Tx_State = 0;
 uint8_t  USB_Rx_State = 0;
@@ -202,6 +203,9 @@ int main(void)
 					loop();
                                         DECLARE_SYS_HEALTH(RAN_Loop);
 				}
+
+				//Send TCP output the application left queued
+				TCPClient::sendPendingIfDue();
 #ifdef SPARK_WLAN_ENABLE
 			}
 		}
@@ -349,10 +353,7 @@ uint8_t USB_USART_Available_Data(void)
 {
 	if(bDeviceState == CONFIGURED)
 	{
-		if(USB_Rx_State == 1)
-		{
-			return (USB_Rx_length - USB_Rx_ptr);
-		}
+		return USB_Rx_Ring.size();
 	}
 
 	return 0;
@@ -368,18 +369,18 @@ int32_t USB_USART_Receive_Data(void)
 {
 	if(bDeviceState == CONFIGURED)
 	{
-		if(USB_Rx_State == 1)
-		{
-			if((USB_Rx_length - USB_Rx_ptr) == 1)
-			{
-				USB_Rx_State = 0;
+		int32_t data = USB_Rx_Ring.get();
 
-				/* Enable the receive of data on EP3 */
-				SetEPRxValid(ENDP3);
-			}
+		/* EP3 was left NAKing when the ring filled up. Resume once a packet fits. */
+		if(USB_Rx_State == 1 && USB_Rx_Ring.space() >= VIRTUAL_COM_PORT_DATA_SIZE)
+		{
+			USB_Rx_State = 0;
 
-			return USB_Rx_Buffer[USB_Rx_ptr++];
+			/* Enable the receive of data on EP3 */
+			SetEPRxValid(ENDP3);
 		}
+
+		return data;
 	}
 
 	return -1;
@@ -57,6 +57,7 @@ struct User_Var_Lookup_Table_t
 {
 	void *userVar;
 	char userVarKey[USER_VAR_KEY_LENGTH];
+	uint32_t userVarHash;
 	Spark_Data_TypeDef userVarType;
 } User_Var_Lookup_Table[USER_VAR_MAX_COUNT];
 
@@ -64,11 +65,69 @@ struct User_Func_Lookup_Table_t
 {
 	int (*pUserFunc)(String userArg);
 	char userFuncKey[USER_FUNC_KEY_LENGTH];
+	uint32_t userFuncHash;
 	char userFuncArg[USER_FUNC_ARG_LENGTH];
 	int userFuncRet;
 	bool userFuncSchedule;
 } User_Func_Lookup_Table[USER_FUNC_MAX_COUNT];
 
+// Open addressing indexes over the lookup tables, built as handlers are
+// registered, so that a cloud request finds its handler by the hash of its key
+// instead of comparing it against every registered one. A slot holds the table
+// position + 1, or 0 when free. Nothing is ever removed, and there is always a
+// free slot to end a probe, since each index is larger than its table.
+#define USER_VAR_INDEX_SIZE				16	// Power of 2 above USER_VAR_MAX_COUNT
+#define USER_FUNC_INDEX_SIZE			8	// Power of 2 above USER_FUNC_MAX_COUNT
+
+typedef char user_var_index_too_small[(USER_VAR_INDEX_SIZE > USER_VAR_MAX_COUNT) ? 1 : -1];
+typedef char user_func_index_too_small[(USER_FUNC_INDEX_SIZE > USER_FUNC_MAX_COUNT) ? 1 : -1];
+
+static uint8_t User_Var_Index[USER_VAR_INDEX_SIZE];
+static uint8_t User_Func_Index[USER_FUNC_INDEX_SIZE];
+
+// FNV-1a of a key as strncmp() sees it: up to its first NUL, and at most
+// length bytes
+static uint32_t userKeyHash(const char *key, int length)
+{
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < length && key[i]; i++)
+	{
+		hash ^= (uint8_t)key[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Returns the table position of the first variable registered as varKey, or -1
+static int findUserVar(const char *varKey)
+{
+	uint32_t hash = userKeyHash(varKey, USER_VAR_KEY_LENGTH);
+	for (uint32_t slot = hash; ; slot++)
+	{
+		int i = User_Var_Index[slot & (USER_VAR_INDEX_SIZE - 1)] - 1;
+		if (i < 0)
+			return -1;
+		if (User_Var_Lookup_Table[i].userVarHash == hash &&
+			0 == strncmp(User_Var_Lookup_Table[i].userVarKey, varKey, USER_VAR_KEY_LENGTH))
+			return i;
+	}
+}
+
+// Returns the table position of the first function registered as funcKey, or -1
+static int findUserFunc(const char *funcKey)
+{
+	uint32_t hash = userKeyHash(funcKey, USER_FUNC_KEY_LENGTH);
+	for (uint32_t slot = hash; ; slot++)
+	{
+		int i = User_Func_Index[slot & (USER_FUNC_INDEX_SIZE - 1)] - 1;
+		if (i < 0)
+			return -1;
+		if (User_Func_Lookup_Table[i].userFuncHash == hash &&
+			0 == strncmp(User_Func_Lookup_Table[i].userFuncKey, funcKey, USER_FUNC_KEY_LENGTH))
+			return i;
+	}
+}
+
 /*
 static unsigned char uitoa(unsigned int cNum, char *cString);
 static unsigned int atoui(char *cString);
@@ -203,19 +262,26 @@ void SparkClass::variable(const char *varKey, void *userVar, Spark_Data_TypeDef
     if (User_Var_Count == USER_VAR_MAX_COUNT)
       return;
 
-    for (int i = 0; i < User_Var_Count; i++)
+    // Only entries with the same hash can be the same registration, and the
+    // probe ends on the free slot the new one goes into
+    uint32_t hash = userKeyHash(varKey, USER_VAR_KEY_LENGTH);
+    uint32_t slot = hash;
+    for (int i; (i = User_Var_Index[slot & (USER_VAR_INDEX_SIZE - 1)] - 1) >= 0; slot++)
     {
       if (User_Var_Lookup_Table[i].userVar == userVar &&
+          User_Var_Lookup_Table[i].userVarHash == hash &&
           (0 == strncmp(User_Var_Lookup_Table[i].userVarKey, varKey, USER_VAR_KEY_LENGTH)))
       {
         return;
       }
     }
 
+    User_Var_Index[slot & (USER_VAR_INDEX_SIZE - 1)] = User_Var_Count + 1;
+    User_Var_Lookup_Table[User_Var_Count].userVarHash = hash;
     User_Var_Lookup_Table[User_Var_Count].userVar = userVar;
     User_Var_Lookup_Table[User_Var_Count].userVarType = userVarType;
     memset(User_Var_Lookup_Table[User_Var_Count].userVarKey, 0, USER_VAR_KEY_LENGTH);
-    memcpy(User_Var_Lookup_Table[User_Var_Count].userVarKey, varKey, USER_VAR_KEY_LENGTH);
+    strncpy(User_Var_Lookup_Table[User_Var_Count].userVarKey, varKey, USER_VAR_KEY_LENGTH);
     User_Var_Count++;
   }
 }
@@ -228,18 +294,23 @@ void SparkClass::function(const char *funcKey, int (*pFunc)(String paramString))
 		if(User_Func_Count == USER_FUNC_MAX_COUNT)
 			return;
 
-		for(i = 0; i < User_Func_Count; i++)
+		uint32_t hash = userKeyHash(funcKey, USER_FUNC_KEY_LENGTH);
+		uint32_t slot = hash;
+		for(; (i = User_Func_Index[slot & (USER_FUNC_INDEX_SIZE - 1)] - 1) >= 0; slot++)
 		{
-			if(User_Func_Lookup_Table[i].pUserFunc == pFunc && (0 == strncmp(User_Func_Lookup_Table[i].userFuncKey, funcKey, USER_FUNC_KEY_LENGTH)))
+			if(User_Func_Lookup_Table[i].pUserFunc == pFunc && User_Func_Lookup_Table[i].userFuncHash == hash &&
+			   (0 == strncmp(User_Func_Lookup_Table[i].userFuncKey, funcKey, USER_FUNC_KEY_LENGTH)))
 			{
 				return;
 			}
 		}
 
+		User_Func_Index[slot & (USER_FUNC_INDEX_SIZE - 1)] = User_Func_Count + 1;
+		User_Func_Lookup_Table[User_Func_Count].userFuncHash = hash;
 		User_Func_Lookup_Table[User_Func_Count].pUserFunc = pFunc;
 		memset(User_Func_Lookup_Table[User_Func_Count].userFuncArg, 0, USER_FUNC_ARG_LENGTH);
 		memset(User_Func_Lookup_Table[User_Func_Count].userFuncKey, 0, USER_FUNC_KEY_LENGTH);
-		memcpy(User_Func_Lookup_Table[User_Func_Count].userFuncKey, funcKey, USER_FUNC_KEY_LENGTH);
+		strncpy(User_Func_Lookup_Table[User_Func_Count].userFuncKey, funcKey, USER_FUNC_KEY_LENGTH);
 		User_Func_Lookup_Table[User_Func_Count].userFuncSchedule = false;
 		User_Func_Count++;
 	}
@@ -710,6 +781,12 @@ void Spark_Protocol_Init(void)
     FLASH_Read_CorePrivateKey(private_key);
 
     spark_protocol.init((const char *)ID1, keys, callbacks, descriptor);
+
+#if defined (SPARK_SESSION_RESUMPTION)
+    // Only for clouds that answer resume requests; any other one would sit
+    // on the request until the handshake times out
+    spark_protocol.enable_session_resumption(true);
+#endif
   }
 }
 
@@ -957,24 +1034,20 @@ void Spark_ConnectAbort_WLANReset(void)
 
 int userVarType(const char *varKey)
 {
-	for (int i = 0; i < User_Var_Count; ++i)
+	int i = findUserVar(varKey);
+	if (i >= 0)
 	{
-		if (0 == strncmp(User_Var_Lookup_Table[i].userVarKey, varKey, USER_VAR_KEY_LENGTH))
-		{
-			return User_Var_Lookup_Table[i].userVarType;
-		}
+		return User_Var_Lookup_Table[i].userVarType;
 	}
 	return -1;
 }
 
 void *getUserVar(const char *varKey)
 {
-	for (int i = 0; i < User_Var_Count; ++i)
+	int i = findUserVar(varKey);
+	if (i >= 0)
 	{
-		if (0 == strncmp(User_Var_Lookup_Table[i].userVarKey, varKey, USER_VAR_KEY_LENGTH))
-		{
-			return User_Var_Lookup_Table[i].userVar;
-		}
+		return User_Var_Lookup_Table[i].userVar;
 	}
 	return NULL;
 }
@@ -982,19 +1055,16 @@ void *getUserVar(const char *varKey)
 int userFuncSchedule(const char *funcKey, const char *paramString)
 {
 	String pString(paramString);
-	int i = 0;
-	for(i = 0; i < User_Func_Count; i++)
+	int i = findUserFunc(funcKey);
+	if(i >= 0 && NULL != paramString)
 	{
-		if(NULL != paramString && (0 == strncmp(User_Func_Lookup_Table[i].userFuncKey, funcKey, USER_FUNC_KEY_LENGTH)))
-		{
-			size_t paramLength = strlen(paramString);
-			if(paramLength > USER_FUNC_ARG_LENGTH)
-				paramLength = USER_FUNC_ARG_LENGTH;
-			memcpy(User_Func_Lookup_Table[i].userFuncArg, paramString, paramLength);
-			User_Func_Lookup_Table[i].userFuncSchedule = true;
-			//return User_Func_Lookup_Table[i].pUserFunc(User_Func_Lookup_Table[i].userFuncArg);
-			return User_Func_Lookup_Table[i].pUserFunc(pString);
-		}
+		size_t paramLength = strlen(paramString);
+		if(paramLength > USER_FUNC_ARG_LENGTH)
+			paramLength = USER_FUNC_ARG_LENGTH;
+		memcpy(User_Func_Lookup_Table[i].userFuncArg, paramString, paramLength);
+		User_Func_Lookup_Table[i].userFuncSchedule = true;
+		//return User_Func_Lookup_Table[i].pUserFunc(User_Func_Lookup_Table[i].userFuncArg);
+		return User_Func_Lookup_Table[i].pUserFunc(pString);
 	}
 	return -1;
 }
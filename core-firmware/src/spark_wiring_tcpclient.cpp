@@ -29,6 +29,12 @@
 
 uint16_t TCPClient::_srcport = 1024;
 
+long TCPClient::_txSock = MAX_SOCK_NUM;
+uint8_t TCPClient::_txBuffer[TCPCLIENT_TX_BUF_MAX_SIZE];
+uint16_t TCPClient::_txCount = 0;
+system_tick_t TCPClient::_txDeadline = 0;
+long TCPClient::_txFailedSock = MAX_SOCK_NUM;
+
 static bool inline isOpen(long sd)
 {
    return sd != MAX_SOCK_NUM;
@@ -36,12 +42,17 @@ static bool inline isOpen(long sd)
 
 TCPClient::TCPClient() : _sock(MAX_SOCK_NUM)
 {
-  flush();
+  clearReceiveBuffer();
 }
 
-TCPClient::TCPClient(uint8_t sock) : _sock(sock) 
+TCPClient::TCPClient(uint8_t sock) : _sock(sock)
 {
-  flush();
+  // A newly accepted socket may reuse the number of one that failed
+  if (_txFailedSock == _sock)
+  {
+    _txFailedSock = MAX_SOCK_NUM;
+  }
+  clearReceiveBuffer();
 }
 
 int TCPClient::connect(const char* host, uint16_t port) 
@@ -73,7 +84,11 @@ int TCPClient::connect(IPAddress ip, uint16_t port)
 
           if (_sock >= 0)
           {
-            flush();
+            clearReceiveBuffer();
+            if (_txFailedSock == _sock)
+            {
+              _txFailedSock = MAX_SOCK_NUM;
+            }
 
             tSocketAddr.sa_family = AF_INET;
 
@@ -108,28 +123,114 @@ size_t TCPClient::write(uint8_t b)
 
 size_t TCPClient::write(const uint8_t *buffer, size_t size)
 {
-        return status() ? send(_sock, buffer, size, 0) : -1;
+        const uint8_t * const buffers[] = { buffer };
+        const size_t sizes[] = { size };
+        return write(buffers, sizes, 1);
+}
+
+// Queues the 'count' buffers for sending as if they were one. Every send() is a
+// full HCI transaction over SPI, so small writes are coalesced in _txBuffer until
+// it fills up, TCPCLIENT_TX_FLUSH_DELAY passes, or flush() is called. Parts too
+// big for the buffer are sent straight from the caller's memory.
+size_t TCPClient::write(const uint8_t * const buffers[], const size_t sizes[], int count)
+{
+        if (!status() || _txFailedSock == _sock)
+        {
+          return -1;
+        }
+
+        // The queue holds one socket's output at a time
+        if (_txSock != _sock)
+        {
+          sendPending();
+          _txSock = _sock;
+        }
+
+        size_t written = 0;
+        for (int i = 0; i < count; i++)
+        {
+          if (_txCount + sizes[i] > arraySize(_txBuffer))
+          {
+            if (!sendPending())
+            {
+              return -1;
+            }
+
+            if (sizes[i] >= arraySize(_txBuffer))
+            {
+              if (send(_sock, buffers[i], sizes[i], 0) < 0)
+              {
+                return -1;
+              }
+              written += sizes[i];
+              continue;
+            }
+          }
+
+          if (_txCount == 0)
+          {
+            _txDeadline = millis() + TCPCLIENT_TX_FLUSH_DELAY;
+          }
+          memcpy(_txBuffer + _txCount, buffers[i], sizes[i]);
+          _txCount += sizes[i];
+          written += sizes[i];
+        }
+
+        if (_txCount == arraySize(_txBuffer))
+        {
+          sendPending();
+        }
+        else
+        {
+          sendPendingIfDue();
+        }
+
+        return written;
+}
+
+bool TCPClient::sendPending()
+{
+        if (_txCount == 0)
+        {
+          return true;
+        }
+
+        int sent = isOpen(_txSock) ? send(_txSock, _txBuffer, _txCount, 0) : -1;
+        DEBUG("send(%d)=%d", _txCount, sent);
+        _txCount = 0;
+        if (sent < 0)
+        {
+          // write() already reported these bytes as written
+          _txFailedSock = _txSock;
+        }
+        return sent >= 0;
+}
+
+void TCPClient::sendPendingIfDue()
+{
+        if (_txCount && (long)(millis() - _txDeadline) >= 0)
+        {
+          sendPending();
+        }
 }
 
 int TCPClient::bufferCount()
 {
-  return _total - _offset;
+  return _rxBuffer.size();
 }
 
 int TCPClient::available() 
 {
     int avail = 0;
 
-    // At EOB => Flush it
-    if (_total && (_offset == _total))
-    {
-      flush();
-    }
+    sendPendingIfDue();
 
     if(WiFi.ready() && isOpen(_sock))
     {
-        // Have room
-        if ( _total < arraySize(_buffer))
+        // Have room. recv() goes straight into the ring, up to where it wraps.
+        unsigned int room;
+        uint8_t *dst = _rxBuffer.write_span(room);
+        if (room > 0)
         {
           _types_fd_set_cc3000 readSet;
           timeval timeout;
@@ -144,12 +245,11 @@ int TCPClient::available()
           {
               if (FD_ISSET(_sock, &readSet))
               {
-                  int ret = recv(_sock, _buffer + _total , arraySize(_buffer)-_total, 0);
+                  int ret = recv(_sock, dst, room, 0);
                   DEBUG("recv(=%d)",ret);
                   if (ret > 0)
                   {
-                      if (_total == 0) _offset = 0;
-                      _total += ret;
+                      _rxBuffer.commit(ret);
                   }
               }
           } // Select
@@ -162,7 +262,7 @@ int TCPClient::available()
 int TCPClient::read() 
 {
 
-  return (bufferCount() || available()) ? _buffer[_offset++] : -1;
+  return (bufferCount() || available()) ? _rxBuffer.get() : -1;
 }
 
 int TCPClient::read(uint8_t *buffer, size_t size)
@@ -170,28 +270,46 @@ int TCPClient::read(uint8_t *buffer, size_t size)
         int read = -1;
         if (bufferCount() || available())
         {
-          read = (size > (size_t) bufferCount()) ? bufferCount() : size;
-          memcpy(buffer, &_buffer[_offset], read);
-          _offset += read;
+          read = _rxBuffer.pop(buffer, size);
         }
         return read;
 }
 
 int TCPClient::peek() 
 {
-  return  (bufferCount() || available()) ? _buffer[_offset] : -1;
+  return  (bufferCount() || available()) ? _rxBuffer.peek() : -1;
 }
 
+// Sends everything queued by write() right away
 void TCPClient::flush() 
 {
-  _offset = 0;
-  _total = 0;
+  sendQueued();
+}
+
+bool TCPClient::sendQueued()
+{
+  if (_txSock == _sock)
+  {
+    sendPending();
+  }
+  return _txFailedSock != _sock;
+}
+
+void TCPClient::clearReceiveBuffer()
+{
+  _rxBuffer.clear();
 }
 
 void TCPClient::stop() 
 {
   DEBUG("_sock %d closesocket", _sock);
 
+  flush();
+  if (_txFailedSock == _sock)
+  {
+    _txFailedSock = MAX_SOCK_NUM;
+  }
+
   if (isOpen(_sock))
   {
       int rv = closesocket(_sock);
@@ -202,6 +320,12 @@ void TCPClient::stop()
 
 uint8_t TCPClient::connected() 
 {
+  sendPendingIfDue();
+  if (isOpen(_sock) && _txFailedSock == _sock)
+  {
+    return false;
+  }
+
   // Wlan up, open and not in CLOSE_WAIT or data still in the local buffer
   bool rv = ( 1 == status() || bufferCount()) ? true : false;
   // no data in the local buffer, Socket open but my be in CLOSE_WAIT yet the CC3000 may have data in its buffer
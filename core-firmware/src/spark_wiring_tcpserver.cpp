@@ -89,6 +89,8 @@ TCPClient TCPServer::available()
 		return _client;
 	}
 
+	_client.flush(); // Output still queued for the previous client goes out before we replace it
+
 	sockaddr tClientAddr;
 	socklen_t tAddrLen = sizeof(tClientAddr);
 
@@ -115,3 +117,13 @@ size_t TCPServer::write(const uint8_t *buffer, size_t size)
 {
 	return _client.write(buffer, size);
 }
+
+size_t TCPServer::write(const uint8_t * const buffers[], const size_t sizes[], int count)
+{
+	return _client.write(buffers, sizes, count);
+}
+
+void TCPServer::flush()
+{
+	_client.flush();
+}
@@ -133,6 +133,48 @@ uint32_t WiFiClass::ping(IPAddress remoteIP, uint8_t nTries)
   return result;
 }
 
+// Non-blocking version of ping(): sends the pings and returns right away.
+// Returns false if the CC3000 refused them. Poll pingResult() for the outcome.
+bool WiFiClass::pingStart(IPAddress remoteIP, uint8_t nTries)
+{
+  uint32_t pingIPAddr = remoteIP[3] << 24 | remoteIP[2] << 16 | remoteIP[1] << 8 | remoteIP[0];
+  unsigned long pingSize = 32UL;
+  unsigned long pingTimeout = 500UL; // in milliseconds
+
+  memset(&ping_report,0,sizeof(netapp_pingreport_args_t));
+  ping_report_num = 0;
+
+  long psend = netapp_ping_send((UINT32*)&pingIPAddr, (unsigned long)nTries, pingSize, pingTimeout);
+  _pingDeadline = millis() + 2*nTries*pingTimeout;
+  _pingPending = (psend == 0L);
+
+  return _pingPending;
+}
+
+// Returns -1 while the pings started by pingStart() are in flight, otherwise the
+// number of packets received (0 if the ping report never came).
+int WiFiClass::pingResult(void)
+{
+  if (!_pingPending)
+  {
+    return 0;
+  }
+
+  if (ping_report_num)
+  {
+    _pingPending = false;
+    return ping_report.packets_received;
+  }
+
+  if ((long)(millis() - _pingDeadline) >= 0)
+  {
+    _pingPending = false;
+    return 0;
+  }
+
+  return -1;
+}
+
 void WiFiClass::connect(void)
 {
   if(!ready())
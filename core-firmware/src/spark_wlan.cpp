@@ -65,6 +65,7 @@ volatile uint8_t WLAN_SMART_CONFIG_FINISHED = 1;
 volatile uint8_t WLAN_SERIAL_CONFIG_DONE = 1;
 volatile uint8_t WLAN_CONNECTED;
 volatile uint8_t WLAN_DHCP;
+volatile uint32_t WLAN_DISCONNECT_EVENTS; //Counts unsolicited disconnects, even if the CC3000 reconnects on its own
 volatile uint8_t WLAN_CAN_SHUTDOWN;
 
 enum eWanTimings {
@@ -269,6 +270,7 @@ void WLAN_Async_Callback(long lEventType, char *data, unsigned char length)
 			}
 			WLAN_CONNECTED = 0;
 			WLAN_DHCP = 0;
+			WLAN_DISCONNECT_EVENTS++;
 			SPARK_CLOUD_SOCKETED = 0;
 			SPARK_CLOUD_CONNECTED = 0;
 			SPARK_FLASH_UPDATE = 0;
@@ -620,6 +620,18 @@ void RTCAlarm_IRQHandler(void)
 	}
 }
 
+/*******************************************************************************
+ * Function Name  : DMA1_Channel4_IRQHandler
+ * Description    : This function handles SPI2_RX_DMA interrupt request.
+ * Input          : None
+ * Output         : None
+ * Return         : None
+ *******************************************************************************/
+void DMA1_Channel4_IRQHandler(void)
+{
+	sFLASH_DMA_IntHandler();
+}
+
 /*******************************************************************************
  * Function Name  : DMA1_Channel5_IRQHandler
  * Description    : This function handles SPI2_TX_DMA interrupt request.
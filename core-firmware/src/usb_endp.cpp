@@ -25,6 +25,7 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "main.h"
+#include "ring_buffer.h"
 extern "C" {
 #include "usb_lib.h"
 #include "usb_desc.h"
@@ -47,8 +48,7 @@ extern uint32_t USART_Rx_ptr_out;
 extern uint32_t USART_Rx_length;
 
 extern uint8_t USB_Rx_Buffer[];
-extern uint16_t USB_Rx_length;
-extern uint16_t USB_Rx_ptr;
+extern RingBuffer<USB_RX_RING_SIZE> USB_Rx_Ring;
 
 extern uint8_t  USB_Tx_State;
 extern uint8_t  USB_Rx_State;
@@ -107,18 +107,33 @@ void EP1_IN_Callback (void)
 *******************************************************************************/
 void EP3_OUT_Callback(void)
 {
-  USB_Rx_State = 1;
-
-  USB_Rx_ptr = 0;
-
   /* Get the number of received data on the selected Endpoint */
-  USB_Rx_length = GetEPRxCount(ENDP3);
+  uint16_t USB_Rx_length = GetEPRxCount(ENDP3);
 
-  /* Use the memory interface function to write to the selected endpoint */
-  PMAToUserBufferCopy(USB_Rx_Buffer, ENDP3_RXADDR, USB_Rx_length);
+  /* Copy straight into the ring when the packet fits before it wraps */
+  unsigned int room;
+  uint8_t *dst = USB_Rx_Ring.write_span(room);
+  if (room >= USB_Rx_length)
+  {
+    PMAToUserBufferCopy(dst, ENDP3_RXADDR, USB_Rx_length);
+    USB_Rx_Ring.commit(USB_Rx_length);
+  }
+  else
+  {
+    PMAToUserBufferCopy(USB_Rx_Buffer, ENDP3_RXADDR, USB_Rx_length);
+    USB_Rx_Ring.push(USB_Rx_Buffer, USB_Rx_length);
+  }
 
-  /* USB data should be immediately processed, this allow next USB traffic being
-  NAKed till the end of the processing */
+  /* Keep receiving while another packet fits. Otherwise the next USB traffic is
+  NAKed until USB_USART_Receive_Data() makes room. */
+  if (USB_Rx_Ring.space() >= VIRTUAL_COM_PORT_DATA_SIZE)
+  {
+    SetEPRxValid(ENDP3);
+  }
+  else
+  {
+    USB_Rx_State = 1;
+  }
 }
 
 